@@ -6,6 +6,7 @@ import hashlib
 import json
 import shutil
 import logging
+import os
 
 from ci.os import OS, ARCH, getOS, getArch
 
@@ -52,6 +53,7 @@ class Toolchain:
 
     Linker: Optional[str] = None
     Linker_Flags: list[str] = field(default_factory=list)
+    Linker_Libs: list[str] = field(default_factory=list)
 
     Strip: Optional[str] = None
     Strip_Flags: list[str] = field(default_factory=list)
@@ -78,6 +80,15 @@ def hash_files(files: list[Path]) -> str:
                 
     return hasher.hexdigest()
 
+def has_library(compiler: str, header: str, lib: str, flags: list[str]) -> bool:
+    """True if 'header' is there and 'lib' links with 'flags' (e.g. a static build needs the .a)"""
+    source = f"#include <{header}>\nint main(void) {{ return 0; }}\n"
+    try:
+        result = subprocess.run([compiler, *flags, "-x", "c", "-", f"-l{lib}", "-o", os.devnull], input=source.encode(), capture_output=True)
+    except OSError:
+        return False
+    return result.returncode == 0
+
 def build_src(debug: bool, toolchain: Toolchain, buildCache: BuildCache, build_dir: Path, source_dir: Path, out: Path):
     patterns = ["*.c", "*.cpp"]
 
@@ -131,6 +142,7 @@ def build_src(debug: bool, toolchain: Toolchain, buildCache: BuildCache, build_d
 
     linker = toolchain.Linker
     flags = toolchain.Linker_Flags
+    libs = toolchain.Linker_Libs
 
     out.parent.mkdir(parents=True, exist_ok=True)
 
@@ -139,7 +151,7 @@ def build_src(debug: bool, toolchain: Toolchain, buildCache: BuildCache, build_d
 
         if not buildCache.is_up_to_date(out, content_hash):
             logger.info(f"Linking {out}")
-            subprocess.run([linker, *flags, *map(str, objects), "-o", str(out)], check=True)
+            subprocess.run([linker, *flags, *map(str, objects), *libs, "-o", str(out)], check=True)
 
             buildCache.update(out, content_hash)
     except subprocess.CalledProcessError as e:
@@ -206,6 +218,23 @@ def build(debug: bool, os: OS, arch: ARCH) -> bool:
         toolchain.Linker_Flags.append("-ldl")
         toolchain.Linker_Flags.append("-lm")
 
+        # zlib is part of every Linux and macOS base system, libraries have to
+        # come after the objects for static linking
+        toolchain.Compiler_C_Flags.append("-DLCT_HAVE_ZLIB")
+        toolchain.Compiler_CPP_Flags.append("-DLCT_HAVE_ZLIB")
+        toolchain.Linker_Libs.append("-lz")
+
+        # xz and zstd archives are decoded in-process when their libraries are
+        # installed, zstd falls back to the zstd tool otherwise
+        probe_flags = [] if debug else Static_Flags
+        for define, header, lib in [("LCT_HAVE_LZMA", "lzma.h", "lzma"), ("LCT_HAVE_ZSTD", "zstd.h", "zstd")]:
+            if has_library(toolchain.Compiler_C, header, lib, probe_flags):
+                toolchain.Compiler_C_Flags.append(f"-D{define}")
+                toolchain.Compiler_CPP_Flags.append(f"-D{define}")
+                toolchain.Linker_Libs.append(f"-l{lib}")
+            else:
+                logger.info(f"{header} or a {'static ' if probe_flags else ''}lib{lib} wasn't found, building without it")
+
         toolchain.Strip_Flags.append("--strip-unneeded")
     
     elif os == OS.macOS:
@@ -213,6 +242,10 @@ def build(debug: bool, os: OS, arch: ARCH) -> bool:
         toolchain.Linker_Flags.append("-lm")
         toolchain.Linker_Flags.append("-lc++")
 
+        toolchain.Compiler_C_Flags.append("-DLCT_HAVE_ZLIB")
+        toolchain.Compiler_CPP_Flags.append("-DLCT_HAVE_ZLIB")
+        toolchain.Linker_Libs.append("-lz")
+
         toolchain.Strip_Flags.append("-x")
         toolchain.Strip_Flags.append("-S")
 
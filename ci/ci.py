@@ -52,6 +52,20 @@ parser.add_argument(
     action="store_false",
     help="Stop before testing the project"
 )
+parser.add_argument(
+    "--bench",
+    dest="bench",
+    action="store_true",
+    help="Fail if read-only commands take longer than --bench-max to start"
+)
+parser.add_argument(
+    "--bench-max",
+    dest="bench_max",
+    metavar="MS",
+    type=float,
+    default=1.0,
+    help="Median startup time in milliseconds --bench allows (default: 1.0)"
+)
 parser.add_argument(
     "--no-log",
     dest="log",
@@ -109,16 +123,24 @@ def main(args, os: OS, arch: ARCH) -> bool:
         logger.error("Staging artifacts failed")
         return False
 
+    if (args.bench):
+        logger.info("Benchmarking startup")
+        executable = Path("dist/bin") / ("lct.exe" if os == OS.Windows else "lct")
+        ret = subprocess.run([str(executable), "bench", "startup", f"--max={args.bench_max}"])
+        if ret.returncode != 0:
+            logger.error("Startup is slower than the limit")
+            return False
+
     if (not args.test):
         logger.debug("Stopping before testing")
         return True
 
-    #logger.info("Starting tests")
-    #ret = subprocess.run([sys.executable, "tests/run.py"])
-    #if ret.returncode != 0:
-    #    logger.error("Tests failed")
-    #    return False
-    #logger.info("Finished tests")
+    logger.info("Starting tests")
+    ret = subprocess.run([sys.executable, "tests/run.py"])
+    if ret.returncode != 0:
+        logger.error("Tests failed")
+        return False
+    logger.info("Finished tests")
 
     return True
 
@@ -156,7 +178,7 @@ if __name__ == "__main__":
         build_console_handler.setFormatter(build_console_formatter)
         build_logger.addHandler(build_console_handler)
 
-    logger.debug(f"Debug: {args.debug}, Clean: {args.clean}, Build: {args.build}, Test: {args.test}, Archive: {args.archive}")
+    logger.debug(f"Debug: {args.debug}, Clean: {args.clean}, Build: {args.build}, Test: {args.test}, Bench: {args.bench}, Archive: {args.archive}")
     archive_name = args.archive_name or "lct"
     logger.debug(f"Archive name: {archive_name}")
 
@@ -0,0 +1,243 @@
+#include "bench.hpp"
+#include "../hash/sha256.h"
+#include "../format/format.hpp"
+#include "../shell/shell.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+namespace fs = std::filesystem;
+
+// Same granularity as a download chunk so the numbers match what downloads see
+static const std::size_t update_size = 16 * 1024;
+
+bool benchHash(std::uintmax_t size, bool use_ansi)
+{
+    const char* names[8];
+    const std::size_t count = std::min<std::size_t>(sha256Implementations(names, 8), 8);
+    const std::string active = sha256Implementation();
+
+    std::vector<unsigned char> buffer(update_size);
+    for (std::size_t i = 0; i < buffer.size(); i++) buffer[i] = static_cast<unsigned char>(i * 131 + 7);
+
+    std::cout << "=> Hashing ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << formatBytes(size);
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " with SHA-256 (default: " << active << ")" << std::endl;
+
+    bool agree = true;
+    std::string expected;
+    for (std::size_t i = 0; i < count; i++) {
+        sha256UseImplementation(names[i]);
+
+        SHA256 ctx;
+        sha256Init(&ctx);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (std::uintmax_t done = 0; done < size; done += update_size) {
+            const std::size_t want = static_cast<std::size_t>(std::min<std::uintmax_t>(size - done, update_size));
+            sha256Update(&ctx, buffer.data(), want);
+        }
+        unsigned char digest[SHA256_DIGEST_SIZE];
+        char hex[SHA256_HEX_SIZE];
+        sha256Final(&ctx, digest);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sha256Hex(digest, hex);
+
+        std::cout << "==> " << names[i] << ": ";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << formatRate(size, seconds);
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " (" << formatDuration(seconds) << ")" << std::endl;
+
+        if (expected.empty()) expected = hex;
+        else if (expected != hex) {
+            std::cerr << names[i] << " produced " << hex << " instead of " << expected << std::endl;
+            agree = false;
+        }
+    }
+
+    sha256UseImplementation(active.c_str());
+    return agree;
+}
+
+// Like a source tree: a hundred files per directory, mostly a few KiB
+static const std::size_t files_per_directory = 100;
+
+static std::uintmax_t treeBytes(const fs::path& root, std::size_t& files)
+{
+    std::uintmax_t bytes = 0;
+    files = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        files++;
+        bytes += it->file_size(ec);
+    }
+    return bytes;
+}
+
+static void printTiming(const char* what, std::size_t files, double seconds, bool use_ansi)
+{
+    std::cout << what;
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << formatDuration(seconds);
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " (" << static_cast<std::uintmax_t>(seconds > 0.0 ? files / seconds : 0.0) << " files/s)";
+}
+
+bool benchFiles(std::size_t files, bool use_ansi)
+{
+    const fs::path root = fs::temp_directory_path() / ("lct-bench-" + std::to_string(getpid()));
+    const fs::path tree = root / "tree";
+
+    std::error_code ec;
+    fs::create_directories(tree, ec);
+    if (ec) {
+        std::cerr << "Couldn't create " << tree.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(16 * 1024);
+    for (std::size_t i = 0; i < buffer.size(); i++) buffer[i] = static_cast<unsigned char>(i * 131 + 7);
+
+    FileBatch* batch = openFileBatch();
+    for (std::size_t i = 0; i < files; i++) {
+        const fs::path dir = tree / ("d" + std::to_string(i / files_per_directory));
+        if (i % files_per_directory == 0) fs::create_directories(dir, ec);
+        const std::size_t size = (i * 2654435761u) % buffer.size();
+        batchWrite(batch, (dir / ("f" + std::to_string(i))).string().c_str(), buffer.data(), size, 0644);
+    }
+    const bool generated = closeFileBatch(batch) == 0;
+
+    std::size_t expected_files;
+    const std::uintmax_t expected_bytes = treeBytes(tree, expected_files);
+
+    std::cout << "=> Copying and removing ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << expected_files << " files";
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " (" << formatBytes(expected_bytes) << ") in " << root.string() << std::endl;
+
+    bool same = generated;
+    const FileBackend backends[] = { FILE_BACKEND_SYNC, FILE_BACKEND_IO_URING };
+    for (FileBackend backend : backends) {
+        if (configureFileBackend(backend) != 0) {
+            std::cout << "==> io_uring: not available on this host" << std::endl;
+            continue;
+        }
+
+        const fs::path copied = root / fileBackendName();
+        auto start = std::chrono::steady_clock::now();
+        const bool copy_ok = copyTree(tree.string().c_str(), copied.string().c_str()) == 0;
+        const double copy_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::size_t copied_files;
+        const std::uintmax_t copied_bytes = treeBytes(copied, copied_files);
+
+        start = std::chrono::steady_clock::now();
+        const bool remove_ok = removeTree(copied.string().c_str()) == 0;
+        const double remove_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "==> " << fileBackendName() << ": ";
+        printTiming("copy ", expected_files, copy_seconds, use_ansi);
+        printTiming(", remove ", expected_files, remove_seconds, use_ansi);
+        std::cout << std::endl;
+
+        if (!copy_ok || !remove_ok || copied_files != expected_files || copied_bytes != expected_bytes) {
+            std::cerr << fileBackendName() << " copied " << copied_files << " files (" << copied_bytes << " bytes) instead of " << expected_files << " (" << expected_bytes << " bytes)" << std::endl;
+            same = false;
+        }
+    }
+
+    removeTree(root.string().c_str());
+    return same;
+}
+
+#ifndef _WIN32
+// Seconds from spawning 'self <command>' until it exited, -1 if it failed
+static double timeStartup(const char* self, const char* command)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+
+    char* args[] = {const_cast<char*>(self), const_cast<char*>(command), nullptr};
+    const auto start = std::chrono::steady_clock::now();
+    pid_t pid;
+    const int spawned = posix_spawnp(&pid, self, &actions, nullptr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) return -1.0;
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid) return -1.0;
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? seconds : -1.0;
+}
+
+bool benchStartup(const char* self, std::size_t runs, double limit, bool use_ansi)
+{
+    std::cout << "=> Starting ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << self;
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " " << runs << " times per command";
+    if (limit > 0.0) std::cout << " (limit: " << formatDuration(limit) << " median)";
+    std::cout << std::endl;
+
+    bool within = true;
+    const char* const commands[] = { "version", "path", "list" };
+    for (const char* command : commands) {
+        std::vector<double> times;
+        for (std::size_t i = 0; i < runs; i++) {
+            const double seconds = timeStartup(self, command);
+            if (seconds < 0.0) {
+                std::cerr << "'" << self << " " << command << "' failed" << std::endl;
+                return false;
+            }
+            times.push_back(seconds);
+        }
+        std::sort(times.begin(), times.end());
+        const double median = times[times.size() / 2];
+        const double slow = times[times.size() * 9 / 10];
+
+        std::cout << "==> " << command << ": ";
+        if (use_ansi) std::cout << (limit > 0.0 && median > limit ? "\033[31m" : "\033[36m");
+        std::cout << formatDuration(median);
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " median, " << formatDuration(slow) << " at p90" << std::endl;
+
+        if (limit > 0.0 && median > limit) {
+            std::cerr << command << " took " << formatDuration(median) << ", more than the limit of " << formatDuration(limit) << std::endl;
+            within = false;
+        }
+    }
+    return within;
+}
+#else
+bool benchStartup(const char* self, std::size_t runs, double limit, bool use_ansi)
+{
+    (void)self;
+    (void)runs;
+    (void)limit;
+    (void)use_ansi;
+    std::cerr << "The startup benchmark needs posix_spawn, which Windows doesn't have" << std::endl;
+    return false;
+}
+#endif
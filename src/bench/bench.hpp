@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Hashes 'size' bytes with every SHA-256 implementation this CPU supports and
+// prints the throughput of each, false if they don't agree on the digest
+bool benchHash(std::uintmax_t size, bool use_ansi);
+
+// Copies and removes a generated tree of 'files' small files with every file
+// backend this host has (see batch.h) and prints how long each one took, false
+// if a copy came out different from the tree
+bool benchFiles(std::size_t files, bool use_ansi);
+
+// Starts 'self' with each read-only command 'runs' times and prints the median
+// and slowest tenth of the wall times, false if a median is above 'limit' seconds
+// (0 for none) or a run failed. The children write to the null device.
+bool benchStartup(const char* self, std::size_t runs, double limit, bool use_ansi);
@@ -0,0 +1,478 @@
+#include "bundle.hpp"
+#include "../hash/sha256.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef LCT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static const char bundle_magic[] = "LCTBNDL1";
+static const std::size_t magic_size = sizeof(bundle_magic) - 1;
+static const std::size_t footer_size = 8 + 8 + magic_size;
+static const std::size_t chunk_size = 64 * 1024;
+
+static void writeU64(std::ostream& out, std::uint64_t value)
+{
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = static_cast<unsigned char>(value >> (i * 8));
+    out.write(reinterpret_cast<const char*>(bytes), 8);
+}
+
+static std::uint64_t readU64(const unsigned char* bytes)
+{
+    std::uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) value = (value << 8) | bytes[i];
+    return value;
+}
+
+bool BundleWriter::Create(const fs::path& bundle_path)
+{
+    out.open(bundle_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return false;
+
+    out.write(bundle_magic, magic_size);
+    offset = magic_size;
+    index = Bundle();
+    index.path = bundle_path;
+    index.platform = hostPlatform();
+
+    return static_cast<bool>(out);
+}
+
+void BundleWriter::Add(const std::string& name, const fs::path& src, bool compress)
+{
+    std::ifstream in(src, std::ios::binary);
+    if (!in.is_open()) throw std::runtime_error("Couldn't read " + src.string());
+
+    BundleFile file;
+    file.name = name;
+    file.offset = offset;
+    file.executable = (fs::status(src).permissions() & fs::perms::owner_exec) != fs::perms::none;
+
+#ifdef LCT_HAVE_ZLIB
+    file.compressed = compress;
+#else
+    (void)compress;
+#endif
+
+    SHA256 sha;
+    sha256Init(&sha);
+
+    std::vector<char> in_buf(chunk_size);
+    std::vector<char> out_buf(chunk_size);
+
+#ifdef LCT_HAVE_ZLIB
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (file.compressed && deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK) {
+        throw std::runtime_error("Couldn't initialize compression");
+    }
+#endif
+
+    bool done = false;
+    while (!done) {
+        in.read(in_buf.data(), in_buf.size());
+        const std::streamsize count = in.gcount();
+        if (in.bad()) break;
+        done = in.eof();
+
+        sha256Update(&sha, in_buf.data(), static_cast<std::size_t>(count));
+        file.size += static_cast<std::uint64_t>(count);
+
+        if (!file.compressed) {
+            out.write(in_buf.data(), count);
+            file.stored += static_cast<std::uint64_t>(count);
+            continue;
+        }
+
+#ifdef LCT_HAVE_ZLIB
+        zs.next_in = reinterpret_cast<Bytef*>(in_buf.data());
+        zs.avail_in = static_cast<uInt>(count);
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(out_buf.data());
+            zs.avail_out = static_cast<uInt>(out_buf.size());
+            deflate(&zs, done ? Z_FINISH : Z_NO_FLUSH);
+
+            const std::size_t produced = out_buf.size() - zs.avail_out;
+            out.write(out_buf.data(), produced);
+            file.stored += produced;
+        } while (zs.avail_out == 0);
+#endif
+    }
+
+#ifdef LCT_HAVE_ZLIB
+    if (file.compressed) deflateEnd(&zs);
+#endif
+
+    if (in.bad() || !out) throw std::runtime_error("Couldn't add " + src.string() + " to bundle");
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256Final(&sha, digest);
+    sha256Hex(digest, hex);
+    file.hash = hex;
+
+    offset += file.stored;
+    index.files.push_back(std::move(file));
+}
+
+void BundleWriter::Finish()
+{
+    std::string text = "bundle=1\nplatform=" + index.platform + "\n";
+    for (const std::string& version : index.versions) {
+        text += "version=" + version + "\n";
+    }
+    for (const BundleFile& file : index.files) {
+        std::string flags;
+        if (file.compressed) flags += 'z';
+        if (file.executable) flags += 'x';
+        if (flags.empty()) flags = "-";
+
+        text += "file=" + file.name + "," + std::to_string(file.offset) + "," + std::to_string(file.stored) + "," +
+                std::to_string(file.size) + "," + file.hash + "," + flags + "\n";
+    }
+
+    out.write(text.data(), text.size());
+    writeU64(out, offset);
+    writeU64(out, text.size());
+    out.write(bundle_magic, magic_size);
+    out.close();
+
+    if (!out) throw std::runtime_error("Couldn't write bundle " + index.path.string());
+}
+
+static bool parseFile(const std::string& line, BundleFile& file)
+{
+    // The name comes first and is the only field that could contain a comma
+    std::string fields[5];
+    std::size_t end = line.size();
+    for (int i = 4; i >= 0; i--) {
+        std::size_t comma = line.rfind(',', end - 1);
+        if (comma == std::string::npos || comma < 5) return false;
+        fields[i] = line.substr(comma + 1, end - comma - 1);
+        end = comma;
+    }
+
+    file.name = line.substr(5, end - 5);
+    file.offset = std::strtoull(fields[0].c_str(), nullptr, 10);
+    file.stored = std::strtoull(fields[1].c_str(), nullptr, 10);
+    file.size = std::strtoull(fields[2].c_str(), nullptr, 10);
+    file.hash = fields[3];
+    file.compressed = fields[4].find('z') != std::string::npos;
+    file.executable = fields[4].find('x') != std::string::npos;
+    return !file.name.empty();
+}
+
+// Names are relative paths of '/' separated components, so no file of a bundle
+// can end up outside the directory it is extracted to
+static bool validName(const std::string& name)
+{
+    if (name.empty() || name.find_first_of("\\:") != std::string::npos) return false;
+
+    std::size_t start = 0;
+    while (start <= name.size()) {
+        std::size_t end = name.find('/', start);
+        if (end == std::string::npos) end = name.size();
+        const std::string component = name.substr(start, end - start);
+        if (component.empty() || component == "." || component == "..") return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+bool Bundle::Open(const fs::path& bundle_path)
+{
+    path = bundle_path;
+    platform.clear();
+    versions.clear();
+    files.clear();
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+
+    in.seekg(0, std::ios::end);
+    const std::uint64_t total = static_cast<std::uint64_t>(in.tellg());
+    if (total < magic_size + footer_size) return false;
+
+    unsigned char footer[footer_size];
+    in.seekg(static_cast<std::streamoff>(total - footer_size));
+    in.read(reinterpret_cast<char*>(footer), footer_size);
+    if (!in || std::memcmp(footer + 16, bundle_magic, magic_size) != 0) return false;
+
+    const std::uint64_t index_offset = readU64(footer);
+    const std::uint64_t index_size = readU64(footer + 8);
+    if (index_offset < magic_size || index_offset + index_size + footer_size != total) return false;
+
+    std::string text(index_size, '\0');
+    in.seekg(static_cast<std::streamoff>(index_offset));
+    in.read(&text[0], static_cast<std::streamsize>(index_size));
+    if (!in) return false;
+
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t newline = text.find('\n', pos);
+        if (newline == std::string::npos) newline = text.size();
+        const std::string line = text.substr(pos, newline - pos);
+        pos = newline + 1;
+
+        if (line.rfind("platform=", 0) == 0) {
+            platform = line.substr(9);
+        } else if (line.rfind("version=", 0) == 0) {
+            versions.push_back(line.substr(8));
+        } else if (line.rfind("file=", 0) == 0) {
+            BundleFile file;
+            if (!parseFile(line, file) || !validName(file.name) || file.offset + file.stored > index_offset) return false;
+            files.push_back(std::move(file));
+        }
+    }
+
+    return !platform.empty();
+}
+
+void Bundle::Extract(const BundleFile& file, const fs::path& dst) const
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) throw std::runtime_error("Couldn't read bundle " + path.string());
+    in.seekg(static_cast<std::streamoff>(file.offset));
+
+    std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("Couldn't write " + dst.string());
+
+    SHA256 sha;
+    sha256Init(&sha);
+
+    std::vector<char> in_buf(chunk_size);
+    std::vector<char> out_buf(chunk_size);
+    std::uint64_t remaining = file.stored;
+    std::uint64_t written = 0;
+    bool damaged = false;
+
+#ifdef LCT_HAVE_ZLIB
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (file.compressed && inflateInit(&zs) != Z_OK) {
+        throw std::runtime_error("Couldn't initialize decompression");
+    }
+#else
+    if (file.compressed) {
+        throw std::runtime_error("This build of lct can't decompress " + file.name);
+    }
+#endif
+
+    while (remaining > 0 && !damaged) {
+        const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, in_buf.size()));
+        in.read(in_buf.data(), want);
+        if (static_cast<std::size_t>(in.gcount()) != want) {
+            damaged = true;
+            break;
+        }
+        remaining -= want;
+
+        if (!file.compressed) {
+            sha256Update(&sha, in_buf.data(), want);
+            out.write(in_buf.data(), want);
+            written += want;
+            continue;
+        }
+
+#ifdef LCT_HAVE_ZLIB
+        zs.next_in = reinterpret_cast<Bytef*>(in_buf.data());
+        zs.avail_in = static_cast<uInt>(want);
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(out_buf.data());
+            zs.avail_out = static_cast<uInt>(out_buf.size());
+            const int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                damaged = true;
+                break;
+            }
+
+            const std::size_t produced = out_buf.size() - zs.avail_out;
+            sha256Update(&sha, out_buf.data(), produced);
+            out.write(out_buf.data(), produced);
+            written += produced;
+        } while (zs.avail_out == 0);
+#endif
+    }
+
+#ifdef LCT_HAVE_ZLIB
+    if (file.compressed) inflateEnd(&zs);
+#endif
+
+    out.close();
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256Final(&sha, digest);
+    sha256Hex(digest, hex);
+
+    if (damaged || !out || written != file.size || file.hash != hex) {
+        std::error_code ec;
+        fs::remove(dst, ec);
+        throw std::runtime_error(file.name + " in bundle " + path.string() + " is damaged");
+    }
+
+    if (file.executable) {
+        std::error_code ec;
+        fs::permissions(dst, fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec, fs::perm_options::add, ec);
+    }
+}
+
+std::vector<std::pair<std::string, std::string>> Bundle::Entries() const
+{
+    std::vector<std::pair<std::string, std::string>> entries;
+
+    for (const BundleFile& file : files) {
+        if (file.name.rfind("store/", 0) != 0 || !validName(file.name)) continue;
+
+        const std::size_t version_end = file.name.find('/', 6);
+        if (version_end == std::string::npos) continue;
+        const std::size_t tool_end = file.name.find('/', version_end + 1);
+        if (tool_end == std::string::npos) continue;
+
+        std::pair<std::string, std::string> entry(file.name.substr(6, version_end - 6), file.name.substr(version_end + 1, tool_end - version_end - 1));
+        if (isHostOnly(entry.first)) continue;
+        if (std::find(entries.begin(), entries.end(), entry) == entries.end()) entries.push_back(std::move(entry));
+    }
+
+    return entries;
+}
+
+BundleStats exportBundle(const fs::path& bundle_path, const std::vector<StoreEntry>& entries, const std::vector<fs::path>& archives)
+{
+    const auto start = std::chrono::steady_clock::now();
+    BundleStats stats;
+
+    // Written next to the destination first so an interrupted export doesn't leave a broken bundle
+    const fs::path tmp = bundle_path.string() + ".tmp-" + std::to_string(getpid());
+
+    BundleWriter writer;
+    if (!writer.Create(tmp)) throw std::runtime_error("Couldn't create " + bundle_path.string());
+
+    try {
+        for (const fs::path& archive : archives) {
+            // Source archives are compressed already
+            writer.Add("archives/" + archive.filename().string(), archive, false);
+            stats.archives++;
+        }
+
+        for (const StoreEntry& entry : entries) {
+            if (isHostOnly(entry.version)) continue;
+            for (const StoreFile& file : entry.files) {
+                writer.Add("store/" + entry.version + "/" + entry.tool + "/" + file.path, entry.path / file.path, true);
+            }
+            if (std::find(writer.index.versions.begin(), writer.index.versions.end(), entry.version) == writer.index.versions.end()) {
+                writer.index.versions.push_back(entry.version);
+            }
+            stats.entries++;
+        }
+
+        writer.Finish();
+    } catch (const std::runtime_error&) {
+        writer.out.close();
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+
+    std::error_code ec;
+    fs::rename(tmp, bundle_path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        throw std::runtime_error("Couldn't create " + bundle_path.string());
+    }
+
+    for (const BundleFile& file : writer.index.files) {
+        stats.size += file.size;
+        stats.stored += file.stored;
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+BundleStats importBundle(const Bundle& bundle, const Store& store, const fs::path& archive_dir, const std::vector<std::pair<std::string, std::string>>& entries)
+{
+    const auto start = std::chrono::steady_clock::now();
+    BundleStats stats;
+
+    // Checked before anything is written, a single bad name rejects the whole bundle
+    for (const BundleFile& file : bundle.files) {
+        if (!validName(file.name)) throw std::runtime_error("Bundle " + bundle.path.string() + " has an invalid file name: " + file.name);
+    }
+
+    std::error_code ec;
+    fs::create_directories(archive_dir, ec);
+
+    // Archives work on every platform with the same archive format, so they are always imported
+    for (const BundleFile& file : bundle.files) {
+        if (file.name.rfind("archives/", 0) != 0) continue;
+
+        const fs::path dst = archive_dir / fs::path(file.name.substr(9)).filename();
+        if (fs::exists(dst, ec)) continue;
+
+        const fs::path tmp = dst.string() + ".tmp-" + std::to_string(getpid());
+        bundle.Extract(file, tmp);
+        fs::rename(tmp, dst, ec);
+        if (ec) {
+            fs::remove(tmp, ec);
+            throw std::runtime_error("Couldn't write " + dst.string());
+        }
+
+        stats.archives++;
+        stats.size += file.size;
+        stats.stored += file.stored;
+    }
+
+    if (bundle.platform != hostPlatform()) {
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+    // Entries are rebuilt as a 'dist/' and published like a fresh build, which
+    // hashes them once more into the objects of the store
+    const fs::path staging = archive_dir / ("bundle-" + std::to_string(getpid()));
+
+    for (const auto& [version, tool] : entries) {
+        if (store.Has(version, tool)) continue;
+
+        const std::string prefix = "store/" + version + "/" + tool + "/";
+
+        fs::remove_all(staging, ec);
+        try {
+            for (const BundleFile& file : bundle.files) {
+                if (file.name.rfind(prefix, 0) != 0) continue;
+
+                const fs::path dst = staging / file.name.substr(prefix.size());
+                fs::create_directories(dst.parent_path());
+                bundle.Extract(file, dst);
+
+                stats.size += file.size;
+                stats.stored += file.stored;
+            }
+
+            store.Publish(staging, version, tool);
+        } catch (const std::exception&) {
+            fs::remove_all(staging, ec);
+            throw;
+        }
+
+        stats.entries++;
+    }
+
+    fs::remove_all(staging, ec);
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include "../store/store.hpp"
+
+// A bundle carries everything a site needs to install without network access in
+// a single file: the source archives and the prebuilt store entries of one platform.
+// Every file is compressed on its own and listed in an index at the end of the
+// bundle, so single files can be extracted without reading the rest.
+//
+// Layout: "LCTBNDL1", file data..., index, index offset (u64 LE), index size (u64 LE), "LCTBNDL1"
+// Files are named 'archives/<archive>' and 'store/<version>/<tool>/<path>'.
+
+struct BundleFile {
+    std::string name;
+    std::uint64_t offset = 0;
+    std::uint64_t stored = 0;
+    std::uint64_t size = 0;
+    std::string hash;
+    bool compressed = false;
+    bool executable = false;
+};
+
+struct BundleStats {
+    std::uintmax_t entries = 0;
+    std::uintmax_t archives = 0;
+    std::uintmax_t size = 0;
+    std::uintmax_t stored = 0;
+    double seconds = 0.0;
+};
+
+struct Bundle {
+    std::filesystem::path path;
+    std::string platform;
+    std::vector<std::string> versions;
+    std::vector<BundleFile> files;
+
+    // Only reads the index, fails on file names that are absolute or have '.' or '..' components
+    bool Open(const std::filesystem::path& bundle_path);
+
+    // Throws if the file is damaged, its size and hash are checked against the index
+    void Extract(const BundleFile& file, const std::filesystem::path& dst) const;
+
+    // Version and tool of every store entry in the bundle
+    std::vector<std::pair<std::string, std::string>> Entries() const;
+};
+
+struct BundleWriter {
+    std::ofstream out;
+    std::uint64_t offset = 0;
+    Bundle index;
+
+    bool Create(const std::filesystem::path& bundle_path);
+    void Add(const std::string& name, const std::filesystem::path& src, bool compress);
+    void Finish();
+};
+
+BundleStats exportBundle(const std::filesystem::path& bundle_path, const std::vector<StoreEntry>& entries, const std::vector<std::filesystem::path>& archives);
+
+// Entries already in the store and archives already cached are skipped
+BundleStats importBundle(const Bundle& bundle, const Store& store, const std::filesystem::path& archive_dir, const std::vector<std::pair<std::string, std::string>>& entries);
@@ -0,0 +1,79 @@
+#include "config.hpp"
+#include <fstream>
+#include <cstdlib>
+#include <cctype>
+
+static std::string trim(const std::string& str)
+{
+    std::size_t begin = 0;
+    std::size_t end = str.size();
+    while (begin < end && std::isspace(static_cast<unsigned char>(str[begin]))) begin++;
+    while (end > begin && std::isspace(static_cast<unsigned char>(str[end - 1]))) end--;
+    return str.substr(begin, end - begin);
+}
+
+bool Config::Load(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path);
+    if (!ifs.is_open()) return true;
+
+    std::string line;
+    while (std::getline(ifs, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        std::size_t equals = line.find('=');
+        if (equals == std::string::npos) continue;
+
+        std::string key = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+        if (!key.empty()) values[key] = value;
+    }
+
+    return true;
+}
+
+std::optional<std::string> Config::Get(const std::string& key) const
+{
+    std::string env_name = "LCT_";
+    for (char c : key) {
+        env_name += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+
+    const char* env = std::getenv(env_name.c_str());
+    if (env && *env) return std::string(env);
+
+    auto it = values.find(key);
+    if (it == values.end() || it->second.empty())
+        return std::nullopt;
+
+    return it->second;
+}
+
+bool Config::GetBool(const std::string& key, bool fallback) const
+{
+    std::optional<std::string> value = Get(key);
+    if (!value.has_value()) return fallback;
+
+    return *value == "1" || *value == "true" || *value == "yes" || *value == "on";
+}
+
+std::vector<std::string> Config::GetList(const std::string& key) const
+{
+    std::vector<std::string> list;
+
+    std::optional<std::string> value = Get(key);
+    if (!value.has_value()) return list;
+
+    std::size_t pos = 0;
+    while (pos <= value->size()) {
+        std::size_t comma = value->find(',', pos);
+        if (comma == std::string::npos) comma = value->size();
+
+        std::string item = trim(value->substr(pos, comma - pos));
+        if (!item.empty()) list.push_back(item);
+        pos = comma + 1;
+    }
+
+    return list;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <unordered_map>
+#include <string>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+// Settings are read from "key=value" lines. Later files override earlier ones
+// and an environment variable LCT_<KEY> (uppercased) overrides every file.
+struct Config {
+    std::unordered_map<std::string, std::string> values;
+
+    bool Load(const std::filesystem::path& path);
+
+    std::optional<std::string> Get(const std::string& key) const;
+
+    inline std::string GetString(const std::string& key, const std::string& fallback) const
+    {
+        std::optional<std::string> value = Get(key);
+        return value.has_value() ? *value : fallback;
+    }
+
+    bool GetBool(const std::string& key, bool fallback) const;
+
+    // Comma separated values, empty ones are dropped
+    std::vector<std::string> GetList(const std::string& key) const;
+};
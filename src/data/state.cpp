@@ -1,5 +1,7 @@
 #include "state.hpp"
+#include <cstdlib>
 #include <fstream>
+#include <string>
 
 bool State::Save(const std::filesystem::path& path) const
 {
@@ -9,8 +11,24 @@ bool State::Save(const std::filesystem::path& path) const
     std::ofstream ofs(tmp, std::ios::trunc);
     if (!ofs.is_open()) return false;
 
-    for (const std::pair<const std::string, std::string>& kv : installed_tools) {
-        ofs << "tool=" << kv.first << "," << kv.second << "\n";
+    // "tool=" holds the active version, so older versions of lct still understand the file
+    for (const std::pair<const std::string, ToolState>& kv : installed_tools) {
+        ofs << "tool=" << kv.first << "," << kv.second.active << "\n";
+        for (const std::string& version : kv.second.versions) {
+            if (version != kv.second.active) ofs << "version=" << kv.first << "," << version << "\n";
+        }
+        for (const std::pair<const std::string, std::string>& profile : kv.second.profiles) {
+            ofs << "profile=" << kv.first << "," << profile.first << "," << profile.second << "\n";
+        }
+        for (const InstalledFile& file : kv.second.files) {
+            // The path goes last, it is the only field that could contain a comma
+            ofs << "file=" << kv.first << "," << std::oct << file.mode << std::dec << "," << file.size << "," << file.mtime << "," << file.hash << "," << file.path << "\n";
+        }
+        if (!ofs) return false;
+    }
+
+    for (const std::pair<const std::string, std::string>& kv : staged_tools) {
+        ofs << "staged=" << kv.first << "," << kv.second << "\n";
         if (!ofs) return false;
     }
 
@@ -29,6 +47,7 @@ bool State::Save(const std::filesystem::path& path) const
 
 bool State::Load(const std::filesystem::path& path) {
     installed_tools.clear();
+    staged_tools.clear();
 
     std::ifstream ifs(path);
     if (!ifs.is_open()) return true;
@@ -40,10 +59,80 @@ bool State::Load(const std::filesystem::path& path) {
             if (comma != std::string::npos) {
                 std::string name = line.substr(5, comma - 5);
                 std::string version = line.substr(comma + 1);
-                installed_tools[name] = version;
+                SetTool(name, version);
+            }
+        } else if (line.rfind("version=", 0) == 0) {
+            std::size_t comma = line.find(',', 8);
+            if (comma != std::string::npos) {
+                std::string name = line.substr(8, comma - 8);
+                std::string version = line.substr(comma + 1);
+                AddVersion(name, version);
+            }
+        } else if (line.rfind("profile=", 0) == 0) {
+            // "profile=<tool>,<version>,<profile>"
+            std::size_t comma = line.find(',', 8);
+            std::size_t last = line.rfind(',');
+            if (comma != std::string::npos && last != comma) {
+                SetProfile(line.substr(8, comma - 8), line.substr(comma + 1, last - comma - 1), line.substr(last + 1));
+            }
+        } else if (line.rfind("file=", 0) == 0) {
+            // "file=<tool>,<mode>,<size>,<mtime>,<hash>,<path>" after the "tool=" line of its tool
+            std::size_t commas[5];
+            std::size_t pos = 4;
+            std::size_t found = 0;
+            while (found < 5 && (pos = line.find(',', pos + 1)) != std::string::npos) commas[found++] = pos;
+
+            auto it = found == 5 ? installed_tools.find(line.substr(5, commas[0] - 5)) : installed_tools.end();
+            if (it != installed_tools.end()) {
+                InstalledFile file;
+                file.mode = static_cast<unsigned int>(std::strtoul(line.c_str() + commas[0] + 1, nullptr, 8));
+                file.size = std::strtoull(line.c_str() + commas[1] + 1, nullptr, 10);
+                file.mtime = std::strtoll(line.c_str() + commas[2] + 1, nullptr, 10);
+                file.hash = line.substr(commas[3] + 1, commas[4] - commas[3] - 1);
+                file.path = line.substr(commas[4] + 1);
+                it->second.files.push_back(file);
+            }
+        } else if (line.rfind("staged=", 0) == 0) {
+            std::size_t comma = line.find(',', 7);
+            if (comma != std::string::npos) {
+                staged_tools[line.substr(7, comma - 7)] = line.substr(comma + 1);
             }
         }
     }
 
     return true;
 }
+
+void rotateGenerations(const std::filesystem::path& state_file, const std::filesystem::path& dir, unsigned int keep)
+{
+    std::error_code ec;
+    if (keep == 0 || !std::filesystem::exists(state_file, ec)) return;
+
+    std::filesystem::create_directories(dir, ec);
+    if (ec) return;
+
+    std::filesystem::remove(dir / (std::to_string(keep) + ".state"), ec);
+    for (unsigned int i = keep - 1; i >= 1; i--) {
+        std::filesystem::path from = dir / (std::to_string(i) + ".state");
+        if (std::filesystem::exists(from, ec)) {
+            std::filesystem::rename(from, dir / (std::to_string(i + 1) + ".state"), ec);
+        }
+    }
+
+    std::filesystem::copy_file(state_file, dir / "1.state", std::filesystem::copy_options::overwrite_existing, ec);
+}
+
+std::vector<State> loadGenerations(const std::filesystem::path& dir)
+{
+    std::vector<State> generations;
+
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".state") continue;
+
+        State state;
+        if (state.Load(it->path())) generations.push_back(std::move(state));
+    }
+
+    return generations;
+}
@@ -4,9 +4,36 @@
 #include <string>
 #include <filesystem>
 #include <optional>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// A file the active version of a tool put into current/
+struct InstalledFile {
+    std::string path; // relative to current/, with '/' separators
+    std::uintmax_t size = 0;
+    unsigned int mode = 0; // permission bits
+    std::string hash;
+    std::int64_t mtime = 0; // ticks of the file clock after activation, 0 if unknown
+};
+
+struct ToolState {
+    // The active version is the one linked into current/
+    std::string active;
+    std::vector<std::string> versions;
+
+    // Build profile of every version that isn't a default release build
+    std::unordered_map<std::string, std::string> profiles;
+
+    // What activating the active version installed, empty if an older lct did
+    std::vector<InstalledFile> files;
+};
 
 struct State {
-    std::unordered_map<std::string, std::string> installed_tools;
+    std::unordered_map<std::string, ToolState> installed_tools;
+
+    // Versions fetched into the store ahead of an update
+    std::unordered_map<std::string, std::string> staged_tools;
 
     bool Save(const std::filesystem::path& path) const;
     bool Load(const std::filesystem::path& path);
@@ -16,22 +43,163 @@ struct State {
         return installed_tools.find(name) != installed_tools.end();
     }
 
+    inline bool IsInstalled(const std::string& name, const std::string& version) const
+    {
+        auto it = installed_tools.find(name);
+        if (it == installed_tools.end())
+            return false;
+
+        const std::vector<std::string>& versions = it->second.versions;
+        return std::find(versions.begin(), versions.end(), version) != versions.end();
+    }
+
     inline std::optional<std::reference_wrapper<const std::string>> GetVersion(const std::string& name) const
     {
         auto it = installed_tools.find(name);
         if (it == installed_tools.end())
             return std::nullopt;
 
-        return it->second;
+        return it->second.active;
+    }
+
+    inline std::string GetProfile(const std::string& name, const std::string& version) const
+    {
+        auto it = installed_tools.find(name);
+        if (it == installed_tools.end())
+            return "";
+
+        auto profile = it->second.profiles.find(version);
+        if (profile == it->second.profiles.end())
+            return "";
+
+        return profile->second;
+    }
+
+    // The profile of the active version, new versions of the tool get it too
+    inline std::string GetProfile(const std::string& name) const
+    {
+        auto it = installed_tools.find(name);
+        if (it == installed_tools.end())
+            return "";
+
+        return GetProfile(name, it->second.active);
+    }
+
+    inline void SetProfile(const std::string& name, const std::string& version, const std::string& profile)
+    {
+        auto it = installed_tools.find(name);
+        if (it == installed_tools.end())
+            return;
+
+        if (profile.empty()) it->second.profiles.erase(version);
+        else                 it->second.profiles[version] = profile;
+    }
+
+    inline std::vector<InstalledFile> GetFiles(const std::string& name) const
+    {
+        auto it = installed_tools.find(name);
+        if (it == installed_tools.end())
+            return {};
+
+        return it->second.files;
+    }
+
+    // Activation comes before the install is recorded, so this adds the tool if needed
+    inline void SetFiles(const std::string& name, const std::vector<InstalledFile>& files)
+    {
+        installed_tools[name].files = files;
+    }
+
+    // Every tool that installed 'path' with 'hash' shares the file that is there now
+    inline void SetMtime(const std::string& path, const std::string& hash, std::int64_t mtime)
+    {
+        for (auto& [tool, tool_state] : installed_tools) {
+            for (InstalledFile& file : tool_state.files) {
+                if (file.path == path && file.hash == hash) file.mtime = mtime;
+            }
+        }
+    }
+
+    // True if a tool other than 'name' installed 'path' (e.g. the shared LICENSE)
+    inline bool IsShared(const std::string& path, const std::string& name) const
+    {
+        for (const auto& [tool, tool_state] : installed_tools) {
+            if (tool == name) continue;
+            for (const InstalledFile& file : tool_state.files) {
+                if (file.path == path) return true;
+            }
+        }
+        return false;
+    }
+
+    inline std::vector<std::string> GetVersions(const std::string& name) const
+    {
+        auto it = installed_tools.find(name);
+        if (it == installed_tools.end())
+            return {};
+
+        return it->second.versions;
+    }
+
+    inline void AddVersion(const std::string& name, const std::string& version)
+    {
+        ToolState& tool = installed_tools[name];
+        if (std::find(tool.versions.begin(), tool.versions.end(), version) == tool.versions.end())
+            tool.versions.push_back(version);
+        if (tool.active.empty())
+            tool.active = version;
     }
 
     inline void SetTool(const std::string& name, const std::string& version)
     {
-        installed_tools[name] = version;
+        AddVersion(name, version);
+        installed_tools[name].active = version;
+    }
+
+    // Returns the version that is active afterwards, empty if none is left. If
+    // 'version' was active, the one 'rank' puts highest of those left takes over.
+    inline std::string RemoveVersion(const std::string& name, const std::string& version, int (*rank)(const std::string&))
+    {
+        auto it = installed_tools.find(name);
+        if (it == installed_tools.end())
+            return "";
+
+        std::vector<std::string>& versions = it->second.versions;
+        versions.erase(std::remove(versions.begin(), versions.end(), version), versions.end());
+        it->second.profiles.erase(version);
+        if (versions.empty()) {
+            installed_tools.erase(it);
+            staged_tools.erase(name);
+            return "";
+        }
+
+        if (it->second.active == version) {
+            it->second.active = *std::max_element(versions.begin(), versions.end(), [rank](const std::string& a, const std::string& b) {
+                return rank(a) < rank(b);
+            });
+        }
+
+        return it->second.active;
     }
 
     inline void RemoveTool(const std::string& name)
     {
         installed_tools.erase(name);
+        staged_tools.erase(name);
+    }
+
+    inline void StageTool(const std::string& name, const std::string& version)
+    {
+        staged_tools[name] = version;
+    }
+
+    inline void UnstageTool(const std::string& name)
+    {
+        staged_tools.erase(name);
     }
 };
+
+// Previous states are kept as <dir>/<n>.state (1 is the newest) so that
+// whatever they reference can be rolled back to and isn't garbage collected
+void rotateGenerations(const std::filesystem::path& state_file, const std::filesystem::path& dir, unsigned int keep);
+std::vector<State> loadGenerations(const std::filesystem::path& dir);
@@ -0,0 +1,299 @@
+#include "decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LCT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LCT_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef LCT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+static const char* const extensions[CODEC_COUNT] = { "gz", "xz", "zst" };
+
+#define INPUT_SIZE (64 * 1024)
+
+struct Decoder {
+    ArchiveCodec codec;
+    FILE* file; // the archive, or the output of the zstd tool when 'piped'
+    int piped;
+    int input_done;
+    int finished;
+    unsigned long long decoded;
+#ifdef LCT_HAVE_ZLIB
+    gzFile gz;
+#endif
+#ifdef LCT_HAVE_LZMA
+    lzma_stream xz;
+#endif
+#ifdef LCT_HAVE_ZSTD
+    ZSTD_DStream* zstd;
+    ZSTD_inBuffer zstd_in;
+    size_t zstd_left; // 0 when the last frame was complete
+#endif
+    unsigned char input[INPUT_SIZE];
+};
+
+const char* codecExtension(ArchiveCodec codec)
+{
+    return extensions[codec];
+}
+
+int codecByName(const char* extension)
+{
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        if (strcmp(extension, extensions[i]) == 0) return i;
+    }
+    return -1;
+}
+
+int codecOfFile(const char* path)
+{
+    const size_t length = strlen(path);
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        const size_t ext_length = strlen(extensions[i]) + 5;
+        if (length > ext_length && strncmp(path + length - ext_length, ".tar.", 5) == 0 && strcmp(path + length - ext_length + 5, extensions[i]) == 0) return i;
+    }
+    return -1;
+}
+
+#if !defined(LCT_HAVE_ZSTD) && !defined(_WIN32)
+static int zstdToolFound(void)
+{
+    static int found = -1;
+    if (found < 0) found = system("zstd --version >/dev/null 2>&1") == 0;
+    return found;
+}
+#endif
+
+int codecAvailable(ArchiveCodec codec)
+{
+    switch (codec) {
+#ifdef LCT_HAVE_ZLIB
+        case CODEC_GZIP: return 1;
+#endif
+#ifdef LCT_HAVE_LZMA
+        case CODEC_XZ: return 1;
+#endif
+        case CODEC_ZSTD:
+#if defined(LCT_HAVE_ZSTD)
+            return 1;
+#elif !defined(_WIN32)
+            return zstdToolFound();
+#else
+            return 0;
+#endif
+        default: return 0;
+    }
+}
+
+#if !defined(LCT_HAVE_ZSTD) && !defined(_WIN32)
+// Runs "zstd -dcq -- '<path>'", the path quoted for sh
+static FILE* openZstdTool(const char* path)
+{
+    size_t length = strlen("zstd -dcq -- ''") + 1;
+    for (const char* c = path; *c; c++) length += *c == '\'' ? 4 : 1;
+
+    char* cmd = malloc(length);
+    if (!cmd) return NULL;
+    char* out = cmd + sprintf(cmd, "zstd -dcq -- '");
+    for (const char* c = path; *c; c++) {
+        if (*c == '\'') {
+            memcpy(out, "'\\''", 4);
+            out += 4;
+        } else *out++ = *c;
+    }
+    strcpy(out, "'");
+
+    FILE* pipe = popen(cmd, "r");
+    free(cmd);
+    return pipe;
+}
+#endif
+
+Decoder* openDecoder(const char* path, ArchiveCodec codec)
+{
+    if (!codecAvailable(codec)) return NULL;
+
+    Decoder* decoder = calloc(1, sizeof(Decoder));
+    if (!decoder) return NULL;
+    decoder->codec = codec;
+
+    int ok = 0;
+    switch (codec) {
+#ifdef LCT_HAVE_ZLIB
+        case CODEC_GZIP:
+            decoder->gz = gzopen(path, "rb");
+            ok = decoder->gz != NULL;
+            if (ok) gzbuffer(decoder->gz, INPUT_SIZE);
+            break;
+#endif
+#ifdef LCT_HAVE_LZMA
+        case CODEC_XZ: {
+            const lzma_stream init = LZMA_STREAM_INIT;
+            decoder->xz = init;
+            decoder->file = fopen(path, "rb");
+            ok = decoder->file && lzma_stream_decoder(&decoder->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+            break;
+        }
+#endif
+        case CODEC_ZSTD:
+#if defined(LCT_HAVE_ZSTD)
+            decoder->file = fopen(path, "rb");
+            decoder->zstd = ZSTD_createDStream();
+            ok = decoder->file && decoder->zstd && !ZSTD_isError(ZSTD_initDStream(decoder->zstd));
+#elif !defined(_WIN32)
+            decoder->file = openZstdTool(path);
+            decoder->piped = 1;
+            ok = decoder->file != NULL;
+#endif
+            break;
+        default:
+            break;
+    }
+
+    if (!ok) {
+        closeDecoder(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+// Refills 'input' once it was used up, returns how many bytes it holds
+static size_t refill(Decoder* decoder)
+{
+    if (decoder->input_done) return 0;
+    const size_t read = fread(decoder->input, 1, INPUT_SIZE, decoder->file);
+    if (read < INPUT_SIZE) decoder->input_done = 1;
+    return read;
+}
+
+static long decode(Decoder* decoder, void* buffer, size_t size)
+{
+    if (decoder->finished || size == 0) return 0;
+
+    switch (decoder->codec) {
+#ifdef LCT_HAVE_ZLIB
+        case CODEC_GZIP: {
+            const int read = gzread(decoder->gz, buffer, (unsigned int)(size > INPUT_SIZE ? INPUT_SIZE : size));
+            if (read > 0) return read;
+
+            // A truncated archive ends without an error from gzread()
+            int error;
+            gzerror(decoder->gz, &error);
+            if (read < 0 || error != Z_OK) return -1;
+            decoder->finished = 1;
+            return 0;
+        }
+#endif
+#ifdef LCT_HAVE_LZMA
+        case CODEC_XZ: {
+            lzma_stream* xz = &decoder->xz;
+            xz->next_out = buffer;
+            xz->avail_out = size;
+            while (xz->avail_out == size) {
+                if (xz->avail_in == 0 && !decoder->input_done) {
+                    xz->next_in = decoder->input;
+                    xz->avail_in = refill(decoder);
+                    if (ferror(decoder->file)) return -1;
+                }
+
+                // More streams may follow until the input ends
+                const lzma_ret ret = lzma_code(xz, decoder->input_done && xz->avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+                if (ret == LZMA_STREAM_END) {
+                    decoder->finished = 1;
+                    break;
+                }
+                if (ret != LZMA_OK) return -1;
+            }
+            return (long)(size - xz->avail_out);
+        }
+#endif
+        case CODEC_ZSTD:
+#if defined(LCT_HAVE_ZSTD)
+        {
+            ZSTD_outBuffer out = { buffer, size, 0 };
+            ZSTD_inBuffer* in = &decoder->zstd_in;
+            while (out.pos == 0) {
+                if (in->pos == in->size) {
+                    in->src = decoder->input;
+                    in->size = refill(decoder);
+                    in->pos = 0;
+                    if (ferror(decoder->file)) return -1;
+                    if (in->size == 0) {
+                        // The input may only end between frames
+                        if (decoder->zstd_left != 0) return -1;
+                        decoder->finished = 1;
+                        return 0;
+                    }
+                }
+
+                decoder->zstd_left = ZSTD_decompressStream(decoder->zstd, &out, in);
+                if (ZSTD_isError(decoder->zstd_left)) return -1;
+            }
+            return (long)out.pos;
+        }
+#elif !defined(_WIN32)
+        {
+            const size_t read = fread(buffer, 1, size, decoder->file);
+            if (read == 0) {
+                if (ferror(decoder->file)) return -1;
+                decoder->finished = 1;
+            }
+            return (long)read;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+long readDecoder(Decoder* decoder, void* buffer, size_t size)
+{
+    const long read = decode(decoder, buffer, size);
+    if (read > 0) decoder->decoded += (unsigned long long)read;
+    return read;
+}
+
+unsigned long long decodedBytes(const Decoder* decoder)
+{
+    return decoder->decoded;
+}
+
+int closeDecoder(Decoder* decoder)
+{
+    if (!decoder) return -1;
+
+    int ok = decoder->finished;
+#ifdef LCT_HAVE_ZLIB
+    if (decoder->gz && gzclose(decoder->gz) != Z_OK) ok = 0;
+#endif
+#ifdef LCT_HAVE_LZMA
+    if (decoder->codec == CODEC_XZ) lzma_end(&decoder->xz);
+#endif
+#ifdef LCT_HAVE_ZSTD
+    if (decoder->zstd) ZSTD_freeDStream(decoder->zstd);
+#endif
+
+    if (decoder->file) {
+#ifndef _WIN32
+        if (decoder->piped) {
+            // The tool's exit status is what says whether the stream was valid
+            const int status = pclose(decoder->file);
+            if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = 0;
+        } else
+#endif
+        fclose(decoder->file);
+    }
+
+    free(decoder);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compressions source archives may come in, "<version>.tar.<extension>"
+typedef enum ArchiveCodec {
+    CODEC_GZIP,
+    CODEC_XZ,
+    CODEC_ZSTD,
+    CODEC_COUNT
+} ArchiveCodec;
+
+// "gz", "xz" or "zst"
+const char* codecExtension(ArchiveCodec codec);
+
+// The codec with this extension, -1 if there is none
+int codecByName(const char* extension);
+
+// The codec of a "*.tar.<extension>" file, -1 if it isn't one
+int codecOfFile(const char* path);
+
+// True if this build can decode it: gzip and xz are linked in when their
+// libraries were found, zstd is too or goes through the zstd tool otherwise
+int codecAvailable(ArchiveCodec codec);
+
+typedef struct Decoder Decoder;
+
+Decoder* openDecoder(const char* path, ArchiveCodec codec);
+
+// Reads up to 'size' decompressed bytes, returns 0 at the end and -1 on errors
+long readDecoder(Decoder* decoder, void* buffer, size_t size);
+
+// How many decompressed bytes were read so far
+unsigned long long decodedBytes(const Decoder* decoder);
+
+// Returns 0 if the whole stream was read and was valid
+int closeDecoder(Decoder* decoder);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,136 @@
+#include "git.hpp"
+#include "../shell/shell.h"
+#include "../format/format.hpp"
+#include "../events/events.hpp"
+#include "transfer.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+const char* const default_git_url = "https://github.com/Jonathan1324/LCT.git";
+
+static std::string quote(const std::string& str)
+{
+#ifdef _WIN32
+    return "\"" + str + "\"";
+#else
+    std::string quoted = "'";
+    for (char c : str) {
+        if (c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+#endif
+}
+
+static bool git(const std::string& args, std::string* output = nullptr)
+{
+    CommandResult res = invokeSystemCall(("git " + args).c_str());
+    if (output && res.stdout_str) *output = res.stdout_str;
+    std::free(res.stdout_str);
+    std::free(res.stderr_str);
+    return res.exit_code == 0;
+}
+
+// Bytes of loose and packed objects in the mirror
+static std::uintmax_t objectsSize(const std::string& mirror)
+{
+    std::string output;
+    if (!git("-C " + mirror + " count-objects -v", &output)) return 0;
+
+    std::uintmax_t kib = 0;
+    std::istringstream lines(output);
+    std::string key;
+    std::uintmax_t value;
+    while (lines >> key >> value) {
+        if (key == "size:" || key == "size-pack:") kib += value;
+    }
+    return kib * 1024;
+}
+
+bool GitSource::Available()
+{
+    return git("--version");
+}
+
+bool GitSource::Fetch(const std::string& version, bool use_ansi) const
+{
+    const std::string mirror = quote(mirror_dir.string());
+    const std::string tag = "refs/tags/" + version;
+
+    std::error_code ec;
+    if (!fs::exists(mirror_dir / "HEAD", ec)) {
+        fs::create_directories(mirror_dir.parent_path(), ec);
+        if (!git("init -q --bare " + mirror)) return false;
+    }
+
+    if (git("-C " + mirror + " rev-parse -q --verify " + quote(tag + "^{commit}"))) return true;
+
+    std::cout << "==> Fetching ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << version;
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " into the git mirror..." << '\n';
+
+    // Takes a connection slot like any other download and gives up on stalls the
+    // same way, git has no bandwidth cap though so limit_rate doesn't apply
+    const DownloadLimits& limits = downloadLimits();
+    std::string options;
+    if (limits.stall_timeout > 0) options = "-c http.lowSpeedLimit=1024 -c http.lowSpeedTime=" + std::to_string(limits.stall_timeout) + " ";
+
+    ConnectionSlot slot;
+    EventPhase phase("fetch", version);
+
+    const std::uintmax_t before = objectsSize(mirror);
+    if (!git(options + "-C " + mirror + " fetch -q --no-tags " + quote(url) + " " + quote("+" + tag + ":" + tag))) {
+        phase.Fail();
+        return false;
+    }
+    const std::uintmax_t after = objectsSize(mirror);
+
+    std::cout << "==> Fetched " << formatBytes(after > before ? after - before : 0) << " of new objects" << '\n';
+    return true;
+}
+
+std::uintmax_t GitSource::TreeSize(const std::string& version) const
+{
+    std::string output;
+    if (!git("-C " + quote(mirror_dir.string()) + " ls-tree -r -l " + quote("refs/tags/" + version + "^{commit}"), &output)) return 0;
+
+    // "<mode> blob <object> <size>\t<path>"
+    std::uintmax_t size = 0;
+    std::istringstream lines(output);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string mode, type, object, bytes;
+        if (fields >> mode >> type >> object >> bytes && type == "blob") size += std::strtoull(bytes.c_str(), nullptr, 10);
+    }
+    return size;
+}
+
+bool GitSource::Checkout(const std::string& version, const std::vector<std::string>& excluded, const fs::path& dest) const
+{
+    const std::string mirror = quote(mirror_dir.string());
+    git("-C " + mirror + " worktree prune");
+
+    std::error_code ec;
+    fs::remove_all(dest, ec);
+    const std::string worktree = quote(dest.string());
+    if (!git("-C " + mirror + " worktree add -q -f --detach --no-checkout " + worktree + " " + quote("refs/tags/" + version + "^{commit}"))) return false;
+
+    // Older gits without non-cone sparse checkouts just get everything
+    if (!excluded.empty()) {
+        std::string patterns = quote("/*");
+        for (const std::string& dir : excluded) patterns += " " + quote("!/" + dir + "/");
+        git("-C " + worktree + " sparse-checkout set --no-cone " + patterns);
+    }
+
+    if (!git("-C " + worktree + " read-tree -mu HEAD")) {
+        fs::remove_all(dest, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Keeps a bare mirror of the LCT repository and checks versions out of it as
+// worktrees, so a new tag only fetches the objects earlier tags didn't bring.
+// 'url' can be anything git fetches from, including a local bare repository.
+struct GitSource {
+    std::string url;
+    std::filesystem::path mirror_dir;
+
+    inline bool Enabled() const
+    {
+        return !url.empty() && !mirror_dir.empty();
+    }
+
+    static bool Available();
+
+    // Makes sure the mirror has the tag of 'version', false if git failed
+    bool Fetch(const std::string& version, bool use_ansi) const;
+
+    // Bytes of all files at the tag, 0 if unknown
+    std::uintmax_t TreeSize(const std::string& version) const;
+
+    // Checks a fetched 'version' out as a worktree at 'dest' without the 'excluded'
+    // directories, false if git failed and the caller has to fall back to the
+    // archive. Worktrees that were deleted are pruned by the next checkout.
+    bool Checkout(const std::string& version, const std::vector<std::string>& excluded, const std::filesystem::path& dest) const;
+};
+
+extern const char* const default_git_url;
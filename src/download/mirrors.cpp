@@ -0,0 +1,388 @@
+#include "mirrors.hpp"
+#include "transfer.hpp"
+#include "../store/objects.hpp"
+#include "../shell/shell.h"
+#include "../format/format.hpp"
+#include "../events/events.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+const char* const default_mirror = "https://github.com/Jonathan1324/LCT/archive/refs/tags/";
+
+// A mirror that failed this often in a row is only tried last until the time is up
+static const unsigned int bench_failures = 3;
+static const std::time_t bench_seconds = 60 * 60;
+
+static const unsigned int probe_timeout = 3;
+
+// Weight of the newest sample in the moving averages
+static const double average_weight = 0.3;
+
+static double average(double previous, double sample)
+{
+    if (previous <= 0.0) return sample;
+    return previous + average_weight * (sample - previous);
+}
+
+static std::string joinUrl(const std::string& base, const std::string& file)
+{
+    if (!base.empty() && base.back() == '/') return base + file;
+    return base + "/" + file;
+}
+
+static std::string archiveName(const std::string& version, ArchiveCodec codec)
+{
+    return version + ".tar." + codecExtension(codec);
+}
+
+// Until measured: zstd unpacks several times faster than gzip, xz compresses best but is slowest
+static const CodecStats typical_codecs[CODEC_COUNT] = {
+    {0.25, 150e6},
+    {0.18, 50e6},
+    {0.21, 400e6},
+};
+
+// Assumed for downloads while no mirror was measured yet
+static const double typical_throughput = 5e6;
+
+// Reads "<sha256>  <file>" lines as written by sha256sum, '*' marks binary mode
+static void loadHashes(const fs::path& path, std::unordered_map<std::string, std::string>& hashes, bool overwrite)
+{
+    std::ifstream ifs(path);
+    if (!ifs.is_open()) return;
+
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.size() < 66 || line[64] != ' ') continue;
+
+        std::string file = line.substr(65);
+        if (!file.empty() && (file[0] == ' ' || file[0] == '*')) file.erase(0, 1);
+        if (!file.empty() && file.back() == '\r') file.pop_back();
+        if (file.empty()) continue;
+
+        if (overwrite || hashes.find(file) == hashes.end()) hashes[file] = line.substr(0, 64);
+    }
+}
+
+void Sources::Load()
+{
+    health.clear();
+    hashes.clear();
+    released.clear();
+
+    // The release manifest wins over what was remembered
+    if (!hashes_file.empty()) loadHashes(hashes_file, hashes, true);
+    if (!release_manifest.empty()) {
+        std::unordered_map<std::string, std::string> listed;
+        loadHashes(release_manifest, listed, true);
+        for (const auto& [file, hash] : listed) {
+            hashes[file] = hash;
+            released.insert(file);
+        }
+    }
+
+    std::ifstream ifs(stats_file);
+    if (!ifs.is_open()) return;
+
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.rfind("codec=", 0) == 0) {
+            std::istringstream fields(line.substr(6));
+            std::string name, ratio, speed;
+            const int codec = std::getline(fields, name, ',') && std::getline(fields, ratio, ',') && std::getline(fields, speed) ? codecByName(name.c_str()) : -1;
+            if (codec >= 0) {
+                codecs[codec].ratio = std::strtod(ratio.c_str(), nullptr);
+                codecs[codec].speed = std::strtod(speed.c_str(), nullptr);
+            }
+            continue;
+        }
+        if (line.rfind("mirror=", 0) != 0) continue;
+
+        // The url comes first and is the only field that could contain a comma
+        std::string fields[6];
+        std::size_t end = line.size();
+        bool valid = true;
+        for (int i = 5; i >= 0 && valid; i--) {
+            std::size_t comma = line.rfind(',', end - 1);
+            if (comma == std::string::npos || comma < 7) valid = false;
+            else {
+                fields[i] = line.substr(comma + 1, end - comma - 1);
+                end = comma;
+            }
+        }
+        if (!valid) continue;
+
+        MirrorHealth mirror;
+        mirror.successes = static_cast<unsigned int>(std::strtoul(fields[0].c_str(), nullptr, 10));
+        mirror.failures = static_cast<unsigned int>(std::strtoul(fields[1].c_str(), nullptr, 10));
+        mirror.failures_in_row = static_cast<unsigned int>(std::strtoul(fields[2].c_str(), nullptr, 10));
+        mirror.latency = std::strtod(fields[3].c_str(), nullptr);
+        mirror.throughput = std::strtod(fields[4].c_str(), nullptr);
+        mirror.last_failure = static_cast<std::time_t>(std::strtoll(fields[5].c_str(), nullptr, 10));
+        health[line.substr(7, end - 7)] = mirror;
+    }
+}
+
+void Sources::Save() const
+{
+    if (stats_file.empty()) return;
+
+    const fs::path tmp = stats_file.string() + ".tmp-" + std::to_string(getpid());
+    {
+        std::ofstream ofs(tmp, std::ios::trunc);
+        if (!ofs.is_open()) return;
+
+        for (const auto& [url, mirror] : health) {
+            ofs << "mirror=" << url << "," << mirror.successes << "," << mirror.failures << "," << mirror.failures_in_row << ","
+                << mirror.latency << "," << mirror.throughput << "," << static_cast<long long>(mirror.last_failure) << "\n";
+        }
+        for (int i = 0; i < CODEC_COUNT; i++) {
+            if (codecs[i].speed <= 0.0) continue;
+            ofs << "codec=" << codecExtension(static_cast<ArchiveCodec>(i)) << "," << codecs[i].ratio << "," << codecs[i].speed << "\n";
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tmp, stats_file, ec);
+    if (ec) fs::remove(tmp, ec);
+}
+
+bool Sources::Check(const std::string& file, const std::string& hash)
+{
+    if (hash.empty()) return false;
+
+    auto it = hashes.find(file);
+    if (it != hashes.end()) return it->second == hash;
+
+    hashes[file] = hash;
+    if (!hashes_file.empty()) {
+        std::ofstream ofs(hashes_file, std::ios::app);
+        ofs << hash << "  " << file << "\n";
+    }
+    return true;
+}
+
+std::vector<std::string> Sources::Rank(const std::string& file)
+{
+    const std::time_t now = std::time(nullptr);
+
+    std::vector<std::string> ready;
+    std::vector<std::string> benched;
+    for (const std::string& mirror : mirrors) {
+        const MirrorHealth& h = health[mirror];
+        if (h.failures_in_row >= bench_failures && now - h.last_failure < bench_seconds) benched.push_back(mirror);
+        else ready.push_back(mirror);
+    }
+
+    // Mirrors without any samples yet come first so they get measured
+    std::stable_sort(ready.begin(), ready.end(), [&](const std::string& a, const std::string& b) {
+        const MirrorHealth& ha = health[a];
+        const MirrorHealth& hb = health[b];
+        if (ha.failures_in_row != hb.failures_in_row) return ha.failures_in_row < hb.failures_in_row;
+        return ha.latency < hb.latency;
+    });
+
+    if (probe && ready.size() > 1) {
+        std::vector<std::string> urls;
+        std::vector<const char*> url_ptrs;
+        for (const std::string& mirror : ready) urls.push_back(joinUrl(mirror, file));
+        for (const std::string& url : urls) url_ptrs.push_back(url.c_str());
+
+        CommandResult res = curlProbe(url_ptrs.data(), url_ptrs.size(), probe_timeout);
+
+        std::unordered_map<std::string, double> answered;
+        if (res.stdout_str) {
+            std::istringstream lines(res.stdout_str);
+            std::string url;
+            int status;
+            double seconds;
+            while (lines >> url >> status >> seconds) {
+                if (status >= 200 && status < 400) answered[url] = seconds;
+            }
+        }
+
+        // Without any answer (e.g. curl is too old to race) the recorded health has to do
+        if (!answered.empty()) {
+            std::vector<std::pair<double, std::string>> fast;
+            std::vector<std::string> silent;
+            for (std::size_t i = 0; i < ready.size(); i++) {
+                auto it = answered.find(urls[i]);
+                MirrorHealth& h = health[ready[i]];
+                if (it == answered.end()) {
+                    h.failures++;
+                    h.failures_in_row++;
+                    h.last_failure = now;
+                    silent.push_back(ready[i]);
+                } else {
+                    h.latency = average(h.latency, it->second);
+                    fast.push_back({it->second, ready[i]});
+                }
+            }
+
+            // A mirror that answers quickly but failed its last transfers (e.g. stalled) stays behind
+            std::stable_sort(fast.begin(), fast.end(), [&](const auto& a, const auto& b) {
+                const unsigned int fa = health[a.second].failures_in_row;
+                const unsigned int fb = health[b.second].failures_in_row;
+                if (fa != fb) return fa < fb;
+                return a.first < b.first;
+            });
+
+            ready.clear();
+            for (const auto& mirror : fast) ready.push_back(mirror.second);
+            ready.insert(ready.end(), silent.begin(), silent.end());
+        }
+    }
+
+    ready.insert(ready.end(), benched.begin(), benched.end());
+    return ready;
+}
+
+static void printDownloaded(const DownloadResult& result, bool use_ansi)
+{
+    std::cout << "==> Downloaded ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << formatBytes(result.bytes);
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " in " << formatDuration(result.seconds) << " (" << formatRate(result.bytes, result.seconds) << ")" << '\n';
+}
+
+CodecStats Sources::Stats(ArchiveCodec codec) const
+{
+    CodecStats stats = codecs[codec];
+    if (stats.ratio <= 0.0) stats.ratio = typical_codecs[codec].ratio;
+    if (stats.speed <= 0.0) stats.speed = typical_codecs[codec].speed;
+    return stats;
+}
+
+std::vector<ArchiveCodec> Sources::Formats(const std::string& version) const
+{
+    bool listed = false;
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        if (released.count(archiveName(version, static_cast<ArchiveCodec>(i))) > 0) listed = true;
+    }
+
+    std::vector<ArchiveCodec> formats;
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        const ArchiveCodec codec = static_cast<ArchiveCodec>(i);
+        const std::string file = archiveName(version, codec);
+
+        std::error_code ec;
+        bool offered = fs::is_regular_file(archive_dir / file, ec);
+        if (listed) offered = offered || released.count(file) > 0;
+        else offered = offered || std::find(archive_formats.begin(), archive_formats.end(), codecExtension(codec)) != archive_formats.end();
+
+        // tar unpacks gzip when zlib is missing
+        if (offered && (codec == CODEC_GZIP || codecAvailable(codec))) formats.push_back(codec);
+    }
+    if (formats.empty()) formats.push_back(CODEC_GZIP);
+
+    double throughput = 0.0;
+    for (const auto& [mirror, h] : health) throughput = std::max(throughput, h.throughput);
+    if (throughput <= 0.0) throughput = typical_throughput;
+
+    // Seconds per unpacked byte, a cached archive doesn't have to be downloaded
+    auto cost = [&](ArchiveCodec codec) {
+        const CodecStats stats = Stats(codec);
+        std::error_code ec;
+        const double transfer = fs::is_regular_file(archive_dir / archiveName(version, codec), ec) ? 0.0 : stats.ratio / throughput;
+        return transfer + 1.0 / stats.speed;
+    };
+    std::stable_sort(formats.begin(), formats.end(), [&](ArchiveCodec a, ArchiveCodec b) { return cost(a) < cost(b); });
+    return formats;
+}
+
+void Sources::Record(ArchiveCodec codec, std::uintmax_t archive_bytes, std::uintmax_t unpacked_bytes, double seconds)
+{
+    if (archive_bytes == 0 || unpacked_bytes == 0 || seconds <= 0.0) return;
+
+    CodecStats& stats = codecs[codec];
+    stats.ratio = average(stats.ratio, static_cast<double>(archive_bytes) / static_cast<double>(unpacked_bytes));
+    stats.speed = average(stats.speed, static_cast<double>(unpacked_bytes) / seconds);
+    Save();
+}
+
+fs::path Sources::Download(const std::string& version, bool use_ansi)
+{
+#ifdef _WIN32
+    return Fetch(version + ".zip", use_ansi);
+#else
+    const std::vector<ArchiveCodec> formats = Formats(version);
+    for (std::size_t i = 0; i < formats.size(); i++) {
+        const std::string file = archiveName(version, formats[i]);
+        const fs::path archive = Fetch(file, use_ansi);
+        if (!archive.empty()) return archive;
+        if (i + 1 < formats.size()) printWarning("Couldn't get " + file + ", trying " + archiveName(version, formats[i + 1]), use_ansi);
+    }
+    return fs::path();
+#endif
+}
+
+fs::path Sources::Fetch(const std::string& file, bool use_ansi)
+{
+    const fs::path dst = archive_dir / file;
+
+    // Archives are kept as a cache (e.g. imported from a bundle) until gc evicts them
+    std::error_code ec;
+    if (fs::is_regular_file(dst, ec)) {
+        if (Check(file, hashFile(dst))) return dst;
+        printWarning("Cached " + file + " doesn't match its SHA-256, downloading it again", use_ansi);
+        fs::remove(dst, ec);
+    }
+
+    fs::create_directories(archive_dir, ec);
+
+    for (const std::string& peer : peers) {
+        const DownloadResult result = downloadFile(joinUrl(joinUrl(peer, "archives"), file), dst);
+        if (!result.ok) continue;
+        if (Check(file, result.hash)) {
+            printDownloaded(result, use_ansi);
+            return dst;
+        }
+        printWarning(file + " from " + peer + " doesn't match its SHA-256", use_ansi);
+        fs::remove(dst, ec);
+    }
+
+    const std::vector<std::string> ranked = Rank(file);
+    for (std::size_t i = 0; i < ranked.size(); i++) {
+        const std::string& mirror = ranked[i];
+        MirrorHealth& h = health[mirror];
+
+        DownloadResult result = downloadFile(joinUrl(mirror, file), dst);
+        if (result.ok && !Check(file, result.hash)) {
+            printWarning(file + " from " + mirror + " doesn't match its SHA-256", use_ansi);
+            fs::remove(dst, ec);
+            result.ok = false;
+        }
+        if (result.ok) {
+            h.successes++;
+            h.failures_in_row = 0;
+            // Throttled transfers say nothing about the mirror
+            if (result.seconds > 0.0 && downloadLimits().rate == 0) {
+                h.throughput = average(h.throughput, static_cast<double>(result.bytes) / result.seconds);
+            }
+            Save();
+            printDownloaded(result, use_ansi);
+            return dst;
+        }
+
+        h.failures++;
+        h.failures_in_row++;
+        h.last_failure = std::time(nullptr);
+
+        if (i + 1 < ranked.size()) printWarning("Download from " + mirror + " failed, trying the next mirror", use_ansi);
+    }
+
+    Save();
+    return fs::path();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include "git.hpp"
+#include "decode.h"
+
+struct MirrorHealth {
+    unsigned int successes = 0;
+    unsigned int failures = 0;
+    unsigned int failures_in_row = 0;
+    double latency = 0.0;    // seconds until the first byte, moving average
+    double throughput = 0.0; // bytes per second, moving average
+    std::time_t last_failure = 0;
+};
+
+// How archives of a codec did on this host, moving averages
+struct CodecStats {
+    double ratio = 0.0; // archive size / unpacked size
+    double speed = 0.0; // unpacked bytes per second
+};
+
+// Where source archives come from: the archive cache, then the peers, then the
+// mirrors. Mirrors are raced with HEAD requests and tried fastest first, one that
+// failed repeatedly is benched for a while. How every mirror did is kept in
+// 'stats_file' so later runs start with the good ones.
+//
+// Every archive is checked against its SHA-256 from 'release_manifest' (a
+// sha256sum style list published with the releases) and otherwise from
+// 'hashes_file', which remembers the hash an archive had the first time it
+// was seen. Downloads are hashed while they stream in, a mismatch counts as
+// a failure of that source.
+//
+// A version can come as "<version>.tar.gz", ".tar.xz" or ".tar.zst": the ones
+// the release manifest lists, or 'archive_formats' without one. Of those the
+// one expected to be downloaded and unpacked the quickest is tried first,
+// judged by the throughput of the mirrors and how well each codec compressed
+// and how fast it unpacked here before.
+struct Sources {
+    std::filesystem::path archive_dir;
+    std::filesystem::path stats_file;
+    std::filesystem::path hashes_file;
+    std::filesystem::path release_manifest;
+    std::vector<std::string> peers;
+    std::vector<std::string> mirrors;
+    GitSource git; // used instead of the archives when enabled
+
+    // Where sources are unpacked and built, see Workspace
+    std::string build_root = "auto";
+    std::unordered_map<std::string, MirrorHealth> health;
+    std::unordered_map<std::string, std::string> hashes;
+    std::unordered_set<std::string> released; // the files listed in 'release_manifest'
+
+    std::vector<std::string> archive_formats = {"gz"};
+    CodecStats codecs[CODEC_COUNT];
+
+    bool probe = true;
+
+    void Load();
+    void Save() const;
+
+    // False if 'hash' isn't the one expected for 'file', remembers it if nothing is expected yet
+    bool Check(const std::string& file, const std::string& hash);
+
+    // Mirrors in the order they should be tried for 'file'
+    std::vector<std::string> Rank(const std::string& file);
+
+    // Measured, or typical values until an archive of 'codec' was unpacked
+    CodecStats Stats(ArchiveCodec codec) const;
+
+    // Codecs to try for 'version', cheapest first
+    std::vector<ArchiveCodec> Formats(const std::string& version) const;
+
+    // Remembers how an archive compressed and how fast it unpacked
+    void Record(ArchiveCodec codec, std::uintmax_t archive_bytes, std::uintmax_t unpacked_bytes, double seconds);
+
+    // Returns the cached or downloaded 'file', empty if every source failed
+    std::filesystem::path Fetch(const std::string& file, bool use_ansi);
+
+    // Returns the cached or downloaded archive in the first format that could be had
+    std::filesystem::path Download(const std::string& version, bool use_ansi);
+};
+
+extern const char* const default_mirror;
@@ -1,4 +1,5 @@
 #include "source.h"
+#include "untar.h"
 #include "../shell/shell.h"
 #include <string.h>
 #include <stdlib.h>
@@ -84,79 +85,31 @@ static char* find_top_level_folder(const char* base_dir)
 #endif
 }
 
-char* downloadSource(const char* version, const char* path)
+char* unpackSource(const char* file_path, const char* path, const char* version, const char* const* excludes, size_t exclude_count, unsigned long long* unpacked_bytes)
 {
-    if (!version) return NULL;
+    if (!file_path || !path || !version) return NULL;
+    if (unpacked_bytes) *unpacked_bytes = 0;
 
-    const char base1[] = "https://github.com/Jonathan1324/LCT/archive/refs/tags/";
 #ifdef _WIN32
-    const char base2[] = ".zip";
-#else
-    const char base2[] = ".tar.gz";
-#endif
-
-    size_t base1_len = sizeof(base1) - 1;
-    size_t base2_len = sizeof(base2) - 1;
-    size_t version_len = strlen(version);
-    size_t path_len = strlen(path);
-
-    size_t url_len = base1_len + version_len + base2_len + 1;
-    char* url = (char*)malloc(url_len);
-    if (!url) return NULL;
-
-    char* pos = url;
-    memcpy(pos, base1, base1_len);
-    pos += base1_len;
-    memcpy(pos, version, version_len);
-    pos += version_len;
-    memcpy(pos, base2, base2_len);
-    pos += base2_len;
-    *pos = '\0';
-
-    size_t file_len = path_len + 1 + version_len + base2_len + 1;
-    char* file_path = (char*)malloc(file_len);
-    if (!file_path) {
-        free(url);
-        return NULL;
-    }
-    pos = file_path;
-    memcpy(pos, path, path_len);
-    pos += path_len;
-    *pos = '/';
-    pos++;
-    memcpy(pos, version, version_len);
-    pos += version_len;
-    memcpy(pos, base2, base2_len);
-    pos += base2_len;
-    *pos = '\0';
-
-    CommandResult res = curl(url, file_path);
-    free(url);
-
+    (void)excludes;
+    (void)exclude_count;
+    CommandResult res = unzip(file_path, path);
     if (res.exit_code != 0) {
-        free(file_path);
         return NULL;
     }
-
-    return file_path;
-}
-
-char* unpackSource(const char* file_path, const char* path, const char* version)
-{
-    if (!file_path || !path || !version) return NULL;
-
-    CommandResult res;
-#ifdef _WIN32
-    res = unzip(file_path, path);
 #else
-    res = tar_gz(file_path, path);
-#endif
-
-    if (res.exit_code != 0) {
+    const int codec = codecOfFile(file_path);
+    if (codec == CODEC_GZIP && !codecAvailable(CODEC_GZIP)) {
+        // Built without zlib, tar knows gzip anyway
+        CommandResult res = tar_gz_excluding(file_path, path, excludes, exclude_count);
+        if (res.exit_code != 0) {
+            return NULL;
+        }
+    } else if (codec < 0 || untar(file_path, (ArchiveCodec)codec, path, excludes, exclude_count, unpacked_bytes) != 0) {
         return NULL;
     }
+#endif
 
-    sh_remove(file_path);
     char* top_level_folder = find_top_level_folder(path);
 
     return top_level_folder;
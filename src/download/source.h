@@ -1,11 +1,16 @@
 #pragma once
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-char* downloadSource(const char* version, const char* path);
-char* unpackSource(const char* file_path, const char* path, const char* version);
+// Returns the top-level folder the archive unpacked into, members matching one
+// of 'excludes' are skipped (only for tar archives, zips are always unpacked whole).
+// Tar archives are unpacked in-process, see untar(), 'unpacked_bytes' is set to
+// their decompressed size and to 0 when it isn't known.
+char* unpackSource(const char* file_path, const char* path, const char* version, const char* const* excludes, size_t exclude_count, unsigned long long* unpacked_bytes);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,214 @@
+#include "transfer.hpp"
+#include "../hash/sha256.h"
+#include "../events/events.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#define popen _popen
+#define pclose _pclose
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static const std::size_t chunk_size = 16 * 1024;
+
+static DownloadLimits limits;
+static DownloadTotals totals;
+
+// Allows 'rate' bytes per second on average with bursts of up to a quarter second,
+// a chunk bigger than that puts the bucket into debt which is slept off
+struct TokenBucket {
+    double tokens = 0.0;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    void Take(std::size_t bytes)
+    {
+        if (limits.rate == 0) return;
+
+        const double rate = static_cast<double>(limits.rate);
+        const double capacity = rate / 4.0;
+
+        const auto now = std::chrono::steady_clock::now();
+        tokens = std::min(capacity, tokens + std::chrono::duration<double>(now - last).count() * rate);
+        last = now;
+
+        tokens -= static_cast<double>(bytes);
+        if (tokens >= 0.0) return;
+
+        const double wait = -tokens / rate;
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        totals.throttled += wait;
+    }
+};
+
+static TokenBucket bucket;
+
+ConnectionSlot::ConnectionSlot()
+{
+#ifndef _WIN32
+    if (limits.connections == 0 || limits.lock_dir.empty()) return;
+
+    std::error_code ec;
+    fs::create_directories(limits.lock_dir, ec);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (bool waited = false;; waited = true) {
+        for (unsigned int i = 0; i < limits.connections; i++) {
+            const fs::path lock = limits.lock_dir / ("download-" + std::to_string(i) + ".lock");
+            fd = open(lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+            if (fd < 0) return;
+            if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+                if (waited) totals.queued += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                return;
+            }
+            close(fd);
+            fd = -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+#endif
+}
+
+ConnectionSlot::~ConnectionSlot()
+{
+#ifndef _WIN32
+    if (fd >= 0) close(fd);
+#endif
+}
+
+void configureDownloads(const DownloadLimits& new_limits)
+{
+    limits = new_limits;
+}
+
+const DownloadLimits& downloadLimits()
+{
+    return limits;
+}
+
+const DownloadTotals& downloadTotals()
+{
+    return totals;
+}
+
+// The Content-Length of the last response in the headers curl dumped, those of
+// redirects before it don't count. 0 if the server didn't say (chunked).
+static std::uintmax_t contentLength(const fs::path& headers)
+{
+    std::ifstream in(headers);
+    std::uintmax_t length = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 5, "HTTP/") == 0) length = 0;
+        if (line.size() < 15 || line[14] != ':') continue;
+
+        std::string name = line.substr(0, 14);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (name == "content-length") length = std::strtoull(line.c_str() + 15, nullptr, 10);
+    }
+    return length;
+}
+
+DownloadResult downloadFile(const std::string& url, const fs::path& dst)
+{
+    DownloadResult result;
+    ConnectionSlot slot;
+    EventPhase phase("download", url.substr(url.find_last_of('/') + 1));
+
+    const auto start = std::chrono::steady_clock::now();
+
+#ifdef _WIN32
+    std::string cmd = "curl.exe -L -f -s -S";
+#else
+    std::string cmd = "curl -L -f -s -S";
+#endif
+    if (limits.connect_timeout > 0) cmd += " --connect-timeout " + std::to_string(limits.connect_timeout);
+    if (limits.stall_timeout > 0) {
+        // A cap below the stall threshold would look like a stall to curl
+        std::uintmax_t threshold = 1024;
+        if (limits.rate > 0 && limits.rate / 2 < threshold) threshold = std::max<std::uintmax_t>(limits.rate / 2, 1);
+        cmd += " --speed-limit " + std::to_string(threshold) + " --speed-time " + std::to_string(limits.stall_timeout);
+    }
+
+    // Progress needs the size, curl writes the headers to a file before the body comes
+    const fs::path part = dst.string() + ".part-" + std::to_string(getpid());
+    const fs::path headers = part.string() + ".headers";
+    if (eventsEnabled()) cmd += " -D \"" + headers.string() + "\"";
+
+    cmd += " \"" + url + "\"";
+#ifdef _WIN32
+    cmd += " 2>NUL";
+    FILE* pipe = popen(cmd.c_str(), "rb");
+#else
+    cmd += " 2>/dev/null";
+    FILE* pipe = popen(cmd.c_str(), "r");
+#endif
+    if (!pipe) {
+        phase.Fail();
+        return result;
+    }
+
+    std::ofstream out(part, std::ios::binary | std::ios::trunc);
+
+    SHA256 sha;
+    sha256Init(&sha);
+
+    std::vector<char> buffer(chunk_size);
+    std::size_t count;
+    std::uintmax_t total = 0;
+    while ((count = std::fread(buffer.data(), 1, buffer.size(), pipe)) > 0) {
+        bucket.Take(count);
+        out.write(buffer.data(), count);
+        sha256Update(&sha, buffer.data(), count);
+        result.bytes += count;
+
+        if (eventsEnabled()) {
+            if (result.bytes == count) total = contentLength(headers);
+            eventProgress(result.bytes, total);
+        }
+    }
+
+    int status = pclose(pipe);
+#ifndef _WIN32
+    status = (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : 1;
+#endif
+    out.close();
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256Final(&sha, digest);
+    sha256Hex(digest, hex);
+
+    std::error_code ec;
+    if (eventsEnabled()) fs::remove(headers, ec);
+    result.ok = status == 0 && out;
+    if (result.ok) result.hash = hex;
+    if (result.ok) fs::rename(part, dst, ec);
+    if (!result.ok || ec) {
+        result.ok = false;
+        fs::remove(part, ec);
+        phase.Fail();
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    totals.bytes += result.bytes;
+    totals.seconds += result.seconds;
+    if (result.ok) totals.files++;
+
+    return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <cstdint>
+
+// Every download of the process goes through here: the body is streamed from
+// curl into the destination so a single token bucket can cap the bandwidth of
+// all of them together, and a host-wide number of connection slots (lock files
+// shared by every lct process) limits how many run at the same time.
+struct DownloadLimits {
+    std::uintmax_t rate = 0;         // bytes per second, 0 for unlimited
+    unsigned int connections = 0;    // downloads at the same time on this host, 0 for unlimited
+    unsigned int connect_timeout = 10;
+    unsigned int stall_timeout = 30; // gives up after this many seconds below 1 KiB/s, 0 for never
+    std::filesystem::path lock_dir;
+};
+
+struct DownloadResult {
+    bool ok = false;
+    std::uintmax_t bytes = 0;
+    double seconds = 0.0;
+    std::string hash; // SHA-256 of the body, computed while it streams in
+};
+
+struct DownloadTotals {
+    std::uintmax_t bytes = 0;
+    std::size_t files = 0;
+    double seconds = 0.0;
+    double throttled = 0.0; // seconds spent waiting for the bandwidth cap
+    double queued = 0.0;    // seconds spent waiting for a connection slot
+};
+
+// Holds one of the host-wide connection slots while alive, for transfers that
+// don't go through downloadFile()
+struct ConnectionSlot {
+    int fd = -1;
+
+    ConnectionSlot();
+    ~ConnectionSlot();
+
+    ConnectionSlot(const ConnectionSlot&) = delete;
+    ConnectionSlot& operator=(const ConnectionSlot&) = delete;
+};
+
+void configureDownloads(const DownloadLimits& limits);
+const DownloadLimits& downloadLimits();
+const DownloadTotals& downloadTotals();
+
+// Writes to a temporary file next to 'dst' and only renames it into place when complete
+DownloadResult downloadFile(const std::string& url, const std::filesystem::path& dst);
@@ -0,0 +1,601 @@
+#include "untar.h"
+#include "../shell/batch.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BLOCK 512
+
+// Files this large are written on their own instead of being held in the batch
+#define STREAMED_SIZE (4u * 1024u * 1024u)
+
+typedef struct Timestamp {
+    char* path;
+    long long mtime;
+} Timestamp;
+
+// A symlink, they are only created once everything else is out
+typedef struct Link {
+    char* name;
+    char* target;
+} Link;
+
+typedef struct Extraction {
+    Decoder* decoder;
+    FileBatch* batch;
+    const char* out;
+    const char* const* excludes;
+    size_t exclude_count;
+    char* last_parent; // the directory files were last put in, known to exist
+    Timestamp* timestamps;
+    size_t timestamp_count;
+    size_t timestamp_capacity;
+    Link* links;
+    size_t link_count;
+    size_t link_capacity;
+} Extraction;
+
+static int readExactly(Decoder* decoder, void* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        const long n = readDecoder(decoder, (unsigned char*)buffer + done, size - done);
+        if (n <= 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int skipBytes(Decoder* decoder, unsigned long long size)
+{
+    unsigned char buffer[64 * 1024];
+    while (size > 0) {
+        const size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+        if (readExactly(decoder, buffer, chunk) != 0) return -1;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static unsigned long long padding(unsigned long long size)
+{
+    return (BLOCK - size % BLOCK) % BLOCK;
+}
+
+// Octal, or big endian base-256 when the high bit is set (GNU, for large values)
+static unsigned long long parseNumber(const unsigned char* field, size_t length)
+{
+    unsigned long long value = 0;
+    if (field[0] & 0x80) {
+        value = field[0] & 0x7f;
+        for (size_t i = 1; i < length; i++) value = (value << 8) | field[i];
+        return value;
+    }
+
+    size_t i = 0;
+    while (i < length && (field[i] == ' ' || field[i] == '\0')) i++;
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) value = value * 8 + (unsigned long long)(field[i] - '0');
+    return value;
+}
+
+// The checksum field counts as spaces, some old tars summed signed bytes
+static int checksumValid(const unsigned char* header)
+{
+    unsigned long long unsigned_sum = 0;
+    long long signed_sum = 0;
+    for (size_t i = 0; i < BLOCK; i++) {
+        const unsigned char c = i >= 148 && i < 156 ? ' ' : header[i];
+        unsigned_sum += c;
+        signed_sum += (signed char)c;
+    }
+    const unsigned long long expected = parseNumber(header + 148, 8);
+    return expected == unsigned_sum || (long long)expected == signed_sum;
+}
+
+// Reads a member's contents (a long name or pax header) as a string
+static char* readData(Decoder* decoder, unsigned long long size)
+{
+    if (size > 1024 * 1024) return NULL;
+
+    char* data = malloc((size_t)size + 1);
+    if (!data) return NULL;
+    if (readExactly(decoder, data, (size_t)size) != 0 || skipBytes(decoder, padding(size)) != 0) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+static char* copyField(const unsigned char* field, size_t length)
+{
+    size_t used = 0;
+    while (used < length && field[used] != '\0') used++;
+
+    char* copy = malloc(used + 1);
+    if (!copy) return NULL;
+    memcpy(copy, field, used);
+    copy[used] = '\0';
+    return copy;
+}
+
+// Takes "path" and "linkpath" out of "<length> <key>=<value>\n" records
+static void parsePax(const char* data, size_t size, char** path, char** link)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        char* end;
+        const unsigned long length = strtoul(data + offset, &end, 10);
+        if (length == 0 || offset + length > size || *end != ' ') return;
+
+        const char* key = end + 1;
+        const char* record_end = data + offset + length - 1; // the '\n'
+        const char* equals = memchr(key, '=', (size_t)(record_end - key));
+        if (equals) {
+            const size_t key_length = (size_t)(equals - key);
+            char** target = NULL;
+            if (key_length == 4 && strncmp(key, "path", 4) == 0) target = path;
+            else if (key_length == 8 && strncmp(key, "linkpath", 8) == 0) target = link;
+
+            if (target) {
+                const size_t value_length = (size_t)(record_end - equals - 1);
+                free(*target);
+                *target = malloc(value_length + 1);
+                if (*target) {
+                    memcpy(*target, equals + 1, value_length);
+                    (*target)[value_length] = '\0';
+                }
+            }
+        }
+        offset += length;
+    }
+}
+
+// Drops leading slashes and empty or "." components, NULL for names that would leave 'out'
+static char* cleanName(const char* name)
+{
+    char* clean = malloc(strlen(name) + 1);
+    if (!clean) return NULL;
+
+    size_t length = 0;
+    for (const char* component = name; *component;) {
+        const char* slash = strchr(component, '/');
+        const size_t size = slash ? (size_t)(slash - component) : strlen(component);
+        if (size == 2 && component[0] == '.' && component[1] == '.') {
+            free(clean);
+            return NULL;
+        }
+        if (size > 0 && !(size == 1 && component[0] == '.')) {
+            if (length > 0) clean[length++] = '/';
+            memcpy(clean + length, component, size);
+            length += size;
+        }
+        component += size + (slash ? 1 : 0);
+    }
+
+    if (length == 0) {
+        free(clean);
+        return NULL;
+    }
+    clean[length] = '\0';
+    return clean;
+}
+
+// Like tar --exclude: a pattern matching the member or one of its directories skips it
+static int isExcluded(const Extraction* extraction, char* name)
+{
+    for (char* c = name;; c++) {
+        if (*c != '/' && *c != '\0') continue;
+
+        const char saved = *c;
+        *c = '\0';
+        int excluded = 0;
+        for (size_t i = 0; i < extraction->exclude_count && !excluded; i++) {
+            excluded = fnmatch(extraction->excludes[i], name, 0) == 0;
+        }
+        *c = saved;
+
+        if (excluded) return 1;
+        if (saved == '\0') return 0;
+    }
+}
+
+static char* joinPath(const char* dir, const char* name)
+{
+    const size_t dir_length = strlen(dir);
+    char* path = malloc(dir_length + strlen(name) + 2);
+    if (!path) return NULL;
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '/';
+    strcpy(path + dir_length + 1, name);
+    return path;
+}
+
+// Creates the directories above 'path' that are missing, members mostly come
+// grouped by directory. Each one is opened without following symlinks, so a
+// member never ends up outside 'out' through one that was there before.
+static int makeParents(Extraction* extraction, char* path)
+{
+    // 'out' itself exists already
+    const size_t out_length = strlen(extraction->out);
+    char* slash = strrchr(path, '/');
+    if (!slash || (size_t)(slash - path) <= out_length) return 0;
+
+    *slash = '\0';
+    int result = 0;
+    if (!extraction->last_parent || strcmp(extraction->last_parent, path) != 0) {
+        int dir = open(extraction->out, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir < 0) result = -1;
+
+        for (char* component = path + out_length + 1; result == 0;) {
+            char* end = strchr(component, '/');
+            if (end) *end = '\0';
+
+            if (mkdirat(dir, component, 0755) != 0 && errno != EEXIST) result = -1;
+            const int next = result == 0 ? openat(dir, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) : -1;
+            if (next < 0) result = -1;
+            close(dir);
+            dir = next;
+
+            if (!end) break;
+            *end = '/';
+            component = end + 1;
+        }
+        if (dir >= 0) close(dir);
+
+        if (result == 0) {
+            free(extraction->last_parent);
+            extraction->last_parent = strdup(path);
+        }
+    }
+    *slash = '/';
+    return result;
+}
+
+static const Link* findLink(const Extraction* extraction, const char* name)
+{
+    for (size_t i = 0; i < extraction->link_count; i++) {
+        if (strcmp(extraction->links[i].name, name) == 0) return &extraction->links[i];
+    }
+    return NULL;
+}
+
+// A later member with the same name replaces the symlink, like it would in tar
+static void forgetLink(Extraction* extraction, const char* name)
+{
+    for (size_t i = 0; i < extraction->link_count; i++) {
+        if (strcmp(extraction->links[i].name, name) != 0) continue;
+        free(extraction->links[i].name);
+        free(extraction->links[i].target);
+        extraction->links[i] = extraction->links[--extraction->link_count];
+        return;
+    }
+}
+
+static int deferLink(Extraction* extraction, const char* name, const char* target)
+{
+    forgetLink(extraction, name);
+    if (extraction->link_count == extraction->link_capacity) {
+        const size_t capacity = extraction->link_capacity ? extraction->link_capacity * 2 : 64;
+        Link* links = realloc(extraction->links, capacity * sizeof(Link));
+        if (!links) return -1;
+        extraction->links = links;
+        extraction->link_capacity = capacity;
+    }
+
+    Link* link = &extraction->links[extraction->link_count];
+    link->name = strdup(name);
+    link->target = strdup(target);
+    if (!link->name || !link->target) {
+        free(link->name);
+        free(link->target);
+        return -1;
+    }
+    extraction->link_count++;
+    return 0;
+}
+
+// True if the target of a symlink stays inside 'out'. It is resolved from the
+// symlink's directory by its names, so '..' may not come after one of the
+// archive's symlinks, where it would go up from wherever that one points.
+static int linkStaysInside(const Extraction* extraction, const Link* link)
+{
+    const char* target = link->target;
+    if (target[0] == '/' || target[0] == '\0') return 0;
+
+    char* resolved = malloc(strlen(link->name) + strlen(target) + 2);
+    if (!resolved) return 0;
+    const char* slash = strrchr(link->name, '/');
+    size_t length = slash ? (size_t)(slash - link->name) : 0;
+    memcpy(resolved, link->name, length);
+    resolved[length] = '\0';
+
+    int inside = 1;
+    int through_link = 0;
+    for (const char* component = target; inside && *component;) {
+        const char* end = strchr(component, '/');
+        const size_t size = end ? (size_t)(end - component) : strlen(component);
+        if (size == 2 && component[0] == '.' && component[1] == '.') {
+            if (length == 0 || through_link) inside = 0;
+            while (length > 0 && resolved[length - 1] != '/') length--;
+            if (length > 0) length--;
+            resolved[length] = '\0';
+        } else if (size > 0 && !(size == 1 && component[0] == '.')) {
+            if (length > 0) resolved[length++] = '/';
+            memcpy(resolved + length, component, size);
+            length += size;
+            resolved[length] = '\0';
+            if (findLink(extraction, resolved)) through_link = 1;
+        }
+        component += size + (end ? 1 : 0);
+    }
+
+    free(resolved);
+    return inside;
+}
+
+// Creates the symlinks once no member can be written through one anymore,
+// returns -1 if one of them points outside 'out'
+static int createLinks(Extraction* extraction)
+{
+    int result = 0;
+    for (size_t i = 0; i < extraction->link_count && result == 0; i++) {
+        const Link* link = &extraction->links[i];
+        char* path = linkStaysInside(extraction, link) ? joinPath(extraction->out, link->name) : NULL;
+        if (!path) {
+            result = -1;
+            break;
+        }
+        unlink(path);
+        if (symlink(link->target, path) != 0) result = -1;
+        free(path);
+    }
+
+    for (size_t i = 0; i < extraction->link_count; i++) {
+        free(extraction->links[i].name);
+        free(extraction->links[i].target);
+    }
+    free(extraction->links);
+    return result;
+}
+
+static void rememberMtime(Extraction* extraction, const char* path, long long mtime)
+{
+    if (extraction->timestamp_count == extraction->timestamp_capacity) {
+        const size_t capacity = extraction->timestamp_capacity ? extraction->timestamp_capacity * 2 : 256;
+        Timestamp* timestamps = realloc(extraction->timestamps, capacity * sizeof(Timestamp));
+        if (!timestamps) return;
+        extraction->timestamps = timestamps;
+        extraction->timestamp_capacity = capacity;
+    }
+
+    char* copy = strdup(path);
+    if (!copy) return;
+    extraction->timestamps[extraction->timestamp_count].path = copy;
+    extraction->timestamps[extraction->timestamp_count].mtime = mtime;
+    extraction->timestamp_count++;
+}
+
+static int writeFile(Extraction* extraction, const char* path, unsigned long long size, unsigned int mode)
+{
+    if (size < STREAMED_SIZE) {
+        unsigned char* data = malloc(size > 0 ? (size_t)size : 1);
+        int result = data ? readExactly(extraction->decoder, data, (size_t)size) : -1;
+        if (result == 0) result = batchWrite(extraction->batch, path, data, (size_t)size, mode);
+        free(data);
+        return result;
+    }
+
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, mode);
+    if (fd < 0) return -1;
+
+    unsigned char buffer[64 * 1024];
+    int result = 0;
+    while (result == 0 && size > 0) {
+        const size_t chunk = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+        if (readExactly(extraction->decoder, buffer, chunk) != 0 || write(fd, buffer, chunk) != (ssize_t)chunk) result = -1;
+        size -= chunk;
+    }
+    if (close(fd) != 0) result = -1;
+    return result;
+}
+
+// Extracts one member whose header was read, 'data' is what follows it
+static int extractMember(Extraction* extraction, const unsigned char* header, char* name, const char* link_name, unsigned long long size)
+{
+    const char type = (char)header[156];
+    const unsigned int mode = (unsigned int)parseNumber(header + 100, 8) & 0777;
+    const long long mtime = (long long)parseNumber(header + 136, 12);
+
+    char* path = joinPath(extraction->out, name);
+    if (!path) return -1;
+
+    int result = makeParents(extraction, path);
+    int data_read = 0;
+    forgetLink(extraction, name);
+    if (result != 0) {
+        // Nothing to do
+    } else if (type == '5') {
+        // Kept writable by its owner so the files can go in
+        if (mkdir(path, mode | 0700) != 0 && errno != EEXIST) result = -1;
+    } else if (type == '0' || type == '\0' || type == '7') {
+        result = writeFile(extraction, path, size, mode);
+        data_read = 1;
+        if (result == 0) rememberMtime(extraction, path, mtime);
+    } else if (type == '2') {
+        if (!link_name || deferLink(extraction, name, link_name) != 0) result = -1;
+    } else if (type == '1') {
+        char* target_name = link_name ? cleanName(link_name) : NULL;
+        char* target = target_name ? joinPath(extraction->out, target_name) : NULL;
+        const Link* target_link = target_name ? findLink(extraction, target_name) : NULL;
+
+        // The target may still be queued, one that was excluded isn't there at all
+        flushFileBatch(extraction->batch);
+        if (!target || isExcluded(extraction, target_name)) {
+            // Skipped like its target
+        } else if (target_link) {
+            // A hard link to a symlink that doesn't exist yet is another one like it
+            char* symlink_target = strdup(target_link->target);
+            if (!symlink_target || deferLink(extraction, name, symlink_target) != 0) result = -1;
+            free(symlink_target);
+        } else {
+            unlink(path);
+            if (linkat(AT_FDCWD, target, AT_FDCWD, path, 0) != 0) result = -1;
+        }
+        free(target_name);
+        free(target);
+    }
+    // Devices, fifos and the like have no place in a source tree
+
+    free(path);
+    if (result != 0) return -1;
+    if (!data_read && skipBytes(extraction->decoder, size) != 0) return -1;
+    return skipBytes(extraction->decoder, padding(size));
+}
+
+static int extractAll(Extraction* extraction)
+{
+    unsigned char header[BLOCK];
+    char* long_name = NULL;
+    char* long_link = NULL;
+
+    int result = 0;
+    for (;;) {
+        if (readExactly(extraction->decoder, header, BLOCK) != 0) {
+            result = -1;
+            break;
+        }
+
+        int empty = 1;
+        for (size_t i = 0; i < BLOCK && empty; i++) empty = header[i] == 0;
+        if (empty) break;
+
+        if (!checksumValid(header)) {
+            result = -1;
+            break;
+        }
+
+        const char type = (char)header[156];
+        const unsigned long long size = parseNumber(header + 124, 12);
+
+        // Headers that describe the next member
+        if (type == 'L' || type == 'K' || type == 'x') {
+            char* data = readData(extraction->decoder, size);
+            if (!data) {
+                result = -1;
+                break;
+            }
+            if (type == 'L') {
+                free(long_name);
+                long_name = data;
+            } else if (type == 'K') {
+                free(long_link);
+                long_link = data;
+            } else {
+                parsePax(data, (size_t)size, &long_name, &long_link);
+                free(data);
+            }
+            continue;
+        }
+        if (type == 'g') {
+            if (skipBytes(extraction->decoder, size + padding(size)) != 0) {
+                result = -1;
+                break;
+            }
+            continue;
+        }
+
+        char* full_name = long_name;
+        long_name = NULL;
+        if (!full_name) {
+            char* name = copyField(header, 100);
+            if (name && memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+                char* prefix = copyField(header + 345, 155);
+                full_name = prefix ? joinPath(prefix, name) : NULL;
+                free(prefix);
+                free(name);
+            } else full_name = name;
+        }
+        char* link_name = long_link;
+        long_link = NULL;
+        if (!link_name && (type == '1' || type == '2')) link_name = copyField(header + 157, 100);
+
+        char* name = full_name ? cleanName(full_name) : NULL;
+        if (!name || isExcluded(extraction, name)) {
+            // "./" itself or something excluded
+            result = skipBytes(extraction->decoder, size + padding(size));
+        } else {
+            result = extractMember(extraction, header, name, link_name, size);
+        }
+        free(name);
+        free(full_name);
+        free(link_name);
+        if (result != 0) break;
+    }
+
+    free(long_name);
+    free(long_link);
+    return result;
+}
+
+int untar(const char* path, ArchiveCodec codec, const char* out, const char* const* excludes, size_t exclude_count, unsigned long long* unpacked_bytes)
+{
+    Extraction extraction;
+    memset(&extraction, 0, sizeof(extraction));
+    extraction.out = out;
+    extraction.excludes = excludes;
+    extraction.exclude_count = exclude_count;
+
+    extraction.decoder = openDecoder(path, codec);
+    if (!extraction.decoder) return -1;
+    extraction.batch = openFileBatch();
+    if (!extraction.batch) {
+        closeDecoder(extraction.decoder);
+        return -1;
+    }
+
+    int result = extractAll(&extraction);
+
+    // Tar pads the end with zeros, the codec only checks its trailer once everything was read
+    if (result == 0) {
+        unsigned char rest[BLOCK];
+        long n;
+        while ((n = readDecoder(extraction.decoder, rest, sizeof(rest))) > 0) {}
+        if (n < 0) result = -1;
+    }
+    if (unpacked_bytes) *unpacked_bytes = decodedBytes(extraction.decoder);
+    if (closeDecoder(extraction.decoder) != 0) result = -1;
+    if (closeFileBatch(extraction.batch) > 0) result = -1;
+    if (createLinks(&extraction) != 0) result = -1;
+
+    // Builds compare mtimes, so they are restored once nothing writes to the files anymore
+    for (size_t i = 0; i < extraction.timestamp_count; i++) {
+        if (result == 0) {
+            const struct timespec times[2] = {{0, UTIME_OMIT}, {(time_t)extraction.timestamps[i].mtime, 0}};
+            utimensat(AT_FDCWD, extraction.timestamps[i].path, times, 0);
+        }
+        free(extraction.timestamps[i].path);
+    }
+    free(extraction.timestamps);
+    free(extraction.last_parent);
+    return result;
+}
+#else
+int untar(const char* path, ArchiveCodec codec, const char* out, const char* const* excludes, size_t exclude_count, unsigned long long* unpacked_bytes)
+{
+    // Windows sources come as zips
+    (void)path;
+    (void)codec;
+    (void)out;
+    (void)excludes;
+    (void)exclude_count;
+    if (unpacked_bytes) *unpacked_bytes = 0;
+    return -1;
+}
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include "decode.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Unpacks the tar archive 'path' into 'out' without a tar process. The files
+// go through a FileBatch, members matching one of 'excludes' (shell patterns
+// like tar --exclude, '*' also matches '/') are skipped together with
+// everything below them. Ustar, GNU long names and pax paths are understood.
+// Symlinks are created after everything else and fail the unpack if they
+// point outside 'out', no member is ever written through one.
+// Returns 0 on success, 'unpacked_bytes' is set to the size of the tar stream.
+int untar(const char* path, ArchiveCodec codec, const char* out, const char* const* excludes, size_t exclude_count, unsigned long long* unpacked_bytes);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,436 @@
+#include "events.hpp"
+#include "../data/state.hpp"
+#include "../format/format.hpp"
+#include "../store/store.hpp"
+#include "../terminal/terminal.h"
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+
+using Clock = std::chrono::steady_clock;
+
+// Progress and output faster than this would only cost time to render and parse
+static const Clock::duration update_interval = std::chrono::milliseconds(100);
+
+static EventMode mode = EventMode::Quiet;
+static const Clock::time_point run_start = Clock::now();
+static EventPhase* current = nullptr;
+static Clock::time_point last_update;
+static bool line_shown = false;
+static std::size_t line_width = 80;
+
+// Where the events go in json mode, std::cout writes to a sink then
+static std::streambuf* json_out = nullptr;
+
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override
+    {
+        return c;
+    }
+};
+
+void configureEvents(EventMode new_mode)
+{
+    mode = new_mode;
+    if (mode == EventMode::Json && !json_out) {
+        std::cout.flush();
+        // Never freed, std::cout is flushed into it after everything else is gone
+        json_out = std::cout.rdbuf(new NullBuffer());
+    }
+    if (mode == EventMode::Progress) {
+        const int width = terminalWidth();
+        if (width > 1) line_width = static_cast<std::size_t>(width) - 1;
+    }
+}
+
+EventMode eventMode()
+{
+    return mode;
+}
+
+// One event as a JSON object on a line of its own
+class JsonLine {
+public:
+    explicit JsonLine(const char* event)
+    {
+        char t[32];
+        std::snprintf(t, sizeof(t), "%.3f", std::chrono::duration<double>(Clock::now() - run_start).count());
+        text = "{\"t\":";
+        text += t;
+        Add("event", event);
+    }
+
+    JsonLine& Add(const char* key, const std::string& value)
+    {
+        Key(key);
+        String(value.data(), value.size());
+        return *this;
+    }
+
+    JsonLine& Add(const char* key, const char* value, std::size_t length)
+    {
+        Key(key);
+        String(value, length);
+        return *this;
+    }
+
+    JsonLine& Add(const char* key, const char* value)
+    {
+        return Add(key, value, std::strlen(value));
+    }
+
+    JsonLine& Number(const char* key, std::uintmax_t value)
+    {
+        Key(key);
+        text += std::to_string(value);
+        return *this;
+    }
+
+    JsonLine& Integer(const char* key, long long value)
+    {
+        Key(key);
+        text += std::to_string(value);
+        return *this;
+    }
+
+    JsonLine& Number(const char* key, double value)
+    {
+        char number[32];
+        std::snprintf(number, sizeof(number), "%.3f", value);
+        Key(key);
+        text += number;
+        return *this;
+    }
+
+    JsonLine& Flag(const char* key, bool value)
+    {
+        Key(key);
+        text += value ? "true" : "false";
+        return *this;
+    }
+
+    // Appends an already encoded value
+    JsonLine& Raw(const char* key, const std::string& json)
+    {
+        Key(key);
+        text += json;
+        return *this;
+    }
+
+    void Emit()
+    {
+        text += "}\n";
+        json_out->sputn(text.data(), static_cast<std::streamsize>(text.size()));
+        json_out->pubsync();
+    }
+
+    // A JSON string, bytes that aren't UTF-8 (build output can be anything) become U+FFFD
+    static void Quote(std::string& out, const char* str, std::size_t length)
+    {
+        out += '"';
+        for (std::size_t i = 0; i < length;) {
+            const unsigned char c = static_cast<unsigned char>(str[i]);
+            if (c < 0x80) {
+                switch (c) {
+                    case '"':  out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
+                    default:
+                        if (c < 0x20 || c == 0x7f) {
+                            char escaped[8];
+                            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                            out += escaped;
+                        } else out += static_cast<char>(c);
+                }
+                i++;
+                continue;
+            }
+
+            const std::size_t size = utf8Size(str + i, length - i);
+            if (size == 0) {
+                out += "\xef\xbf\xbd";
+                i++;
+            } else {
+                out.append(str + i, size);
+                i += size;
+            }
+        }
+        out += '"';
+    }
+
+    // Length of the UTF-8 sequence at 'str', 0 if it isn't a valid one
+    static std::size_t utf8Size(const char* str, std::size_t left)
+    {
+        const unsigned char* s = reinterpret_cast<const unsigned char*>(str);
+        std::size_t size;
+        unsigned int min;
+        if      ((s[0] & 0xe0) == 0xc0) { size = 2; min = 0x80; }
+        else if ((s[0] & 0xf0) == 0xe0) { size = 3; min = 0x800; }
+        else if ((s[0] & 0xf8) == 0xf0) { size = 4; min = 0x10000; }
+        else return 0;
+        if (size > left) return 0;
+
+        unsigned int code = s[0] & (0x7f >> size);
+        for (std::size_t i = 1; i < size; i++) {
+            if ((s[i] & 0xc0) != 0x80) return 0;
+            code = (code << 6) | (s[i] & 0x3f);
+        }
+        if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) return 0;
+        return size;
+    }
+
+private:
+    void Key(const char* key)
+    {
+        text += ",\"";
+        text += key;
+        text += "\":";
+    }
+
+    void String(const char* str, std::size_t length)
+    {
+        Quote(text, str, length);
+    }
+
+    std::string text;
+};
+
+static std::string quoted(const std::string& str)
+{
+    std::string out;
+    JsonLine::Quote(out, str.data(), str.size());
+    return out;
+}
+
+// The status line never wraps, escape sequences and control characters of
+// build output are dropped and it is cut at the width of the terminal
+static void drawLine(const std::string& text)
+{
+    std::string line = "\r\033[K";
+    std::size_t columns = 0;
+    for (std::size_t i = 0; i < text.size(); i++) {
+        const unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == 0x1b) {
+            // CSI sequences end with a byte from '@' to '~'
+            if (i + 1 < text.size() && text[i + 1] == '[') {
+                i += 2;
+                while (i < text.size() && (text[i] < '@' || text[i] > '~')) i++;
+            }
+            continue;
+        }
+        if (c < 0x20 || c == 0x7f) continue;
+        // Continuation bytes of UTF-8 don't take a column, so no character is cut in half
+        if ((c & 0xc0) != 0x80 && columns++ == line_width) break;
+        line += static_cast<char>(c);
+    }
+
+    std::cout << line;
+    std::cout.flush();
+    line_shown = true;
+}
+
+static void clearLine()
+{
+    if (!line_shown) return;
+    std::cout << "\r\033[K";
+    std::cout.flush();
+    line_shown = false;
+}
+
+static const char* phaseVerb(const char* phase)
+{
+    static const char* const verbs[][2] = {
+        {"download", "Downloading"},
+        {"unpack",   "Unpacking"},
+        {"checkout", "Checking out"},
+        {"build",    "Building"},
+        {"train",    "Training"},
+        {"store",    "Storing"},
+        {"fetch",    "Fetching"},
+        {"link",     "Linking"},
+        {"verify",   "Verifying"}
+    };
+    for (const auto& verb : verbs) {
+        if (std::strcmp(verb[0], phase) == 0) return verb[1];
+    }
+    return phase;
+}
+
+// Updates that come in faster than the interval are dropped, except for the last one of a phase
+static bool due(bool last)
+{
+    const Clock::time_point now = Clock::now();
+    if (!last && now - last_update < update_interval) return false;
+    last_update = now;
+    return true;
+}
+
+EventPhase::EventPhase(const char* phase, const std::string& subject)
+    : phase(phase), subject(subject), start(Clock::now()), outer(current), exceptions(std::uncaught_exceptions())
+{
+    current = this;
+
+    // Human output isn't flushed line by line, what announced the phase shows before it runs
+    if (mode != EventMode::Json) std::cout.flush();
+    if (mode == EventMode::Json) JsonLine("phase_start").Add("phase", phase).Add("subject", subject).Emit();
+}
+
+EventPhase::~EventPhase()
+{
+    current = outer;
+    if (std::uncaught_exceptions() > exceptions) ok = false;
+
+    if (mode == EventMode::Progress) clearLine();
+    if (mode != EventMode::Json) return;
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    JsonLine("phase_end").Add("phase", phase).Add("subject", subject).Flag("ok", ok).Number("seconds", seconds).Emit();
+}
+
+void eventPlan(const std::string& command, const std::vector<PlanItem>& items)
+{
+    if (mode != EventMode::Json) return;
+
+    std::string list = "[";
+    for (const PlanItem& item : items) {
+        if (list.size() > 1) list += ",";
+        list += "{\"action\":" + quoted(item.action) + ",\"tool\":" + quoted(item.tool) + ",\"version\":" + quoted(item.version) + "}";
+    }
+    list += "]";
+    JsonLine("plan").Add("command", command).Raw("items", list).Emit();
+}
+
+void eventProgress(std::uintmax_t done, std::uintmax_t total)
+{
+    if (mode == EventMode::Quiet || !current) return;
+    if (!due(total > 0 && done >= total)) return;
+
+    if (mode == EventMode::Json) {
+        JsonLine line("progress");
+        line.Add("phase", current->phase).Add("subject", current->subject).Number("done", done);
+        if (total > 0) line.Number("total", total);
+        line.Emit();
+        return;
+    }
+
+    // The numbers go first, a narrow terminal cuts off the name of the file
+    const double seconds = std::chrono::duration<double>(Clock::now() - current->start).count();
+    std::string text = "    " + formatBytes(done);
+    if (total > 0) text += " of " + formatBytes(total);
+    text += ", " + formatRate(done, seconds);
+    if (total > done && done > 0 && seconds > 0.0) {
+        text += ", " + formatDuration(static_cast<double>(total - done) * seconds / static_cast<double>(done)) + " left";
+    }
+    text += std::string(" (") + phaseVerb(current->phase) + " " + current->subject + ")";
+    drawLine(text);
+}
+
+void eventOutput(int stream, const char* line, std::size_t length)
+{
+    if (mode == EventMode::Quiet || !current) return;
+    if (length > 0 && line[length - 1] == '\r') length--;
+
+    if (mode == EventMode::Json) {
+        JsonLine("output").Add("phase", current->phase).Add("subject", current->subject).Add("stream", stream == 2 ? "stderr" : "stdout").Add("line", line, length).Emit();
+        return;
+    }
+
+    // The latest line shows what the build is busy with
+    if (length == 0 || !due(false)) return;
+    const double seconds = std::chrono::duration<double>(Clock::now() - current->start).count();
+    drawLine(std::string("    ") + phaseVerb(current->phase) + " " + current->subject + " (" + formatDuration(seconds) + "): " + std::string(line, length));
+}
+
+void eventWarning(const std::string& message)
+{
+    if (mode == EventMode::Progress) clearLine();
+    if (mode == EventMode::Json) JsonLine("warning").Add("message", message).Emit();
+}
+
+void eventError(const std::string& message)
+{
+    if (mode == EventMode::Progress) clearLine();
+    if (mode == EventMode::Json) JsonLine("error").Add("message", message).Emit();
+}
+
+void printWarning(const std::string& message, bool use_ansi)
+{
+    eventWarning(message);
+    if (use_ansi) std::cerr << "\033[33m";
+    std::cerr << "Warning: " << message << '\n';
+    if (use_ansi) std::cerr << "\033[0m";
+}
+
+void printError(const std::string& message, bool use_ansi)
+{
+    eventError(message);
+    if (use_ansi) std::cerr << "\033[31m";
+    std::cerr << message << '\n';
+    if (use_ansi) std::cerr << "\033[0m";
+}
+
+void eventState(const State& state)
+{
+    if (mode != EventMode::Json) return;
+
+    // Sorted, so the same state always reads the same
+    const std::map<std::string, ToolState> tools(state.installed_tools.begin(), state.installed_tools.end());
+
+    std::string list = "[";
+    for (const auto& [tool, tool_state] : tools) {
+        if (list.size() > 1) list += ",";
+        list += "{\"tool\":" + quoted(tool) + ",\"active\":" + quoted(tool_state.active) + ",\"versions\":[";
+        for (std::size_t i = 0; i < tool_state.versions.size(); i++) {
+            if (i > 0) list += ",";
+            list += quoted(storeVersion(tool_state.versions[i], state.GetProfile(tool, tool_state.versions[i])));
+        }
+        list += "],\"profile\":" + quoted(state.GetProfile(tool)) + ",\"files\":" + std::to_string(tool_state.files.size());
+
+        auto staged = state.staged_tools.find(tool);
+        if (staged != state.staged_tools.end()) list += ",\"staged\":" + quoted(staged->second);
+        list += "}";
+    }
+    list += "]";
+    JsonLine("state").Raw("tools", list).Emit();
+}
+
+void eventVersion(const std::string& version, const std::string& first, const std::string& latest)
+{
+    if (mode != EventMode::Json) return;
+    JsonLine("version").Add("version", version).Add("first", first).Add("latest", latest).Emit();
+}
+
+void eventPath(const std::filesystem::path& main_dir, const std::filesystem::path& store_root, const std::filesystem::path& bin_dir)
+{
+    if (mode != EventMode::Json) return;
+    JsonLine("path").Add("dir", main_dir.string()).Add("store", store_root.string()).Add("bin", bin_dir.string()).Emit();
+}
+
+void eventFiles(const State& state, const std::string& tool, const std::filesystem::path& install_dir)
+{
+    if (mode != EventMode::Json) return;
+
+    std::string list = "[";
+    for (const InstalledFile& file : state.GetFiles(tool)) {
+        if (list.size() > 1) list += ",";
+        char mode_bits[8];
+        std::snprintf(mode_bits, sizeof(mode_bits), "%o", file.mode);
+        list += "{\"path\":" + quoted(file.path) + ",\"size\":" + std::to_string(file.size) + ",\"mode\":" + quoted(mode_bits) +
+                ",\"hash\":" + quoted(file.hash) + "}";
+    }
+    list += "]";
+
+    auto active = state.GetVersion(tool);
+    const std::string version = active.has_value() ? storeVersion(active->get(), state.GetProfile(tool)) : "";
+    JsonLine("files").Add("tool", tool).Add("version", version).Add("dir", install_dir.string()).Raw("files", list).Emit();
+}
+
+void eventExit(int code)
+{
+    if (mode == EventMode::Progress) clearLine();
+    if (mode == EventMode::Json) JsonLine("exit").Integer("code", code).Emit();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct State;
+
+// What a run does as a stream of events. With --json every event is a line of
+// JSON on stdout and the human output is dropped, on a terminal they drive a
+// status line with the throughput and ETA of the running phase, and otherwise
+// they go nowhere.
+enum class EventMode {
+    Quiet,
+    Progress,
+    Json
+};
+
+void configureEvents(EventMode mode);
+EventMode eventMode();
+
+// True if events go anywhere, so work that only feeds them can be skipped
+inline bool eventsEnabled()
+{
+    return eventMode() != EventMode::Quiet;
+}
+
+struct PlanItem {
+    std::string action; // "install", "uninstall", "update", "fetch", "use" or "activate"
+    std::string tool;
+    std::string version; // may carry a build profile, see storeVersion()
+};
+
+// A step like "download" or "build" of 'subject' (a file or version). Phases
+// nest, progress and output belong to the innermost one. It ends when it goes
+// out of scope, as failed if that happens through an exception or Fail().
+class EventPhase {
+public:
+    EventPhase(const char* phase, const std::string& subject);
+    ~EventPhase();
+
+    EventPhase(const EventPhase&) = delete;
+    EventPhase& operator=(const EventPhase&) = delete;
+
+    inline void Fail()
+    {
+        ok = false;
+    }
+
+    const char* phase;
+    const std::string subject;
+    const std::chrono::steady_clock::time_point start;
+
+private:
+    EventPhase* outer;
+    const int exceptions;
+    bool ok = true;
+};
+
+void eventPlan(const std::string& command, const std::vector<PlanItem>& items);
+
+// 'done' of 'total' bytes of the current phase, 'total' is 0 if unknown. Can
+// be called for every chunk, updates are rate limited.
+void eventProgress(std::uintmax_t done, std::uintmax_t total);
+
+// A line a command of the current phase wrote, 'stream' is 1 for stdout and 2 for stderr
+void eventOutput(int stream, const char* line, std::size_t length);
+
+// Call before printing the message, the status line has to go first
+void eventWarning(const std::string& message);
+void eventError(const std::string& message);
+
+// The event and the message on stderr, in yellow or red on a terminal
+void printWarning(const std::string& message, bool use_ansi);
+void printError(const std::string& message, bool use_ansi);
+
+// The tools and versions installed when the command is done
+void eventState(const State& state);
+
+// What the read-only commands print as text
+void eventVersion(const std::string& version, const std::string& first, const std::string& latest);
+void eventPath(const std::filesystem::path& main_dir, const std::filesystem::path& store_root, const std::filesystem::path& bin_dir);
+void eventFiles(const State& state, const std::string& tool, const std::filesystem::path& install_dir);
+
+void eventExit(int code);
@@ -0,0 +1,61 @@
+#include "format.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+
+std::string formatBytes(std::uintmax_t bytes)
+{
+    static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+
+    double value = static_cast<double>(bytes);
+    std::size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024.0;
+        unit++;
+    }
+
+    char buf[32];
+    if (unit == 0) std::snprintf(buf, sizeof(buf), "%ju %s", bytes, units[unit]);
+    else           std::snprintf(buf, sizeof(buf), "%.1f %s", value, units[unit]);
+    return buf;
+}
+
+std::string formatDuration(double seconds)
+{
+    char buf[32];
+    if (seconds < 1.0) std::snprintf(buf, sizeof(buf), "%.1f ms", seconds * 1000.0);
+    else               std::snprintf(buf, sizeof(buf), "%.2f s", seconds);
+    return buf;
+}
+
+std::string formatRate(std::uintmax_t bytes, double seconds)
+{
+    if (seconds <= 0.0) return formatBytes(bytes) + "/s";
+    return formatBytes(static_cast<std::uintmax_t>(static_cast<double>(bytes) / seconds)) + "/s";
+}
+
+bool parseBytes(const std::string& str, std::uintmax_t& bytes)
+{
+    if (str.empty() || !std::isdigit(static_cast<unsigned char>(str[0]))) return false;
+
+    char* end = nullptr;
+    double value = std::strtod(str.c_str(), &end);
+
+    std::uintmax_t multiplier = 1;
+    switch (std::toupper(static_cast<unsigned char>(*end))) {
+        case '\0': case 'B': break;
+        case 'K': multiplier = 1ull << 10; end++; break;
+        case 'M': multiplier = 1ull << 20; end++; break;
+        case 'G': multiplier = 1ull << 30; end++; break;
+        case 'T': multiplier = 1ull << 40; end++; break;
+        default: return false;
+    }
+
+    // Allow "M", "MB" and "MiB"
+    if (*end == 'i') end++;
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end != '\0') return false;
+
+    bytes = static_cast<std::uintmax_t>(value * static_cast<double>(multiplier));
+    return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+std::string formatBytes(std::uintmax_t bytes);
+std::string formatDuration(double seconds);
+std::string formatRate(std::uintmax_t bytes, double seconds);
+
+// Accepts plain byte counts and K/M/G/T suffixes (powers of 1024), returns false if invalid
+bool parseBytes(const std::string& str, std::uintmax_t& bytes);
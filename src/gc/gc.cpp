@@ -0,0 +1,172 @@
+#include "gc.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Anything younger than this may still be written by another lct process
+static const std::chrono::hours min_age(1);
+
+struct Candidate {
+    fs::path path;
+    std::uintmax_t size;
+    fs::file_time_type last_access;
+    bool is_entry;
+};
+
+static std::uintmax_t treeSize(const fs::path& path)
+{
+    std::error_code ec;
+    if (fs::is_regular_file(fs::symlink_status(path, ec))) return fs::file_size(path, ec);
+
+    std::uintmax_t size = 0;
+    for (fs::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_symlink(ec) || !it->is_regular_file(ec)) continue;
+        size += it->file_size(ec);
+    }
+    return size;
+}
+
+static fs::file_time_type lastAccess(const StoreEntry& entry)
+{
+    std::error_code ec;
+    fs::file_time_type latest = fs::last_write_time(entry.path / ".entry", ec);
+
+#ifndef _WIN32
+    // Running a tool updates the atime of its binary on most mounts (relatime)
+    struct stat st;
+    if (!entry.files.empty() && stat((entry.path / entry.files.front().path).c_str(), &st) == 0) {
+        const fs::file_time_type atime = fs::file_time_type::clock::now() - std::chrono::seconds(std::time(nullptr) - st.st_atime);
+        if (atime > latest) latest = atime;
+    }
+#endif
+
+    return latest;
+}
+
+static std::uintmax_t physicalSize(const Store& store, const std::vector<fs::path>& roots, const fs::path& cache_dir)
+{
+    std::uintmax_t size = treeSize(cache_dir);
+    for (const fs::path& root : roots) size += store.Usage(root).physical;
+    return size;
+}
+
+GCResult collectGarbage(const Store& store, const std::vector<fs::path>& roots, const fs::path& cache_dir, const fs::path& install_dir, const std::vector<State>& states, std::optional<std::uintmax_t> budget)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const fs::file_time_type now = fs::file_time_type::clock::now();
+
+    std::unordered_set<std::string> referenced;
+    std::unordered_set<std::string> tracked;
+    for (const State& state : states) {
+        for (const auto& [tool, tool_state] : state.installed_tools) {
+            tracked.insert(tool);
+            for (const std::string& version : tool_state.versions) {
+                referenced.insert(storeVersion(version, state.GetProfile(tool, version)) + "/" + tool);
+            }
+        }
+        for (const auto& [tool, version] : state.staged_tools) {
+            referenced.insert(storeVersion(version, state.GetProfile(tool)) + "/" + tool);
+        }
+    }
+
+    std::vector<Candidate> candidates;
+    std::error_code ec;
+
+    for (const fs::path& root : roots) {
+        // Only the states of this user are known, other users of a shared store
+        // may have installed anything in it
+        const bool shared = root != store.roots.back();
+
+        for (const StoreEntry& entry : store.Entries(root)) {
+            if (referenced.count(entry.version + "/" + entry.tool)) continue;
+
+            // A tool no state knows about (an older lct installed it) is kept
+            // while current/ has its binary. Equal binaries share one object,
+            // so for the other tools only the states tell which version is installed.
+            if (!tracked.count(entry.tool) && !entry.files.empty() &&
+                fs::equivalent(install_dir / entry.files.front().path, entry.path / entry.files.front().path, ec)) continue;
+
+            // Files with more links than the object and this entry stay on disk
+            std::uintmax_t size = 0;
+            bool linked = false;
+            for (const StoreFile& file : entry.files) {
+                std::uintmax_t links = fs::hard_link_count(entry.path / file.path, ec);
+                if (ec) links = 0;
+                if (links <= 2) size += file.size;
+                else linked = true;
+            }
+
+            // In a shared store a link from outside may be someone's install,
+            // an entry is only evicted when nobody links it and it wasn't used lately
+            const fs::file_time_type last_access = lastAccess(entry);
+            if (shared && (linked || now - last_access < min_age)) continue;
+
+            candidates.push_back({entry.path, size, last_access, true});
+        }
+    }
+
+    for (fs::directory_iterator it(cache_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code time_ec;
+        fs::file_time_type modified = fs::last_write_time(it->path(), time_ec);
+        if (time_ec || now - modified < min_age) continue;
+
+        candidates.push_back({it->path(), treeSize(it->path()), modified, false});
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.last_access < b.last_access;
+    });
+
+    const std::uintmax_t before = physicalSize(store, roots, cache_dir);
+    std::uintmax_t estimate = before;
+
+    GCResult result;
+    for (const Candidate& candidate : candidates) {
+        if (budget.has_value() && estimate <= *budget) break;
+
+        fs::remove_all(candidate.path, ec);
+        if (ec) continue;
+
+        // Only succeeds once the last tool of a version is gone
+        if (candidate.is_entry) fs::remove(candidate.path.parent_path(), ec);
+        estimate -= std::min(estimate, candidate.size);
+        result.evicted++;
+    }
+
+    // Objects only linked from the objects directory aren't used by any entry
+    // anymore. A publish adds the object before linking it into its entry, so
+    // young ones may be about to be used.
+    for (const fs::path& root : roots) {
+        std::vector<fs::path> orphans;
+        for (fs::recursive_directory_iterator it(root / "objects", ec), end; !ec && it != end; it.increment(ec)) {
+            std::error_code file_ec;
+            if (!it->is_regular_file(file_ec)) continue;
+            if (it->hard_link_count(file_ec) != 1) continue;
+            const fs::file_time_type modified = it->last_write_time(file_ec);
+            if (file_ec || now - modified < min_age) continue;
+            orphans.push_back(it->path());
+        }
+        for (const fs::path& orphan : orphans) fs::remove(orphan, ec);
+
+        std::vector<fs::path> stale;
+        for (fs::directory_iterator it(root / ".tmp", ec), end; !ec && it != end; it.increment(ec)) {
+            std::error_code time_ec;
+            if (now - it->last_write_time(time_ec) >= min_age) stale.push_back(it->path());
+        }
+        for (const fs::path& path : stale) fs::remove_all(path, ec);
+    }
+
+    result.remaining = physicalSize(store, roots, cache_dir);
+    result.freed = before > result.remaining ? before - result.remaining : 0;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+#include <cstdint>
+#include "../store/store.hpp"
+#include "../data/state.hpp"
+
+struct GCResult {
+    std::uintmax_t freed = 0;
+    std::uintmax_t remaining = 0;
+    std::size_t evicted = 0;
+    double seconds = 0.0;
+};
+
+// Evicts the least recently used store entries of the given roots and cached
+// archives until everything fits into the budget, or everything unreferenced
+// when there is no budget. Entries referenced by any of the states are kept,
+// as are those of tools the states don't know that 'install_dir' links to. In
+// roots other than the per-user one, entries with files linked from anywhere
+// else and entries used within the last hour are kept too.
+GCResult collectGarbage(const Store& store, const std::vector<std::filesystem::path>& roots, const std::filesystem::path& cache_dir,
+                        const std::filesystem::path& install_dir, const std::vector<State>& states, std::optional<std::uintmax_t> budget);
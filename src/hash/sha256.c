@@ -0,0 +1,369 @@
+#include "sha256.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define SHA256_ARM 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+#endif
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// The message schedule only stays in registers when the rounds are unrolled
+#if defined(__clang__)
+#define UNROLL_ROUNDS _Pragma("unroll")
+#elif defined(__GNUC__)
+#define UNROLL_ROUNDS _Pragma("GCC unroll 16")
+#else
+#define UNROLL_ROUNDS
+#endif
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256BlocksPortable(uint32_t state[8], const unsigned char* data, size_t blocks)
+{
+    uint32_t w[64];
+
+    while (blocks--) {
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+                   ((uint32_t)data[i * 4 + 2] << 8) | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+        data += 64;
+    }
+}
+
+#ifdef SHA256_X86
+
+static int sha256HasShaNi(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) return 0;
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1u << 29)) != 0;
+}
+
+// The state is kept as ABEF/CDGH pairs, the layout sha256rnds2 works on
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256BlocksShaNi(uint32_t state[8], const unsigned char* data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks--) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+        __m128i w[4];
+
+        UNROLL_ROUNDS
+        for (int i = 0; i < 16; i++) {
+            __m128i msg;
+            if (i < 4) {
+                msg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), mask);
+            } else {
+                msg = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                msg = _mm_add_epi32(msg, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                msg = _mm_sha256msg2_epu32(msg, w[(i + 3) & 3]);
+            }
+            w[i & 3] = msg;
+
+            msg = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&K[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+#endif
+
+#ifdef SHA256_ARM
+
+static int sha256HasArmv8(void)
+{
+#if defined(__ARM_FEATURE_SHA2) || defined(__APPLE__)
+    return 1;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+    return 0;
+#endif
+}
+
+#if defined(__ARM_FEATURE_SHA2)
+#define SHA256_ARM_TARGET
+#elif defined(__clang__)
+#define SHA256_ARM_TARGET __attribute__((target("sha2")))
+#else
+#define SHA256_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+
+SHA256_ARM_TARGET
+static void sha256BlocksArmv8(uint32_t state[8], const unsigned char* data, size_t blocks)
+{
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+
+    while (blocks--) {
+        const uint32x4_t abcd = state0;
+        const uint32x4_t efgh = state1;
+        uint32x4_t w[4];
+
+        UNROLL_ROUNDS
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+            } else {
+                w[i & 3] = vsha256su1q_u32(vsha256su0q_u32(w[i & 3], w[(i + 1) & 3]), w[(i + 2) & 3], w[(i + 3) & 3]);
+            }
+
+            const uint32x4_t msg = vaddq_u32(w[i & 3], vld1q_u32(&K[i * 4]));
+            const uint32x4_t previous = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, previous, msg);
+        }
+
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+
+#endif
+
+typedef void (*BlocksFunction)(uint32_t state[8], const unsigned char* data, size_t blocks);
+
+typedef struct Implementation {
+    const char* name;
+    BlocksFunction blocks;
+    int (*supported)(void);
+} Implementation;
+
+static int alwaysSupported(void)
+{
+    return 1;
+}
+
+// Fastest first
+static const Implementation implementations[] = {
+#ifdef SHA256_X86
+    { "sha-ni", sha256BlocksShaNi, sha256HasShaNi },
+#endif
+#ifdef SHA256_ARM
+    { "armv8", sha256BlocksArmv8, sha256HasArmv8 },
+#endif
+    { "portable", sha256BlocksPortable, alwaysSupported },
+};
+
+#define IMPLEMENTATION_COUNT (sizeof(implementations) / sizeof(implementations[0]))
+
+static const Implementation* active = NULL;
+
+// Every thread picks the same one, so racing on the first call is harmless
+static const Implementation* activeImplementation(void)
+{
+    if (active) return active;
+
+    const char* forced = getenv("LCT_SHA256");
+    const Implementation* chosen = NULL;
+    for (size_t i = 0; i < IMPLEMENTATION_COUNT && !chosen; i++) {
+        if (!implementations[i].supported()) continue;
+        if (!forced || !*forced || strcmp(forced, implementations[i].name) == 0) chosen = &implementations[i];
+    }
+    if (!chosen) chosen = &implementations[IMPLEMENTATION_COUNT - 1];
+
+    active = chosen;
+    return active;
+}
+
+static void sha256Blocks(uint32_t state[8], const unsigned char* data, size_t blocks)
+{
+    activeImplementation()->blocks(state, data, blocks);
+}
+
+const char* sha256Implementation(void)
+{
+    return activeImplementation()->name;
+}
+
+size_t sha256Implementations(const char** names, size_t max)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < IMPLEMENTATION_COUNT; i++) {
+        if (!implementations[i].supported()) continue;
+        if (count < max) names[count] = implementations[i].name;
+        count++;
+    }
+    return count;
+}
+
+int sha256UseImplementation(const char* name)
+{
+    for (size_t i = 0; i < IMPLEMENTATION_COUNT; i++) {
+        if (strcmp(implementations[i].name, name) != 0) continue;
+        if (!implementations[i].supported()) return -1;
+        active = &implementations[i];
+        return 0;
+    }
+    return -1;
+}
+
+void sha256Init(SHA256* ctx)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->buffer_len = 0;
+}
+
+void sha256Update(SHA256* ctx, const void* data, size_t len)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    ctx->length += len;
+
+    if (ctx->buffer_len > 0) {
+        size_t fill = 64 - ctx->buffer_len;
+        if (fill > len) fill = len;
+        memcpy(ctx->buffer + ctx->buffer_len, bytes, fill);
+        ctx->buffer_len += fill;
+        bytes += fill;
+        len -= fill;
+
+        if (ctx->buffer_len < 64) return;
+        sha256Blocks(ctx->state, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+
+    if (len >= 64) {
+        sha256Blocks(ctx->state, bytes, len / 64);
+        bytes += len & ~(size_t)63;
+        len &= 63;
+    }
+
+    memcpy(ctx->buffer, bytes, len);
+    ctx->buffer_len = len;
+}
+
+void sha256Final(SHA256* ctx, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = ctx->length * 8;
+
+    ctx->buffer[ctx->buffer_len++] = 0x80;
+    if (ctx->buffer_len > 56) {
+        memset(ctx->buffer + ctx->buffer_len, 0, 64 - ctx->buffer_len);
+        sha256Blocks(ctx->state, ctx->buffer, 1);
+        ctx->buffer_len = 0;
+    }
+    memset(ctx->buffer + ctx->buffer_len, 0, 56 - ctx->buffer_len);
+    for (int i = 0; i < 8; i++) {
+        ctx->buffer[56 + i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    sha256Blocks(ctx->state, ctx->buffer, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4]     = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)(ctx->state[i]);
+    }
+}
+
+void sha256Hex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE])
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        hex[i * 2]     = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    hex[SHA256_HEX_SIZE - 1] = '\0';
+}
+
+int sha256File(const char* path, char hex[SHA256_HEX_SIZE])
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+
+    SHA256 ctx;
+    sha256Init(&ctx);
+
+    unsigned char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        sha256Update(&ctx, buf, n);
+    }
+
+    int failed = ferror(file);
+    fclose(file);
+    if (failed) return -1;
+
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    sha256Final(&ctx, digest);
+    sha256Hex(digest, hex);
+
+    return 0;
+}
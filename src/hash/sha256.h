@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE    65
+
+typedef struct SHA256 {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t buffer_len;
+} SHA256;
+
+void sha256Init(SHA256* ctx);
+void sha256Update(SHA256* ctx, const void* data, size_t len);
+void sha256Final(SHA256* ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+void sha256Hex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+
+// Returns 0 on success
+int sha256File(const char* path, char hex[SHA256_HEX_SIZE]);
+
+// The compression function is picked at runtime: SHA-NI on x86, the ARMv8
+// crypto extensions on arm64, plain C everywhere else. LCT_SHA256=<name>
+// forces one of them.
+const char* sha256Implementation(void);
+
+// Writes up to 'max' names of the implementations this CPU supports, returns how many there are
+size_t sha256Implementations(const char** names, size_t max);
+
+// Returns 0 on success, -1 if the name is unknown or unsupported here
+int sha256UseImplementation(const char* name);
+
+#ifdef __cplusplus
+}
+#endif
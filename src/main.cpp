@@ -1,13 +1,28 @@
 #include <iostream>
+#include <fstream>
+#include <iomanip>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#include <algorithm>
 #include "version/version.hpp"
+#include "version/profile.hpp"
 #include "home/home.hpp"
 #include "data/state.hpp"
+#include "data/config.hpp"
+#include "store/store.hpp"
+#include "format/format.hpp"
+#include "gc/gc.hpp"
+#include "shim/shim.hpp"
+#include "bundle/bundle.hpp"
+#include "serve/serve.hpp"
+#include "bench/bench.hpp"
+#include "verify/verify.hpp"
+#include "download/transfer.hpp"
+#include "events/events.hpp"
 #include "terminal/terminal.h"
 #include "shell/shell.h"
 
@@ -24,6 +39,16 @@ typedef unsigned char Command;
 #define COMMAND_LIST        ((Command)7)
 #define COMMAND_PATH        ((Command)8)
 #define COMMAND_REMOVE      ((Command)9)
+#define COMMAND_STORE       ((Command)10)
+#define COMMAND_GC          ((Command)11)
+#define COMMAND_USE         ((Command)12)
+#define COMMAND_APPLY       ((Command)13)
+#define COMMAND_FETCH       ((Command)14)
+#define COMMAND_BUNDLE      ((Command)15)
+#define COMMAND_SERVE       ((Command)16)
+#define COMMAND_BENCH       ((Command)17)
+#define COMMAND_FILES       ((Command)18)
+#define COMMAND_VERIFY      ((Command)19)
 
 #ifdef DEBUG_BUILD
 #define DO_LOCAL_TEST 1
@@ -33,15 +58,23 @@ typedef unsigned char Command;
 
 #define VERSION "v0.1.0-alpha.3-after"
 
-const char* first_version = "v0.1.0-alpha.6";
-const char* latest_version = "v0.1.0-alpha.6.2";
+// Plain arrays are part of the binary, maps would be built on every start
+// even for commands that never look at them
+static const char* const known_versions[] = {
+    "v0.1.0-alpha.6",
+    "v0.1.0-alpha.6.2"
+};
+static const int latest_index = static_cast<int>(sizeof(known_versions) / sizeof(known_versions[0])) - 1;
+
+const char* first_version = known_versions[0];
+const char* latest_version = known_versions[latest_index];
 
-static std::unordered_map<std::string, int> versions = {
-    {"v0.1.0-alpha.6", 0},
-    {"v0.1.0-alpha.6.2", 1}
+struct ToolInfo {
+    const char* name;
+    const char* deps[2]; // nullptr terminated
 };
 
-static std::unordered_map<std::string, std::vector<std::string>> valid_tools_deps = {
+static const ToolInfo known_tools[] = {
     {"lhoho", {}},
     {"ljoke", {}},
     {"lbf",   {}},
@@ -52,7 +85,12 @@ static std::unordered_map<std::string, std::vector<std::string>> valid_tools_dep
     {"lasmp", {}}
 };
 
-static std::unordered_map<std::string, std::vector<std::string> > bundles = {
+struct BundleInfo {
+    const char* name;
+    const char* tools[9]; // nullptr terminated
+};
+
+static const BundleInfo known_bundles[] = {
     {"all", {"lasmp", "lasm", "lnk", "lbt", "lfs", "lbf", "ljoke", "lhoho"}},
 
     {"toolchain", {"lasmp", "lasm", "lnk"}},
@@ -60,14 +98,41 @@ static std::unordered_map<std::string, std::vector<std::string> > bundles = {
     {"fun", {"lbf", "ljoke", "lhoho"}}
 };
 
+// The position of 'version' in known_versions, -1 if it isn't supported
+static int versionIndex(const std::string& version)
+{
+    for (int i = 0; i <= latest_index; i++) {
+        if (version == known_versions[i]) return i;
+    }
+    return -1;
+}
+
+static const ToolInfo* findTool(const std::string& name)
+{
+    for (const ToolInfo& tool : known_tools) {
+        if (name == tool.name) return &tool;
+    }
+    return nullptr;
+}
+
+static bool dependsOn(const ToolInfo& tool, const std::string& dep)
+{
+    for (const char* const* it = tool.deps; *it; it++) {
+        if (dep == *it) return true;
+    }
+    return false;
+}
+
 void printVersion(bool use_ansi)
 {
     (void)use_ansi;
 
-    std::cout << "LCT Manager " << VERSION << std::endl;
-    std::cout << "Supports LCT " << first_version << " through " << latest_version << std::endl;
-    std::cout << "Compiled on " << __DATE__ << std::endl;
-    std::cout << "License: BSD 3-Clause" << std::endl;
+    eventVersion(VERSION, first_version, latest_version);
+
+    std::cout << "LCT Manager " << VERSION << '\n';
+    std::cout << "Supports LCT " << first_version << " through " << latest_version << '\n';
+    std::cout << "Compiled on " << __DATE__ << '\n';
+    std::cout << "License: BSD 3-Clause" << '\n';
 
     std::cout.flush();
 }
@@ -76,61 +141,339 @@ void printHelp(const char* name, std::ostream& out, bool use_ansi)
 {
     (void)use_ansi;
 
-    out << "Usage: " << name << " <command> <args>" << std::endl;
+    out << "Usage: " << name << " <command> <args>" << '\n';
+
+    out << "> " << name << " install <tools>[@<version>] [--profile=release|native|lto|pgo]" << '\n';
+    out << "> " << name << " uninstall <tools>[@<version>]" << '\n';
+    out << "> " << name << " reinstall <tools>[@<version>] [--profile=release|native|lto|pgo]" << '\n';
+    out << "> " << name << " update <tools> [--prepare]" << '\n';
+    out << "> " << name << " fetch [tools]" << '\n';
+    out << "> " << name << " use <tool>@<version>" << '\n';
+    out << "> " << name << " apply <manifest> [--dry-run]" << '\n';
+    out << "> " << name << " list" << '\n';
+    out << "> " << name << " path" << '\n';
+    out << "> " << name << " files <tool>" << '\n';
+    out << "> " << name << " verify [tools] [--full] [--repair] [--jobs=<n>] [--deadline=<seconds>]" << '\n';
+    out << "> " << name << " store" << '\n';
+    out << "> " << name << " gc [--budget=<size>] [--system]" << '\n';
+    out << "> " << name << " bundle export <file> [tools[@<version>]]" << '\n';
+    out << "> " << name << " bundle import <file> [tools[@<version>]]" << '\n';
+    out << "> " << name << " bundle list <file>" << '\n';
+    out << "> " << name << " serve [--bind=<address>] [--port=<port>] [--connections=<n>]" << '\n';
+    out << "> " << name << " bench hash [--size=<size>]" << '\n';
+    out << "> " << name << " bench files [--files=<n>]" << '\n';
+    out << "> " << name << " bench startup [--runs=<n>] [--max=<ms>]" << '\n';
+    out << "> " << name << " remove" << '\n';
+    out << "Add --limit-rate=<rate> or --max-downloads=<n> to a command to limit its downloads, git fetches (source_mode=git) only take a slot and aren't rate limited" << '\n';
+    out << "Add --json to a command to get a line of JSON per event (plan, phases, progress, output, state) instead of text" << '\n';
+}
+
+struct ToolSpec {
+    std::string tool;
+    std::string version; // empty if none was given
+
+    inline std::string Name() const
+    {
+        return version.empty() ? tool : tool + "@" + version;
+    }
+};
 
-    out << "> " << name << " install <tools>" << std::endl;
-    out << "> " << name << " uninstall <tools>" << std::endl;
-    out << "> " << name << " reinstall <tools>" << std::endl;
-    out << "> " << name << " update <tools>" << std::endl;
-    out << "> " << name << " list" << std::endl;
-    out << "> " << name << " path" << std::endl;
-    out << "> " << name << " remove" << std::endl;
+void printSpec(const ToolSpec& spec, bool use_ansi)
+{
+    if (use_ansi) std::cout << "\033[32m";
+    std::cout << spec.tool;
+    if (use_ansi) std::cout << "\033[0m";
+
+    if (!spec.version.empty()) {
+        std::cout << "@";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << spec.version;
+        if (use_ansi) std::cout << "\033[0m";
+    }
 }
 
-#define ARG_CMP(n, str) (std::strcmp(argv[n], str) == 0)
-#define ARG_IS_HELP(n) (ARG_CMP(n, "help") || ARG_CMP(n, "-h") || ARG_CMP(n, "--help"))
-#define ARG_IS_VERSION(n) (ARG_CMP(n, "version") || ARG_CMP(n, "-v") || ARG_CMP(n, "--version"))
+// Tools and bundles, each optionally suffixed with @<version>
+std::vector<ToolSpec> parseToolSpecs(const std::vector<std::string>& args)
+{
+    std::vector<ToolSpec> specs;
+    std::unordered_set<std::string> added;
 
-int main(int argc, const char* argv[])
+    for (const std::string& arg : args) {
+        if (arg.empty() || arg[0] == '-') continue;
+
+        std::string name = arg;
+        std::string version;
+
+        std::size_t at = name.find('@');
+        if (at != std::string::npos) {
+            version = name.substr(at + 1);
+            name.resize(at);
+        }
+
+        const BundleInfo* bundle = nullptr;
+        for (const BundleInfo& known : known_bundles) {
+            if (name == known.name) bundle = &known;
+        }
+
+        if (bundle) {
+            for (const char* const* tool = bundle->tools; *tool; tool++) {
+                if (added.insert(std::string(*tool) + "@" + version).second) specs.push_back({*tool, version});
+            }
+        } else {
+            if (added.insert(name + "@" + version).second) specs.push_back({name, version});
+        }
+    }
+
+    return specs;
+}
+
+std::vector<ToolSpec> parseToolSpecs(int argc, const char* argv[])
 {
-#if DO_LOCAL_TEST == 0
-    const fs::path main_dir = fs::path(getHomeDir()) / ".lct";
-#else
-    const fs::path main_dir = "test";
-#endif
+    return parseToolSpecs(std::vector<std::string>(argv + 2, argv + argc));
+}
+
+// An empty version in a spec matches every version
+bool isRequested(const std::vector<ToolSpec>& specs, const std::string& tool, const std::string& version)
+{
+    for (const ToolSpec& spec : specs) {
+        if (spec.tool != tool) continue;
+        if (spec.version.empty() || version.empty() || spec.version == version) return true;
+    }
+    return false;
+}
+
+std::vector<std::pair<std::string, std::vector<std::string>>> groupByVersion(const std::vector<ToolSpec>& specs)
+{
+    std::vector<std::pair<std::string, std::vector<std::string>>> groups;
+
+    for (const ToolSpec& spec : specs) {
+        auto it = std::find_if(groups.begin(), groups.end(), [&](const auto& group) { return group.first == spec.version; });
+        if (it == groups.end()) groups.push_back({spec.version, {spec.tool}});
+        else it->second.push_back(spec.tool);
+    }
+
+    return groups;
+}
+
+// Specs with the version replaced by what the store keeps the tool's build under,
+// versions that aren't installed yet get the profile of the active one
+std::vector<ToolSpec> withProfiles(const std::vector<ToolSpec>& specs, const State& state)
+{
+    std::vector<ToolSpec> keyed;
+    for (const ToolSpec& spec : specs) {
+        const std::string profile = state.IsInstalled(spec.tool, spec.version) ? state.GetProfile(spec.tool, spec.version) : state.GetProfile(spec.tool);
+        keyed.push_back({spec.tool, storeVersion(spec.version, profile)});
+    }
+    return keyed;
+}
+
+void printGC(const GCResult& result, bool use_ansi)
+{
+    std::cout << "=> Collected garbage: freed ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << formatBytes(result.freed);
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " (" << result.evicted << " evicted, " << formatBytes(result.remaining) << " left) in " << formatDuration(result.seconds) << '\n';
+}
+
+void printList(const State& state, bool use_ansi)
+{
+    for (const ToolInfo& info : known_tools) {
+        const std::string tool = info.name;
+        const bool is_installed = state.IsInstalled(tool);
+
+        if (use_ansi) std::cout << (is_installed ? "\033[32m" : "\033[31m");
+        std::cout << tool << ": " << (is_installed ? "installed" : "not installed");
+        if (use_ansi) std::cout << "\033[0m";
+
+        if (is_installed) {
+            auto version = state.GetVersion(tool);
+            if (version.has_value()) {
+                const bool latest = versionIndex(version->get()) >= latest_index;
+
+                std::cout << " ";
+                if (use_ansi) {
+                    if (latest) std::cout << "\033[36m";
+                    else        std::cout << "\033[33m";
+                }
+                else {
+                    if (latest) std::cout << "(";
+                    else        std::cout << "!(";
+                }
+                std::cout << version->get();
+                if (use_ansi) std::cout << "\033[0m";
+                else          std::cout << ")";
+
+                const std::string profile = state.GetProfile(tool);
+                if (!profile.empty()) std::cout << " [" << profile << "]";
+
+                auto staged = state.staged_tools.find(tool);
+                if (staged != state.staged_tools.end() && staged->second != version->get()) {
+                    std::cout << " | update ready: " << staged->second;
+                }
+
+                std::vector<std::string> others = state.GetVersions(tool);
+                others.erase(std::remove(others.begin(), others.end(), version->get()), others.end());
+                if (!others.empty()) {
+                    std::cout << " | also installed: ";
+                    for (std::size_t i = 0; i < others.size(); i++) {
+                        std::cout << others[i];
+                        const std::string other_profile = state.GetProfile(tool, others[i]);
+                        if (!other_profile.empty()) std::cout << " [" << other_profile << "]";
+                        if (i + 1 < others.size()) std::cout << ", ";
+                    }
+                }
+            }
+        }
+
+        if (info.deps[0]) {
+            std::cout << " | requires: ";
+            for (const char* const* dep = info.deps; *dep; dep++) {
+                if (dep != info.deps) std::cout << ", ";
+                std::cout << *dep;
+            }
+        }
+
+        // Flushed once at exit instead of per line
+        std::cout << '\n';
+    }
+}
+
+void printPath(const fs::path& main_dir, const fs::path& store_root, const fs::path& bin_dir)
+{
+    eventPath(main_dir, store_root, bin_dir);
 
-    const fs::path source_dir = main_dir / "archives";
-    const fs::path install_dir = main_dir / "current";
-    const fs::path bin_dir = install_dir / "bin";
     std::string bin_dir_string;
     for (char c : bin_dir.string()) {
         if (c == '\\') bin_dir_string += "\\\\";
         else bin_dir_string += c;
     }
 
-    bool use_ansi = static_cast<bool>(supportsANSI());
+    std::cout << "LCT-Directory: " << main_dir << "\n";
+    std::cout << "LCT-Store: " << store_root << "\n";
+    std::cout << "\n";
 
-    if (argc < 2) {
-        printHelp(argv[0], std::cerr, use_ansi);
+    std::cout << "Add '" << bin_dir_string << "' to your PATH. If you don't know how to do this, follow these steps:\n";
+
+#ifdef _WIN32
+    std::cout << "1) Terminal:\n";
+    std::cout << "   setx PATH \"%PATH%;" << bin_dir_string << "\"\n\n";
+    std::cout << "   # or in PowerShell:\n";
+    std::cout << "   [Environment]::SetEnvironmentVariable(\"PATH\", $env:PATH + \";" << bin_dir_string << "\", \"User\")\n\n";
+
+    std::cout << "2) Current terminal:\n";
+    std::cout << "   set PATH=%PATH%;" << bin_dir_string << "\n";
+    std::cout << "   # or in PowerShell:\n";
+    std::cout << "   $env:PATH += \";" << bin_dir_string << "\"\n\n";
+
+    std::cout << "3) GUI apps (requires logout/login):\n";
+    std::cout << "   # Changes via setx or PowerShell are picked up after logout/login\n";
+
+#elif defined(__APPLE__) || defined(__MACH__)
+    std::cout << "1) Terminal:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zshrc\n";
+    std::cout << "   # or when using bash:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.bashrc\n\n";
+
+    std::cout << "2) Current terminal:\n";
+    std::cout << "   export PATH=\"$PATH:" << bin_dir_string << "\"\n\n";
+
+    std::cout << "3) GUI apps:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zprofile\n";
+    std::cout << "   # or when using bash:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.bash_profile\n";
+    std::cout << "   # Effects take place after logout/login\n";
+
+#elif defined(__linux__)
+    std::cout << "1) Terminal:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.bashrc\n";
+    std::cout << "   # or when using zsh:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zshrc\n\n";
+
+    std::cout << "2) Current terminal:\n";
+    std::cout << "   export PATH=\"$PATH:" << bin_dir_string << "\"\n\n";
+
+    std::cout << "3) GUI apps:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.profile\n";
+    std::cout << "   # or when using zsh:\n";
+    std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zprofile\n";
+    std::cout << "   # GUI apps will see it after logout/login\n";
+
+#else
+    std::cout << "Please use OS-specific commands to add \"" << bin_dir_string << "\" to PATH.\n";
+#endif
+}
+
+int printFiles(const State& state, const std::string& tool, const fs::path& install_dir, bool use_ansi)
+{
+    auto active = state.GetVersion(tool);
+    if (!active.has_value()) {
+        printError(tool + " isn't installed", use_ansi);
         return 1;
     }
+    eventFiles(state, tool, install_dir);
 
-    const fs::path state_file = main_dir / "lct.state";
-    const std::string state_file_string = state_file.string();
+    const std::vector<InstalledFile> files = state.GetFiles(tool);
+    if (files.empty()) {
+        printWarning(tool + " was installed without a manifest, reinstall it to record one", use_ansi);
+        return 0;
+    }
 
-    auto latestVersionIt = versions.find(latest_version);
-    if (latestVersionIt == versions.end()) {
-        std::cerr << "Internal Error: latest version not defined in versions" << std::endl;
-        return 1;
+    std::cout << "=> Files of ";
+    if (use_ansi) std::cout << "\033[32m";
+    std::cout << tool;
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << storeVersion(active->get(), state.GetProfile(tool));
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " in " << install_dir.string() << ":" << '\n';
+
+    std::uintmax_t total = 0;
+    for (const InstalledFile& file : files) {
+        char mode[10];
+        const char* const bits = "rwxrwxrwx";
+        for (int i = 0; i < 9; i++) mode[i] = (file.mode & (0400u >> i)) ? bits[i] : '-';
+        mode[9] = '\0';
+
+        std::cout << mode << "  " << std::setw(10) << formatBytes(file.size) << "  " << file.hash << "  " << file.path << '\n';
+        total += file.size;
     }
+    std::cout << files.size() << " files, " << formatBytes(total) << '\n';
+    return 0;
+}
 
-    State state;
-    bool state_changed = false;
-    if (!state.Load(state_file)) {
-        printHelp(argv[0], std::cerr, use_ansi);
+#define ARG_CMP(n, str) (std::strcmp(argv[n], str) == 0)
+#define ARG_IS_HELP(n) (ARG_CMP(n, "help") || ARG_CMP(n, "-h") || ARG_CMP(n, "--help"))
+#define ARG_IS_VERSION(n) (ARG_CMP(n, "version") || ARG_CMP(n, "-v") || ARG_CMP(n, "--version"))
+
+static int run(int argc, const char* argv[])
+{
+#if DO_LOCAL_TEST == 0
+    const fs::path main_dir = fs::path(getHomeDir()) / ".lct";
+#else
+    const fs::path main_dir = "test";
+#endif
+
+    int shim_exit_code;
+    if (runShim(main_dir, argc, argv, shim_exit_code)) return shim_exit_code;
+
+    // Help and version don't print in color, so the terminal isn't asked for them
+    if (argc < 2) {
+        printHelp(argv[0], std::cerr, false);
         return 1;
     }
 
+    // Automation asks for events on stdout instead of the human output, from any command
+    bool json = false;
+    int kept_flags = 2;
+    for (int i = 2; i < argc; i++) {
+        if (ARG_CMP(i, "--json")) json = true;
+        else argv[kept_flags++] = argv[i];
+    }
+    argc = kept_flags;
+    if (json) configureEvents(EventMode::Json);
+
     Command command = COMMAND_NONE;
 
     if      (ARG_IS_HELP(1))          command = COMMAND_HELP;
@@ -142,6 +485,250 @@ int main(int argc, const char* argv[])
     else if (ARG_CMP(1, "list"))      command = COMMAND_LIST;
     else if (ARG_CMP(1, "path"))      command = COMMAND_PATH;
     else if (ARG_CMP(1, "remove"))    command = COMMAND_REMOVE;
+    else if (ARG_CMP(1, "store"))     command = COMMAND_STORE;
+    else if (ARG_CMP(1, "gc"))        command = COMMAND_GC;
+    else if (ARG_CMP(1, "use"))       command = COMMAND_USE;
+    else if (ARG_CMP(1, "apply"))     command = COMMAND_APPLY;
+    else if (ARG_CMP(1, "fetch"))     command = COMMAND_FETCH;
+    else if (ARG_CMP(1, "bundle"))    command = COMMAND_BUNDLE;
+    else if (ARG_CMP(1, "serve"))     command = COMMAND_SERVE;
+    else if (ARG_CMP(1, "bench"))     command = COMMAND_BENCH;
+    else if (ARG_CMP(1, "files"))     command = COMMAND_FILES;
+    else if (ARG_CMP(1, "verify"))    command = COMMAND_VERIFY;
+
+    // Read-only commands run in shell prompts and scripts, so each one only
+    // does what it needs and returns before the setup for everything else
+    if (command == COMMAND_HELP) {
+        if (json) {
+            printError("help has no JSON output", false);
+            return 1;
+        }
+        printHelp(argv[0], std::cout, false);
+        return 0;
+    }
+    if (command == COMMAND_VERSION) {
+        printVersion(false);
+        return 0;
+    }
+
+    bool use_ansi = static_cast<bool>(supportsANSI());
+
+    const fs::path install_dir = main_dir / "current";
+    const fs::path state_file = main_dir / "lct.state";
+
+    State state;
+    if (command == COMMAND_LIST || command == COMMAND_FILES) {
+        if (!state.Load(state_file)) {
+            printHelp(argv[0], std::cerr, use_ansi);
+            return 1;
+        }
+        if (command == COMMAND_LIST) {
+            if (json) eventState(state);
+            else printList(state, use_ansi);
+            return 0;
+        }
+        if (argc != 3) {
+            printHelp(argv[0], std::cerr, use_ansi);
+            return 1;
+        }
+        return printFiles(state, argv[2], install_dir, use_ansi);
+    }
+
+    Config config;
+#ifndef _WIN32
+    config.Load("/etc/lct.config");
+#endif
+    config.Load(main_dir / "lct.config");
+
+    // A system store (e.g. /var/cache/lct) is shared by all users, the one in
+    // main_dir is used when it is missing a build and isn't writable
+    Store store;
+    std::optional<std::string> system_store = config.Get("store");
+    if (system_store.has_value()) store.roots.push_back(*system_store);
+    store.roots.push_back(main_dir / "store");
+
+    const fs::path bin_dir = install_dir / "bin";
+    if (command == COMMAND_PATH) {
+        printPath(main_dir, store.roots.front(), bin_dir);
+        return 0;
+    }
+
+    // A terminal gets a status line for long downloads and builds
+    configureEvents(json ? EventMode::Json : use_ansi ? EventMode::Progress : EventMode::Quiet);
+
+    store.peers = config.GetList("peers");
+
+    const fs::path source_dir = main_dir / "archives";
+    const std::string state_file_string = state_file.string();
+    const fs::path generations_dir = main_dir / "generations";
+
+    Sources sources;
+    sources.archive_dir = source_dir;
+    sources.stats_file = main_dir / "mirrors.stats";
+    sources.hashes_file = main_dir / "sources.sha256";
+    sources.release_manifest = config.GetString("release_manifest", "");
+    sources.peers = store.peers;
+    sources.mirrors = config.GetList("mirrors");
+    if (sources.mirrors.empty()) sources.mirrors.push_back(default_mirror);
+    sources.probe = config.GetBool("mirror_probe", true);
+    if (config.GetString("source_mode", "archive") == "git") {
+        sources.git.url = config.GetString("git_url", default_git_url);
+        sources.git.mirror_dir = main_dir / "git" / "LCT.git";
+    }
+    sources.build_root = config.GetString("build_root", "auto");
+    const std::vector<std::string> archive_formats = config.GetList("archive_formats");
+    for (const std::string& format : archive_formats) {
+        if (codecByName(format.c_str()) < 0) {
+            std::cerr << "Invalid archive format (gz, xz or zst): " << format << '\n';
+            return 1;
+        }
+    }
+    if (!archive_formats.empty()) sources.archive_formats = archive_formats;
+    sources.Load();
+
+    // Download limits can be set per command ("<command>_limit_rate") and on the
+    // command line, which is taken out of argv so commands don't see it. Git
+    // fetches only take a connection slot, there is no rate cap for them.
+    DownloadLimits limits;
+    limits.lock_dir = main_dir / "locks";
+    limits.connect_timeout = static_cast<unsigned int>(std::strtoul(config.GetString("connect_timeout", "10").c_str(), nullptr, 10));
+    limits.stall_timeout = static_cast<unsigned int>(std::strtoul(config.GetString("stall_timeout", "30").c_str(), nullptr, 10));
+
+    const std::string command_name = argv[1];
+    std::string limit_rate = config.GetString(command_name + "_limit_rate", config.GetString("limit_rate", ""));
+    std::string max_downloads = config.GetString(command_name + "_max_downloads", config.GetString("max_downloads", ""));
+
+    int kept_args = 2;
+    for (int i = 2; i < argc; i++) {
+        if (std::strncmp(argv[i], "--limit-rate=", 13) == 0) limit_rate = argv[i] + 13;
+        else if (std::strncmp(argv[i], "--max-downloads=", 16) == 0) max_downloads = argv[i] + 16;
+        else argv[kept_args++] = argv[i];
+    }
+    argc = kept_args;
+
+    if (!limit_rate.empty() && !parseBytes(limit_rate, limits.rate)) {
+        std::cerr << "Invalid rate limit: " << limit_rate << '\n';
+        return 1;
+    }
+    if (!max_downloads.empty()) {
+        char* end;
+        limits.connections = static_cast<unsigned int>(std::strtoul(max_downloads.c_str(), &end, 10));
+        if (*end != '\0') {
+            std::cerr << "Invalid download limit: " << max_downloads << '\n';
+            return 1;
+        }
+    }
+    configureDownloads(limits);
+
+    // Builds and pgo training run under these, so a rebuild on a host that
+    // serves traffic stays out of its way. Downloads, git and llvm-profdata don't.
+    ProcessLimits process_limits = {};
+    {
+        const std::string nice_level = config.GetString("build_nice", "");
+        const std::string io_priority = config.GetString("build_ionice", "");
+        const std::string cpus = config.GetString("build_cpus", "");
+        const std::string jobs = config.GetString("build_jobs", "");
+        const std::string memory = config.GetString("build_max_memory", "");
+        const std::string address_space = config.GetString("build_max_address_space", "");
+        const std::string max_load = config.GetString("build_max_load", "");
+
+        char* end;
+        if (!nice_level.empty()) {
+            process_limits.nice = static_cast<int>(std::strtol(nice_level.c_str(), &end, 10));
+            if (*end != '\0' || process_limits.nice < 0 || process_limits.nice > 19) {
+                std::cerr << "Invalid build_nice (0 to 19): " << nice_level << '\n';
+                return 1;
+            }
+        }
+        if (!io_priority.empty()) {
+            // "<class>[:<level>]" as ionice names them
+            const std::size_t colon = io_priority.find(':');
+            const std::string io_class = io_priority.substr(0, colon);
+            process_limits.io_level = 4;
+            if (io_class == "realtime") process_limits.io_class = 1;
+            else if (io_class == "best-effort") process_limits.io_class = 2;
+            else if (io_class == "idle") process_limits.io_class = 3;
+            if (colon != std::string::npos) {
+                process_limits.io_level = static_cast<int>(std::strtol(io_priority.c_str() + colon + 1, &end, 10));
+                if (*end != '\0' || end == io_priority.c_str() + colon + 1) process_limits.io_class = 0;
+            }
+            if (process_limits.io_class == 0 || process_limits.io_level < 0 || process_limits.io_level > 7) {
+                std::cerr << "Invalid build_ionice (idle, best-effort[:0-7] or realtime[:0-7]): " << io_priority << '\n';
+                return 1;
+            }
+        }
+        if (cpus.size() >= sizeof(process_limits.cpus)) {
+            std::cerr << "Invalid build_cpus: " << cpus << '\n';
+            return 1;
+        }
+        std::strcpy(process_limits.cpus, cpus.c_str());
+        if (!jobs.empty()) {
+            process_limits.jobs = static_cast<unsigned int>(std::strtoul(jobs.c_str(), &end, 10));
+            if (*end != '\0') {
+                std::cerr << "Invalid build_jobs: " << jobs << '\n';
+                return 1;
+            }
+        }
+        std::uintmax_t bytes;
+        if (!memory.empty()) {
+            if (!parseBytes(memory, bytes)) {
+                std::cerr << "Invalid build_max_memory: " << memory << '\n';
+                return 1;
+            }
+            process_limits.memory = bytes;
+        }
+        if (!address_space.empty()) {
+            if (!parseBytes(address_space, bytes)) {
+                std::cerr << "Invalid build_max_address_space: " << address_space << '\n';
+                return 1;
+            }
+            process_limits.address_space = bytes;
+        }
+        if (!max_load.empty()) {
+            process_limits.max_load = std::strtod(max_load.c_str(), &end);
+            if (*end != '\0' || process_limits.max_load < 0.0) {
+                std::cerr << "Invalid build_max_load: " << max_load << '\n';
+                return 1;
+            }
+        }
+    }
+    if (configureProcesses(&process_limits) != 0) {
+        std::cerr << "Invalid build_cpus: " << process_limits.cpus << '\n';
+        return 1;
+    }
+
+    // Removing and copying trees (workspaces above all) goes through batches of file operations
+    const std::string file_backend = config.GetString("file_backend", "sync");
+    if (file_backend == "io_uring") {
+        if (configureFileBackend(FILE_BACKEND_IO_URING) != 0) printWarning("io_uring isn't available on this host, file operations fall back to sync", use_ansi);
+    } else if (file_backend != "sync") {
+        std::cerr << "Invalid file_backend (sync or io_uring): " << file_backend << '\n';
+        return 1;
+    }
+
+    bool state_changed = false;
+    if (!state.Load(state_file)) {
+        printHelp(argv[0], std::cerr, use_ansi);
+        return 1;
+    }
+
+    // Whatever a run that crashed or was killed left behind is cleaned up before
+    // anything else touches it, tools caught mid-activation go back to the state's version
+    if (command != COMMAND_NONE) {
+        for (const std::string& tool : clean_interrupted(store, sources, install_dir)) {
+            printWarning("Activating " + tool + " was interrupted, restoring it", use_ansi);
+            state_changed = true;
+            try {
+                uninstall_version(install_dir, {tool}, state);
+                std::optional<std::reference_wrapper<const std::string>> active = state.GetVersion(tool);
+                if (active.has_value()) {
+                    activate_version(storeVersion(active->get(), state.GetProfile(tool)).c_str(), store, install_dir, {tool}, state, use_ansi);
+                }
+            } catch (const std::runtime_error& e) {
+                printError(e.what(), use_ansi);
+            }
+        }
+    }
 
     switch (command)
     {
@@ -156,80 +743,328 @@ int main(int argc, const char* argv[])
         }
 
         case COMMAND_UNINSTALL: case COMMAND_REINSTALL: {
-            std::vector<std::string> tools;
-            std::unordered_set<std::string> added_tools;
+            std::vector<ToolSpec> specs = parseToolSpecs(argc, argv);
+            std::vector<ToolSpec> removals;
+            bool invalid_tool = false;
+
+            for (const ToolSpec& spec : specs) {
+                if (!findTool(spec.tool)) {
+                    printWarning(spec.tool + " doesn't exist. Skipping.", use_ansi);
+                    invalid_tool = true;
+                    continue;
+                }
+
+                std::vector<std::string> tool_versions = state.GetVersions(spec.tool);
+                if (!spec.version.empty()) {
+                    if (!state.IsInstalled(spec.tool, spec.version)) tool_versions.clear();
+                    else tool_versions = {spec.version};
+                }
+
+                if (tool_versions.empty()) {
+                    printWarning(spec.Name() + " isn't installed. Skipping.", use_ansi);
+                    invalid_tool = true;
+                    continue;
+                }
+
+                for (const std::string& version : tool_versions) {
+                    bool required_by_other = false;
+                    for (const ToolInfo& other : known_tools) {
+                        const std::string other_tool = other.name;
+                        if (other_tool == spec.tool) continue;
+                        if (!state.IsInstalled(other_tool, version)) continue;
+                        if (isRequested(specs, other_tool, version)) continue;
+
+                        if (dependsOn(other, spec.tool)) {
+                            printWarning("Cannot uninstall " + spec.tool + "@" + version + ": still required by installed tool " + other_tool + ". Skipping.", use_ansi);
+                            required_by_other = true;
+                            break;
+                        }
+                    }
+
+                    if (required_by_other) {
+                        invalid_tool = true;
+                        continue;
+                    }
+
+                    removals.push_back({spec.tool, version});
+                }
+            }
+
+            if (!removals.empty()) {
+                std::vector<PlanItem> plan;
+                for (const ToolSpec& removal : removals) plan.push_back({"uninstall", removal.tool, removal.version});
+                eventPlan(command_name, plan);
+
+                try {
+                    std::cout << "=> Uninstalling";
+                    for (const ToolSpec& removal : removals) {
+                        std::cout << " ";
+                        printSpec(removal, use_ansi);
+                    }
+                    std::cout << "..." << '\n';
+
+                    // The manifests of the active versions say what to remove, so that happens first
+                    std::vector<std::string> deactivated;
+                    for (const ToolSpec& removal : removals) {
+                        auto active = state.GetVersion(removal.tool);
+                        if (active.has_value() && active->get() == removal.version) deactivated.push_back(removal.tool);
+                    }
+
+                    uninstall_version(install_dir, deactivated, state);
+                    for (const ToolSpec& removal : removals) state.RemoveVersion(removal.tool, removal.version, versionIndex);
+                    state_changed = true;
+
+                    // Fall back to another installed version
+                    std::vector<ToolSpec> fallbacks;
+                    for (const std::string& tool : deactivated) {
+                        auto active = state.GetVersion(tool);
+                        if (active.has_value()) fallbacks.push_back({tool, active->get()});
+                    }
+
+                    for (const auto& [version, tools] : groupByVersion(withProfiles(fallbacks, state))) {
+                        activate_version(version.c_str(), store, install_dir, tools, state, use_ansi);
+                    }
+                } catch (const std::runtime_error& e) {
+                    printError(e.what(), use_ansi);
+                    return 1;
+                }
+            } else if (!invalid_tool) {
+                printHelp(argv[0], std::cerr, use_ansi);
+                return 1;
+            }
+
+            if (command != COMMAND_REINSTALL) break;
+
+            [[fallthrough]];
+        }
+
+        case COMMAND_INSTALL: {
+            std::vector<ToolSpec> specs = parseToolSpecs(argc, argv);
+            std::vector<ToolSpec> installs;
             bool invalid_tool = false;
 
+            // Without --profile a tool keeps the profile it was installed with
+            std::optional<std::string> requested_profile;
             for (int i = 2; i < argc; i++) {
-                const char* arg = argv[i];
+                if (std::strncmp(argv[i], "--profile=", 10) == 0) requested_profile = argv[i] + 10;
+            }
+            if (requested_profile.has_value() && *requested_profile == "release") requested_profile = "";
+            if (requested_profile.has_value() && !requested_profile->empty() && !isProfile(*requested_profile)) {
+                printError("Unknown build profile: " + *requested_profile, use_ansi);
+                return 1;
+            }
+
+            const std::string default_profile = config.GetString("profile", "") == "release" ? "" : config.GetString("profile", "");
+            if (!default_profile.empty() && !isProfile(default_profile)) {
+                printError("Unknown build profile in config: " + default_profile, use_ansi);
+                return 1;
+            }
+
+            auto profileOf = [&](const std::string& tool) {
+                if (requested_profile.has_value()) return *requested_profile;
+                if (state.IsInstalled(tool)) return state.GetProfile(tool);
+                return default_profile;
+            };
+
+            for (ToolSpec& spec : specs) {
+                if (spec.version.empty()) spec.version = latest_version;
+            }
+
+            for (std::size_t i = 0; i < specs.size(); i++) {
+                const ToolSpec spec = specs[i];
 
-                if (arg[0] == '-') continue;
+                if (!findTool(spec.tool)) {
+                    printWarning(spec.tool + " doesn't exist. Skipping.", use_ansi);
+                    invalid_tool = true;
+                    continue;
+                }
+
+                if (versionIndex(spec.version) < 0) {
+                    printWarning(spec.version + " isn't a supported version of LCT. Skipping " + spec.tool + ".", use_ansi);
+                    invalid_tool = true;
+                    continue;
+                }
+
+                const std::string profile = profileOf(spec.tool);
+                if (state.IsInstalled(spec.tool, spec.version) && state.GetProfile(spec.tool, spec.version) == profile) {
+                    printWarning(spec.Name() + " is already installed. Skipping.", use_ansi);
+                    invalid_tool = true;
+                    continue;
+                }
+
+                for (const char* const* dep_name = findTool(spec.tool)->deps; *dep_name; dep_name++) {
+                    const std::string dep = *dep_name;
+                    if (state.IsInstalled(dep, spec.version)) continue;
+                    if (isRequested(specs, dep, spec.version)) continue;
+
+                    printWarning(spec.tool + " requires " + dep + ". Adding " + dep + ".", use_ansi);
+                    specs.push_back({dep, spec.version});
+                }
+
+                installs.push_back({spec.tool, storeVersion(spec.version, profile)});
+            }
 
-                std::string name = arg;
-                
-                auto bundleIt = bundles.find(name);
-                if (bundleIt != bundles.end()) {
-                    for (const std::string& tool : bundleIt->second) {
-                        if (added_tools.insert(tool).second) tools.push_back(tool);
+            if (!installs.empty()) {
+                std::vector<PlanItem> plan;
+                for (const ToolSpec& install : installs) plan.push_back({"install", install.tool, install.version});
+                eventPlan(command_name, plan);
+
+                try {
+                    // One download and build per version and profile, no matter how many tools need it
+                    for (const auto& [version, tools] : groupByVersion(installs)) {
+                        std::cout << "=> Installing ";
+
+                        for (const std::string& tool : tools) {
+                            if (use_ansi) std::cout << "\033[32m";
+                            std::cout << tool;
+                            if (use_ansi) std::cout << "\033[0m";
+                            std::cout << " ";
+                        }
+
+                        std::cout << "of ";
+                        if (use_ansi) std::cout << "\033[36m";
+                        std::cout << version;
+                        if (use_ansi) std::cout << "\033[0m";
+
+                        std::cout << "..." << '\n';
+
+                        install_version(version.c_str(), store, sources, install_dir, tools, state, use_ansi);
+                        state_changed = true;
+
+                        std::string plain_version, profile;
+                        splitStoreVersion(version, plain_version, profile);
+                        for (const std::string& tool : tools) {
+                            state.SetTool(tool, plain_version);
+                            state.SetProfile(tool, plain_version, profile);
+                        }
                     }
-                } else {
-                    if (added_tools.insert(name).second) tools.push_back(name);
+                } catch (const std::runtime_error& e) {
+                    printError(e.what(), use_ansi);
+                    return 1;
+                }
+            } else if (!invalid_tool) {
+                printHelp(argv[0], std::cerr, use_ansi);
+                return 1;
+            }
+
+            break;
+        }
+
+        case COMMAND_UPDATE: case COMMAND_FETCH: {
+            // Fetching builds the latest version into the store without activating it,
+            // a later update then only has to verify and link it
+            bool prepare_only = command == COMMAND_FETCH;
+            for (int i = 2; i < argc; i++) {
+                if (ARG_CMP(i, "--prepare")) prepare_only = true;
+            }
+
+            std::vector<ToolSpec> specs = parseToolSpecs(argc, argv);
+            std::vector<std::string> tools;
+            bool invalid_tool = false;
+
+            const bool fetch_all = specs.empty() && prepare_only;
+            if (fetch_all) {
+                for (const auto& kv : state.installed_tools) specs.push_back({kv.first, ""});
+            }
+
+            for (const ToolSpec& spec : specs) {
+                const std::string& tool = spec.tool;
+
+                if (!findTool(tool)) {
+                    printWarning(tool + " doesn't exist. Skipping.", use_ansi);
+                    invalid_tool = true;
+                    continue;
+                }
+
+                if (!spec.version.empty()) {
+                    printWarning("update always moves to the latest version, use 'install " + spec.Name() + "' instead. Skipping.", use_ansi);
+                    invalid_tool = true;
+                    continue;
+                }
+
+                if (!state.IsInstalled(tool)) {
+                    printWarning(tool + " isn't installed. Skipping.", use_ansi);
+                    invalid_tool = true;
+                    continue;
                 }
-            }
 
-            for (std::size_t i = 0; i < tools.size(); /* manual incrementing */) {
-                const std::string& tool = tools[i];
+                const std::string& active = state.GetVersion(tool)->get();
 
-                if (valid_tools_deps.find(tool) == valid_tools_deps.end()) {
-                    if (use_ansi) std::cerr << "\033[33m";
-                    std::cerr << "Warning: " << tool << " doesn't exist. Skipping." << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m";
-                    tools.erase(tools.begin() + i);
+                if (versionIndex(active) >= latest_index) {
+                    if (!fetch_all) printWarning(tool + " is already up to date. Skipping.", use_ansi);
                     invalid_tool = true;
-
                     continue;
                 }
 
-                if (!state.IsInstalled(tool)) {
-                    if (use_ansi) std::cerr << "\033[33m";
-                    std::cerr << "Warning: " << tool << " isn't installed. Skipping." << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m";
-                    tools.erase(tools.begin() + i);
-                    invalid_tool = true;
-
+                if (prepare_only) {
+                    tools.push_back(tool);
                     continue;
                 }
 
                 bool required_by_other = false;
-                for (const auto& [other_tool, deps] : valid_tools_deps) {
+                for (const ToolInfo& other : known_tools) {
+                    const std::string other_tool = other.name;
                     if (other_tool == tool) continue;
-                    if (!state.IsInstalled(other_tool)) continue;
-                    if (added_tools.find(other_tool) != added_tools.end()) continue;
-
-                    for (const auto& dep : deps) {
-                        if (dep == tool) {
-                            if (use_ansi) std::cerr << "\033[33m";
-                            std::cerr << "Warning: Cannot uninstall " << tool  << ": still required by installed tool " << other_tool << ". Skipping.\n";
-                            if (use_ansi) std::cerr << "\033[0m";
-                            required_by_other = true;
-                            break;
-                        }
+                    if (!state.IsInstalled(other_tool, active)) continue;
+                    if (isRequested(specs, other_tool, "")) continue;
+
+                    if (dependsOn(other, tool)) {
+                        printWarning("Cannot update " + tool + ": still required by installed tool " + other_tool + ". Update both to update " + tool + ". Skipping.", use_ansi);
+                        required_by_other = true;
+                        break;
                     }
-                    if (required_by_other) break;
                 }
 
                 if (required_by_other) {
-                    tools.erase(tools.begin() + i);
                     invalid_tool = true;
                     continue;
                 }
 
-                i++;
+                tools.push_back(tool);
             }
 
             if (!tools.empty()) {
+                std::vector<PlanItem> plan;
+                for (const std::string& tool : tools) plan.push_back({prepare_only ? "fetch" : "update", tool, latest_version});
+                eventPlan(command_name, plan);
+            }
+
+            if (!tools.empty() && prepare_only) {
                 try {
-                    std::cout << "=> Uninstalling";
+                    std::cout << "=> Fetching";
+
+                    for (const std::string& tool : tools) {
+                        std::cout << " ";
+                        if (use_ansi) std::cout << "\033[32m";
+                        std::cout << tool;
+                        if (use_ansi) std::cout << "\033[0m";
+                    }
+
+                    std::cout << "..." << '\n';
+
+                    std::vector<ToolSpec> latest;
+                    for (const std::string& tool : tools) latest.push_back({tool, latest_version});
+                    for (const auto& [version, profile_tools] : groupByVersion(withProfiles(latest, state))) {
+                        prepare_version(version.c_str(), store, sources, profile_tools, use_ansi);
+                    }
+                    state_changed = true;
+
+                    for (const std::string& tool : tools) {
+                        state.StageTool(tool, latest_version);
+                    }
+
+                    std::cout << "=> Ready, run '" << argv[0] << " update' to activate ";
+                    if (use_ansi) std::cout << "\033[36m";
+                    std::cout << latest_version;
+                    if (use_ansi) std::cout << "\033[0m";
+                    std::cout << '\n';
+                } catch (const std::runtime_error& e) {
+                    printError(e.what(), use_ansi);
+                    return 1;
+                }
+            } else if (!tools.empty()) {
+                try {
+                    std::cout << "=> Updating";
 
                     for (const std::string& tool : tools) {
                         std::cout << " ";
@@ -238,247 +1073,399 @@ int main(int argc, const char* argv[])
                         if (use_ansi) std::cout << "\033[0m";
                     }
 
-                    std::cout << "..." << std::endl;
+                    std::cout << "..." << '\n';
+
+                    // Only switch once the new version is complete, so a failed build
+                    // leaves the old one in place
+                    std::vector<ToolSpec> latest;
+                    for (const std::string& tool : tools) latest.push_back({tool, latest_version});
+                    const auto groups = groupByVersion(withProfiles(latest, state));
+                    for (const auto& [version, profile_tools] : groups) {
+                        prepare_version(version.c_str(), store, sources, profile_tools, use_ansi);
+                        verify_version(version.c_str(), store, profile_tools, use_ansi);
+                    }
 
-                    uninstall_version(install_dir, tools);
+                    // Activating over the old version only replaces the files that changed
+                    for (const auto& [version, profile_tools] : groups) {
+                        activate_version(version.c_str(), store, install_dir, profile_tools, state, use_ansi);
+                    }
                     state_changed = true;
 
                     for (const std::string& tool : tools) {
-                        state.RemoveTool(tool);
+                        const std::string previous = state.GetVersion(tool)->get();
+                        const std::string profile = state.GetProfile(tool, previous);
+                        state.RemoveVersion(tool, previous, versionIndex);
+                        state.SetTool(tool, latest_version);
+                        state.SetProfile(tool, latest_version, profile);
+                        state.UnstageTool(tool);
                     }
                 } catch (const std::runtime_error& e) {
-                    if (use_ansi) std::cerr << "\033[31m";
-                    std::cerr << e.what() << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m"; 
+                    printError(e.what(), use_ansi);
                     return 1;
                 }
+            } else if (fetch_all) {
+                std::cout << "=> Nothing to fetch, everything is up to date" << '\n';
             } else if (!invalid_tool) {
                 printHelp(argv[0], std::cerr, use_ansi);
                 return 1;
             }
 
-            if (command != COMMAND_REINSTALL) break;
+            break;
+        }
 
-            [[fallthrough]];
+        case COMMAND_USE: {
+            std::vector<ToolSpec> specs = parseToolSpecs(argc, argv);
+            if (specs.empty()) {
+                printHelp(argv[0], std::cerr, use_ansi);
+                return 1;
+            }
+
+            std::vector<PlanItem> plan;
+            for (const ToolSpec& spec : specs) {
+                if (!spec.version.empty() && state.IsInstalled(spec.tool, spec.version)) plan.push_back({"use", spec.tool, spec.version});
+            }
+            eventPlan(command_name, plan);
+
+            try {
+                for (const ToolSpec& spec : specs) {
+                    if (spec.version.empty() || !state.IsInstalled(spec.tool, spec.version)) {
+                        printWarning(spec.Name() + " isn't installed. Skipping.", use_ansi);
+                        continue;
+                    }
+
+                    std::cout << "=> Using ";
+                    printSpec(spec, use_ansi);
+                    std::cout << "..." << '\n';
+
+                    // Every version keeps the profile it was installed with
+                    const std::string version = storeVersion(spec.version, state.GetProfile(spec.tool, spec.version));
+                    prepare_version(version.c_str(), store, sources, {spec.tool}, use_ansi);
+
+                    activate_version(version.c_str(), store, install_dir, {spec.tool}, state, use_ansi);
+                    state.SetTool(spec.tool, spec.version);
+                    state_changed = true;
+                }
+            } catch (const std::runtime_error& e) {
+                printError(e.what(), use_ansi);
+                return 1;
+            }
+
+            break;
         }
 
-        case COMMAND_INSTALL: {
-            std::vector<std::string> tools;
-            std::unordered_set<std::string> added_tools;
-            bool invalid_tool = false;
+        case COMMAND_APPLY: {
+            const char* manifest_path = nullptr;
+            bool dry_run = false;
 
             for (int i = 2; i < argc; i++) {
-                const char* arg = argv[i];
+                if (ARG_CMP(i, "--dry-run")) dry_run = true;
+                else if (argv[i][0] != '-' && !manifest_path) manifest_path = argv[i];
+                else {
+                    printHelp(argv[0], std::cerr, use_ansi);
+                    return 1;
+                }
+            }
 
-                if (arg[0] == '-') continue;
+            if (!manifest_path) {
+                printHelp(argv[0], std::cerr, use_ansi);
+                return 1;
+            }
 
-                std::string name = arg;
-                
-                auto bundleIt = bundles.find(name);
-                if (bundleIt != bundles.end()) {
-                    for (const std::string& tool : bundleIt->second) {
-                        if (added_tools.insert(tool).second) tools.push_back(tool);
-                    }
-                } else {
-                    if (added_tools.insert(name).second) tools.push_back(name);
+            // Same syntax as the command line, '#' starts a comment
+            std::ifstream manifest(manifest_path);
+            if (!manifest.is_open()) {
+                printError(std::string("Couldn't open ") + manifest_path, use_ansi);
+                return 1;
+            }
+
+            std::vector<std::string> words;
+            std::string line;
+            while (std::getline(manifest, line)) {
+                std::size_t comment = line.find('#');
+                if (comment != std::string::npos) line.resize(comment);
+
+                std::size_t pos = 0;
+                while (pos < line.size()) {
+                    std::size_t begin = line.find_first_not_of(" \t\r", pos);
+                    if (begin == std::string::npos) break;
+                    std::size_t end = line.find_first_of(" \t\r", begin);
+                    if (end == std::string::npos) end = line.size();
+                    words.push_back(line.substr(begin, end - begin));
+                    pos = end;
                 }
             }
 
-            for (std::size_t i = 0; i < tools.size(); /* manual incrementing */) {
-                const std::string& tool = tools[i];
+            std::vector<ToolSpec> specs = parseToolSpecs(words);
+
+            // The last listed version of a tool becomes its active one
+            State desired;
+            bool invalid_tool = false;
+            for (std::size_t i = 0; i < specs.size(); i++) {
+                ToolSpec spec = specs[i];
+                if (spec.version.empty()) spec.version = latest_version;
 
-                if (valid_tools_deps.find(tool) == valid_tools_deps.end()) {
-                    if (use_ansi) std::cerr << "\033[33m";
-                    std::cerr << "Warning: " << tool << " doesn't exist. Skipping." << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m";
-                    tools.erase(tools.begin() + i);
+                const ToolInfo* info = findTool(spec.tool);
+                if (!info) {
+                    printWarning(spec.tool + " doesn't exist. Skipping.", use_ansi);
                     invalid_tool = true;
                     continue;
                 }
 
-                if (state.IsInstalled(tool)) {
-                    if (use_ansi) std::cerr << "\033[33m";
-                    std::cerr << "Warning: " << tool << " is already installed. Skipping." << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m";
-                    tools.erase(tools.begin() + i);
+                if (versionIndex(spec.version) < 0) {
+                    printWarning(spec.version + " isn't a supported version of LCT. Skipping " + spec.tool + ".", use_ansi);
                     invalid_tool = true;
                     continue;
                 }
 
-                auto depsIt = valid_tools_deps.find(tool);
-                if (depsIt != valid_tools_deps.end()) {
-                    for (const std::string& dep : depsIt->second) {
-                        if (state.IsInstalled(dep)) continue;
+                desired.SetTool(spec.tool, spec.version);
 
-                        if (added_tools.insert(dep).second) {
-                            if (use_ansi) std::cerr << "\033[33m";
-                            std::cerr << "Warning: " << tool << " requires " << dep << ". Adding " << dep << "." << std::endl;
-                            if (use_ansi) std::cerr << "\033[0m";
-                            tools.push_back(dep);
-                        }
-                    }
+                // Implicit dependencies follow the active version of the tool needing
+                // them, a dependency the manifest lists at any version is left to that
+                for (const char* const* dep = info->deps; *dep; dep++) {
+                    if (isRequested(specs, *dep, "")) continue;
+                    desired.SetTool(*dep, spec.version);
                 }
+            }
 
-                i++;
+            if (invalid_tool) {
+                printError(std::string("Invalid manifest ") + manifest_path, use_ansi);
+                return 1;
             }
 
-            if (!tools.empty()) {
-                try {
-                    std::cout << "=> Installing ";
+            // Manifests don't name profiles, installed versions keep theirs and new ones get the tool's
+            for (auto& [tool, tool_state] : desired.installed_tools) {
+                for (const std::string& version : tool_state.versions) {
+                    desired.SetProfile(tool, version, state.IsInstalled(tool, version) ? state.GetProfile(tool, version) : state.GetProfile(tool));
+                }
+            }
 
-                    for (const std::string& tool : tools) {
-                        if (use_ansi) std::cout << "\033[32m";
-                        std::cout << tool;
-                        if (use_ansi) std::cout << "\033[0m";
-                        std::cout << " ";
-                    }
+            std::vector<ToolSpec> installs;
+            std::vector<ToolSpec> removals;
+            std::vector<ToolSpec> activations;
+            std::vector<std::string> deactivations;
 
-                    std::cout << "of ";
-                    if (use_ansi) std::cout << "\033[36m";
-                    std::cout << latest_version;
-                    if (use_ansi) std::cout << "\033[0m";
+            for (const auto& [tool, tool_state] : desired.installed_tools) {
+                for (const std::string& version : tool_state.versions) {
+                    if (!state.IsInstalled(tool, version)) installs.push_back({tool, version});
+                }
 
-                    std::cout << "..." << std::endl;
+                auto active = state.GetVersion(tool);
+                if (!active.has_value() || active->get() != tool_state.active) activations.push_back({tool, tool_state.active});
+            }
 
-                    install_version(latest_version, source_dir, install_dir, tools, use_ansi);
-                    state_changed = true;
+            for (const auto& [tool, tool_state] : state.installed_tools) {
+                for (const std::string& version : tool_state.versions) {
+                    if (!desired.IsInstalled(tool, version)) removals.push_back({tool, version});
+                }
 
-                    for (const std::string& tool : tools) {
-                        state.SetTool(tool, latest_version);
-                    }
-                } catch (const std::runtime_error& e) {
-                    if (use_ansi) std::cerr << "\033[31m";
-                    std::cerr << e.what() << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m"; 
-                    return 1;
+                if (!desired.IsInstalled(tool)) deactivations.push_back(tool);
+            }
+
+            if (installs.empty() && removals.empty() && activations.empty()) {
+                std::cout << "=> Nothing to do, already matches " << manifest_path << '\n';
+                break;
+            }
+
+            std::cout << "=> Plan for " << manifest_path << ":" << '\n';
+            for (const ToolSpec& install : installs) {
+                std::cout << "   + ";
+                printSpec(install, use_ansi);
+                std::cout << (store.Has(storeVersion(install.version, desired.GetProfile(install.tool)), install.tool) ? " (from store)" : " (build)") << '\n';
+            }
+            for (const ToolSpec& removal : removals) {
+                std::cout << "   - ";
+                printSpec(removal, use_ansi);
+                std::cout << '\n';
+            }
+            for (const ToolSpec& activation : activations) {
+                std::cout << "   * ";
+                printSpec(activation, use_ansi);
+                std::cout << " (active)" << '\n';
+            }
+
+            std::vector<PlanItem> plan;
+            for (const ToolSpec& install : installs) plan.push_back({"install", install.tool, install.version});
+            for (const ToolSpec& removal : removals) plan.push_back({"uninstall", removal.tool, removal.version});
+            for (const ToolSpec& activation : activations) plan.push_back({"activate", activation.tool, activation.version});
+            eventPlan(command_name, plan);
+
+            if (dry_run) break;
+
+            // Build everything first, current/ and the state are only touched
+            // once every version is in the store
+            try {
+                for (const auto& [version, tools] : groupByVersion(withProfiles(installs, desired))) {
+                    prepare_version(version.c_str(), store, sources, tools, use_ansi);
                 }
-            } else if (!invalid_tool) {
-                printHelp(argv[0], std::cerr, use_ansi);
+
+                // Switched tools keep the files their new version shares with the old one
+                uninstall_version(install_dir, deactivations, state);
+
+                for (const auto& [version, tools] : groupByVersion(withProfiles(activations, desired))) {
+                    activate_version(version.c_str(), store, install_dir, tools, state, use_ansi);
+                }
+            } catch (const std::runtime_error& e) {
+                printError(e.what(), use_ansi);
                 return 1;
             }
 
+            // The manifest doesn't list files, those of the activations are in 'state'
+            for (auto& [tool, tool_state] : desired.installed_tools) tool_state.files = state.GetFiles(tool);
+            state = desired;
+            state_changed = true;
             break;
         }
 
-        case COMMAND_UPDATE: {
-            std::vector<std::string> tools;
-            std::unordered_set<std::string> added_tools;
-            bool invalid_tool = false;
+        case COMMAND_STORE: {
+            for (const fs::path& root : store.roots) {
+                if (!fs::exists(root)) continue;
+
+                StoreUsage usage = store.Usage(root);
+                std::cout << "Store " << root << ":" << '\n';
+                std::cout << "  " << usage.entries << " entries, " << usage.files << " files, " << usage.objects << " objects" << '\n';
+                std::cout << "  Logical:  " << formatBytes(usage.logical) << '\n';
+                std::cout << "  Physical: " << formatBytes(usage.physical);
+                if (usage.logical > usage.physical) std::cout << " (saved " << formatBytes(usage.logical - usage.physical) << ")";
+                std::cout << '\n';
+            }
 
-            for (int i = 2; i < argc; i++) {
-                const char* arg = argv[i];
+            StoreUsage installed = installedUsage(install_dir);
+            std::cout << "Installed " << install_dir << ":" << '\n';
+            std::cout << "  " << installed.files << " files" << '\n';
+            std::cout << "  Logical:  " << formatBytes(installed.logical) << '\n';
+            std::cout << "  Physical: " << formatBytes(installed.physical) << '\n';
 
-                if (arg[0] == '-') continue;
+            break;
+        }
 
-                std::string name = arg;
-                
-                auto bundleIt = bundles.find(name);
-                if (bundleIt != bundles.end()) {
-                    for (const std::string& tool : bundleIt->second) {
-                        if (added_tools.insert(tool).second) tools.push_back(tool);
+        case COMMAND_GC: {
+            std::optional<std::uintmax_t> budget;
+            std::vector<fs::path> roots = {store.roots.back()};
+
+            for (int i = 2; i < argc; i++) {
+                if (std::strncmp(argv[i], "--budget=", 9) == 0) {
+                    std::uintmax_t bytes;
+                    if (!parseBytes(argv[i] + 9, bytes)) {
+                        std::cerr << "Invalid budget: " << (argv[i] + 9) << '\n';
+                        return 1;
                     }
+                    budget = bytes;
+                } else if (ARG_CMP(i, "--system")) {
+                    roots = store.roots;
                 } else {
-                    if (added_tools.insert(name).second) tools.push_back(name);
+                    printHelp(argv[0], std::cerr, use_ansi);
+                    return 1;
                 }
             }
 
-            for (std::size_t i = 0; i < tools.size(); /* manual incrementing */) {
-                const std::string& tool = tools[i];
+            std::vector<State> states = loadGenerations(generations_dir);
+            states.push_back(state);
 
-                if (valid_tools_deps.find(tool) == valid_tools_deps.end()) {
-                    if (use_ansi) std::cerr << "\033[33m";
-                    std::cerr << "Warning: " << tool << " doesn't exist. Skipping." << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m";
-                    tools.erase(tools.begin() + i);
-                    invalid_tool = true;
+            printGC(collectGarbage(store, roots, source_dir, install_dir, states, budget), use_ansi);
+            break;
+        }
 
-                    continue;
-                }
+        case COMMAND_BUNDLE: {
+            if (argc < 4) {
+                printHelp(argv[0], std::cerr, use_ansi);
+                return 1;
+            }
 
-                if (!state.IsInstalled(tool)) {
-                    if (use_ansi) std::cerr << "\033[33m";
-                    std::cerr << "Warning: " << tool << " isn't installed. Skipping." << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m";
-                    tools.erase(tools.begin() + i);
-                    invalid_tool = true;
+            const fs::path bundle_file = argv[3];
+            const std::vector<ToolSpec> specs = parseToolSpecs(std::vector<std::string>(argv + 4, argv + argc));
 
-                    continue;
-                }
+            if (ARG_CMP(2, "export")) {
+                std::vector<StoreEntry> entries;
+                std::vector<std::string> bundle_versions;
+                std::unordered_set<std::string> seen;
+
+                for (const fs::path& root : store.roots) {
+                    for (StoreEntry& entry : store.Entries(root)) {
+                        // Builds of every profile but native go along, they share the source archive
+                        std::string entry_version, entry_profile;
+                        splitStoreVersion(entry.version, entry_version, entry_profile);
 
-                int version_value = -1;
+                        if (!specs.empty() && !isRequested(specs, entry.tool, entry_version)) continue;
+                        if (isHostOnly(entry.version)) continue;
+                        if (store.Find(entry.version, entry.tool) != entry.path) continue;
+                        if (!seen.insert(entry.version + "/" + entry.tool).second) continue;
 
-                auto version = state.GetVersion(tool);
-                if (version.has_value()) {
-                    auto versionIt = versions.find(version->get());
-                    if (versionIt != versions.end()) {
-                        version_value = versionIt->second;
+                        if (std::find(bundle_versions.begin(), bundle_versions.end(), entry_version) == bundle_versions.end()) {
+                            bundle_versions.push_back(entry_version);
+                        }
+                        entries.push_back(std::move(entry));
                     }
                 }
 
-                if (version_value >= latestVersionIt->second) {
-                    if (use_ansi) std::cerr << "\033[33m";
-                    std::cerr << "Warning: " << tool << " is already up to date. Skipping." << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m";
-                    tools.erase(tools.begin() + i);
-                    invalid_tool = true;
-
-                    continue;
+                if (entries.empty()) {
+                    printError("Nothing to export, install or fetch the tools first", use_ansi);
+                    return 1;
                 }
 
-                bool required_by_other = false;
-                for (const auto& [other_tool, deps] : valid_tools_deps) {
-                    if (other_tool == tool) continue;
-                    if (!state.IsInstalled(other_tool)) continue;
-                    if (added_tools.find(other_tool) != added_tools.end()) continue;
-
-                    for (const auto& dep : deps) {
-                        if (dep == tool) {
-                            if (use_ansi) std::cerr << "\033[33m";
-                            std::cerr << "Warning: Cannot update " << tool  << ": still required by installed tool " << other_tool << ". Update both to update " << tool << ". Skipping.\n";
-                            if (use_ansi) std::cerr << "\033[0m";
-                            required_by_other = true;
-                            break;
-                        }
+                // The sources let a site build tools that aren't in the bundle
+                std::vector<fs::path> archives;
+                for (const std::string& version : bundle_versions) {
+                    std::cout << "==> Collecting source of ";
+                    if (use_ansi) std::cout << "\033[36m";
+                    std::cout << version;
+                    if (use_ansi) std::cout << "\033[0m";
+                    std::cout << "..." << '\n';
+
+                    const fs::path archive = sources.Download(version, use_ansi);
+                    if (archive.empty()) {
+                        printWarning("Couldn't download source of " + version + ", the bundle only contains its prebuilt tools", use_ansi);
+                        continue;
                     }
-                    if (required_by_other) break;
+                    archives.push_back(archive);
                 }
 
-                if (required_by_other) {
-                    tools.erase(tools.begin() + i);
-                    invalid_tool = true;
-                    continue;
+                try {
+                    BundleStats stats = exportBundle(bundle_file, entries, archives);
+                    std::cout << "=> Exported " << stats.entries << " entries and " << stats.archives << " archives to ";
+                    if (use_ansi) std::cout << "\033[36m";
+                    std::cout << bundle_file.string();
+                    if (use_ansi) std::cout << "\033[0m";
+                    std::cout << ": " << formatBytes(stats.size) << " stored in " << formatBytes(stats.stored) << " in " << formatDuration(stats.seconds) << '\n';
+                } catch (const std::runtime_error& e) {
+                    printError(e.what(), use_ansi);
+                    return 1;
+                }
+            } else if (ARG_CMP(2, "import") || ARG_CMP(2, "list")) {
+                Bundle bundle;
+                if (!bundle.Open(bundle_file)) {
+                    printError("Not a valid bundle: " + bundle_file.string(), use_ansi);
+                    return 1;
                 }
 
-                i++;
-            }
-
-            if (!tools.empty()) {
-                try {
-                    std::cout << "=> Updating";
+                std::vector<std::pair<std::string, std::string>> entries;
+                for (const auto& entry : bundle.Entries()) {
+                    if (specs.empty() || isRequested(specs, entry.second, entry.first)) entries.push_back(entry);
+                }
 
-                    for (const std::string& tool : tools) {
-                        std::cout << " ";
-                        if (use_ansi) std::cout << "\033[32m";
-                        std::cout << tool;
-                        if (use_ansi) std::cout << "\033[0m";
+                if (ARG_CMP(2, "list")) {
+                    std::cout << "Bundle " << bundle_file << " (" << bundle.platform << "):" << '\n';
+                    for (const BundleFile& file : bundle.files) {
+                        std::cout << "  " << file.name << " (" << formatBytes(file.size) << ")" << '\n';
                     }
+                    break;
+                }
 
-                    std::cout << "..." << std::endl;
-
-                    uninstall_version(install_dir, tools);
-                    install_version(latest_version, source_dir, install_dir, tools, use_ansi);
-                    state_changed = true;
+                if (bundle.platform != hostPlatform()) {
+                    printWarning("Bundle is for " + bundle.platform + ", only its source archives are imported", use_ansi);
+                }
 
-                    for (const std::string& tool : tools) {
-                        state.SetTool(tool, latest_version);
-                    }
+                try {
+                    BundleStats stats = importBundle(bundle, store, source_dir, entries);
+                    std::cout << "=> Imported " << stats.entries << " entries and " << stats.archives << " archives (";
+                    if (use_ansi) std::cout << "\033[36m";
+                    std::cout << formatBytes(stats.size);
+                    if (use_ansi) std::cout << "\033[0m";
+                    std::cout << ") in " << formatDuration(stats.seconds) << '\n';
                 } catch (const std::runtime_error& e) {
-                    if (use_ansi) std::cerr << "\033[31m";
-                    std::cerr << e.what() << std::endl;
-                    if (use_ansi) std::cerr << "\033[0m"; 
+                    printError(e.what(), use_ansi);
                     return 1;
                 }
-            } else if (!invalid_tool) {
+            } else {
                 printHelp(argv[0], std::cerr, use_ansi);
                 return 1;
             }
@@ -486,108 +1473,176 @@ int main(int argc, const char* argv[])
             break;
         }
 
-        case COMMAND_LIST: {
-            for (const auto& kv : valid_tools_deps) {
-                const std::string& tool = kv.first;
-                const bool is_installed = state.IsInstalled(tool);
-
-                if (use_ansi) std::cout << (is_installed ? "\033[32m" : "\033[31m");
-                std::cout << tool << ": " << (is_installed ? "installed" : "not installed");
-                if (use_ansi) std::cout << "\033[0m";
-
-                if (is_installed) {
-                    int version_value = -1;
-
-                    auto version = state.GetVersion(tool);
-                    if (version.has_value()) {
-                        auto versionIt = versions.find(version->get());
-                        if (versionIt != versions.end()) {
-                            version_value = versionIt->second;
-                        }
+        case COMMAND_SERVE: {
+            ServeOptions options;
+            options.bind = config.GetString("serve_bind", options.bind);
+            std::string port = config.GetString("serve_port", std::to_string(options.port));
+            std::string connections = config.GetString("serve_connections", std::to_string(options.max_connections));
 
-                        std::cout << " ";
-                        if (use_ansi) {
-                            if (version_value >= latestVersionIt->second) std::cout << "\033[36m";
-                            else                                          std::cout << "\033[33m";
-                        }
-                        else {
-                            if (version_value >= latestVersionIt->second) std::cout << "(";
-                            else                                          std::cout << "!(";
-                        }
-                        std::cout << version->get();
-                        if (use_ansi) std::cout << "\033[0m";
-                        else          std::cout << ")";
-                    }
+            for (int i = 2; i < argc; i++) {
+                if (std::strncmp(argv[i], "--bind=", 7) == 0) options.bind = argv[i] + 7;
+                else if (std::strncmp(argv[i], "--port=", 7) == 0) port = argv[i] + 7;
+                else if (std::strncmp(argv[i], "--connections=", 14) == 0) connections = argv[i] + 14;
+                else {
+                    printHelp(argv[0], std::cerr, use_ansi);
+                    return 1;
                 }
+            }
 
-                if (!kv.second.empty()) {
-                    std::cout << " | requires: ";
-                    for (std::size_t i = 0; i < kv.second.size(); i++) {
-                        std::cout << kv.second[i];
-                        if (i + 1 < kv.second.size()) std::cout << ", ";
-                    }
-                }
+            char* end;
+            unsigned long port_value = std::strtoul(port.c_str(), &end, 10);
+            if (*end != '\0' || port_value == 0 || port_value > 65535) {
+                std::cerr << "Invalid port: " << port << '\n';
+                return 1;
+            }
+            options.port = static_cast<unsigned short>(port_value);
 
-                std::cout << std::endl;
+            unsigned long connections_value = std::strtoul(connections.c_str(), &end, 10);
+            if (*end != '\0' || connections_value == 0) {
+                std::cerr << "Invalid connection limit: " << connections << '\n';
+                return 1;
             }
+            options.max_connections = static_cast<unsigned int>(connections_value);
 
+            if (!serve(store, source_dir, options, use_ansi)) return 1;
             break;
         }
 
-        case COMMAND_PATH: {
-            std::cout << "LCT-Directory: " << main_dir << std::endl;
-            std::cout << std::endl;
+        case COMMAND_BENCH: {
+            if (argc >= 3 && std::strcmp(argv[2], "startup") == 0) {
+                // A median above the limit fails, so CI catches startup regressions
+                std::size_t runs = 200;
+                double limit = 1.0;
+                for (int i = 3; i < argc; i++) {
+                    char* end;
+                    if (std::strncmp(argv[i], "--runs=", 7) == 0) {
+                        runs = static_cast<std::size_t>(std::strtoul(argv[i] + 7, &end, 10));
+                        if (*end == '\0' && runs > 0) continue;
+                    } else if (std::strncmp(argv[i], "--max=", 6) == 0) {
+                        limit = std::strtod(argv[i] + 6, &end);
+                        if (*end == '\0' && limit >= 0.0) continue;
+                    }
+                    printHelp(argv[0], std::cerr, use_ansi);
+                    return 1;
+                }
 
-            std::cout << "Add '" << bin_dir_string << "' to your PATH. If you don't know how to do this, follow these steps:" << std::endl;
+                std::string self = argv[0];
+#ifdef __linux__
+                std::error_code ec;
+                const fs::path exe = fs::read_symlink("/proc/self/exe", ec);
+                if (!ec) self = exe.string();
+#endif
+                if (!benchStartup(self.c_str(), runs, limit / 1000.0, use_ansi)) return 1;
+                break;
+            }
 
-#ifdef _WIN32
-            std::cout << "1) Terminal:\n";
-            std::cout << "   setx PATH \"%PATH%;" << bin_dir_string << "\"\n\n";
-            std::cout << "   # or in PowerShell:\n";
-            std::cout << "   [Environment]::SetEnvironmentVariable(\"PATH\", $env:PATH + \";" << bin_dir_string << "\", \"User\")\n\n";
+            if (argc >= 3 && std::strcmp(argv[2], "files") == 0) {
+                std::size_t files = 10000;
+                for (int i = 3; i < argc; i++) {
+                    char* end;
+                    if (std::strncmp(argv[i], "--files=", 8) == 0) {
+                        files = static_cast<std::size_t>(std::strtoul(argv[i] + 8, &end, 10));
+                        if (*end == '\0' && files > 0) continue;
+                    }
+                    printHelp(argv[0], std::cerr, use_ansi);
+                    return 1;
+                }
 
-            std::cout << "2) Current terminal:\n";
-            std::cout << "   set PATH=%PATH%;" << bin_dir_string << "\n";
-            std::cout << "   # or in PowerShell:\n";
-            std::cout << "   $env:PATH += \";" << bin_dir_string << "\"\n\n";
+                if (!benchFiles(files, use_ansi)) return 1;
+                break;
+            }
 
-            std::cout << "3) GUI apps (requires logout/login):\n";
-            std::cout << "   # Changes via setx or PowerShell are picked up after logout/login\n";
+            if (argc < 3 || std::strcmp(argv[2], "hash") != 0) {
+                printHelp(argv[0], std::cerr, use_ansi);
+                return 1;
+            }
 
-#elif defined(__APPLE__) || defined(__MACH__)
-            std::cout << "1) Terminal:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zshrc\n";
-            std::cout << "   # or when using bash:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.bashrc\n\n";
+            std::uintmax_t size = 256 * 1024 * 1024;
+            for (int i = 3; i < argc; i++) {
+                if (std::strncmp(argv[i], "--size=", 7) == 0 && parseBytes(argv[i] + 7, size) && size > 0) continue;
+                printHelp(argv[0], std::cerr, use_ansi);
+                return 1;
+            }
 
-            std::cout << "2) Current terminal:\n";
-            std::cout << "   export PATH=\"$PATH:" << bin_dir_string << "\"\n\n";
+            if (!benchHash(size, use_ansi)) return 1;
+            break;
+        }
 
-            std::cout << "3) GUI apps:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zprofile\n";
-            std::cout << "   # or when using bash:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.bash_profile\n";
-            std::cout << "   # Effects take place after logout/login\n";
+        case COMMAND_VERIFY: {
+            // A deadline keeps a fleet-wide check from running long on a host with a slow disk
+            VerifyOptions options;
+            std::string deadline = config.GetString("verify_deadline", "");
+            std::string jobs;
+            for (int i = 2; i < argc; i++) {
+                if (ARG_CMP(i, "--full")) options.full = true;
+                else if (ARG_CMP(i, "--repair")) options.repair = true;
+                else if (std::strncmp(argv[i], "--jobs=", 7) == 0) jobs = argv[i] + 7;
+                else if (std::strncmp(argv[i], "--deadline=", 11) == 0) deadline = argv[i] + 11;
+                else if (argv[i][0] == '-') {
+                    printHelp(argv[0], std::cerr, use_ansi);
+                    return 1;
+                }
+            }
 
-#elif defined(__linux__)
-            std::cout << "1) Terminal:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.bashrc\n";
-            std::cout << "   # or when using zsh:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zshrc\n\n";
+            char* end;
+            if (!jobs.empty()) {
+                options.jobs = static_cast<unsigned int>(std::strtoul(jobs.c_str(), &end, 10));
+                if (*end != '\0' || options.jobs == 0) {
+                    std::cerr << "Invalid job count: " << jobs << '\n';
+                    return 1;
+                }
+            }
+            if (!deadline.empty()) {
+                options.deadline = std::strtod(deadline.c_str(), &end);
+                if (*end != '\0' || options.deadline < 0.0) {
+                    std::cerr << "Invalid deadline: " << deadline << '\n';
+                    return 1;
+                }
+            }
 
-            std::cout << "2) Current terminal:\n";
-            std::cout << "   export PATH=\"$PATH:" << bin_dir_string << "\"\n\n";
+            std::vector<std::string> tools;
+            const std::vector<ToolSpec> specs = parseToolSpecs(argc, argv);
+            if (specs.empty()) {
+                for (const auto& [tool, tool_state] : state.installed_tools) tools.push_back(tool);
+                std::sort(tools.begin(), tools.end());
+            }
+            for (const ToolSpec& spec : specs) {
+                if (!state.IsInstalled(spec.tool)) {
+                    printError(spec.tool + " isn't installed", use_ansi);
+                    return 1;
+                }
+                tools.push_back(spec.tool);
+            }
 
-            std::cout << "3) GUI apps:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.profile\n";
-            std::cout << "   # or when using zsh:\n";
-            std::cout << "   echo 'export PATH=\"$PATH:" << bin_dir_string << "\"' >> ~/.zprofile\n";
-            std::cout << "   # GUI apps will see it after logout/login\n";
+            std::vector<std::string> with_manifest;
+            for (const std::string& tool : tools) {
+                if (state.GetFiles(tool).empty()) printWarning(tool + " was installed without a manifest, reinstall it to record one", use_ansi);
+                else with_manifest.push_back(tool);
+            }
+            if (with_manifest.empty()) break;
 
+#ifdef _WIN32
+            if (config.GetBool("shims", false)) options.shim = main_dir / "shims" / "lct-shim.exe";
 #else
-            std::cout << "Please use OS-specific commands to add \"" << bin_dir_string << "\" to PATH.\n";
+            if (config.GetBool("shims", false)) options.shim = main_dir / "shims" / "lct-shim";
 #endif
-
+            const VerifyResult result = verifyInstalled(store, install_dir, with_manifest, state, options, use_ansi);
+            if (result.repaired > 0) state_changed = true;
+
+            std::cout << "=> Verified ";
+            if (use_ansi) std::cout << "\033[36m";
+            std::cout << result.checked;
+            if (use_ansi) std::cout << "\033[0m";
+            std::cout << " files of " << with_manifest.size() << (with_manifest.size() == 1 ? " tool" : " tools") << " in " << formatDuration(result.seconds);
+            if (result.hashed > 0) std::cout << " (" << formatRate(result.hashed, result.seconds) << ")";
+            std::cout << ": " << result.bad << " bad";
+            if (options.repair) std::cout << ", " << result.repaired << " repaired";
+            std::cout << '\n';
+
+            if (result.unchecked > 0) {
+                printWarning(std::to_string(result.unchecked) + " files weren't checked before the deadline of " + formatDuration(options.deadline), use_ansi);
+            }
+            if (result.bad > result.repaired) return 1;
             break;
         }
 
@@ -597,18 +1652,74 @@ int main(int argc, const char* argv[])
         }
 
         default:
-            std::cerr << "Unknown command: " << argv[1] << std::endl;
+            std::cerr << "Unknown command: " << argv[1] << '\n';
             return 1;
     }
 
+    const DownloadTotals& downloaded = downloadTotals();
+    if (downloaded.files > 1 || downloaded.throttled > 0.0 || downloaded.queued > 0.0) {
+        std::cout << "=> Downloaded ";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << formatBytes(downloaded.bytes);
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " in " << downloaded.files << " files, " << formatDuration(downloaded.seconds) << " (" << formatRate(downloaded.bytes, downloaded.seconds);
+        if (limits.rate > 0) std::cout << ", capped at " << formatRate(limits.rate, 1.0);
+        if (downloaded.throttled > 0.0) std::cout << ", " << formatDuration(downloaded.throttled) << " throttled";
+        if (downloaded.queued > 0.0) std::cout << ", " << formatDuration(downloaded.queued) << " queued";
+        std::cout << ")" << '\n';
+    }
+
+    const ProcessTotals* processes = processTotals();
+    if (processes->pauses > 0) {
+        std::cout << "=> Builds yielded ";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << formatDuration(processes->throttled);
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " to a load average above " << process_limits.max_load << " (" << processes->pauses << (processes->pauses == 1 ? " pause)" : " pauses)") << '\n';
+    }
+
     if (state_changed) {
         sh_mkdir(state_file.parent_path().string().c_str());
 
+        unsigned int keep_generations = static_cast<unsigned int>(std::strtoul(config.GetString("keep_generations", "3").c_str(), nullptr, 10));
+        rotateGenerations(state_file, generations_dir, keep_generations);
+
         if (!state.Save(state_file)) {
-            std::cerr << "Couldn't save state to " << state_file_string << std::endl;
+            std::cerr << "Couldn't save state to " << state_file_string << '\n';
             return 1;
         }
+
+        if (config.GetBool("shims", false)) {
+            try {
+                writeShims(main_dir / "shims", bin_dir, store, state);
+            } catch (const std::runtime_error& e) {
+                if (use_ansi) std::cerr << "\033[31m";
+                std::cerr << e.what() << '\n';
+                if (use_ansi) std::cerr << "\033[0m";
+                return 1;
+            }
+        }
+
+        // Only the per-user store is collected automatically, a system store
+        // may hold builds other users rely on
+        std::uintmax_t budget;
+        std::optional<std::string> budget_string = config.Get("gc_budget");
+        if (budget_string.has_value() && parseBytes(*budget_string, budget)) {
+            std::vector<State> states = loadGenerations(generations_dir);
+            states.push_back(state);
+
+            GCResult result = collectGarbage(store, {store.roots.back()}, source_dir, install_dir, states, budget);
+            if (result.evicted > 0) printGC(result, use_ansi);
+        }
     }
 
+    eventState(state);
     return 0;
 }
+
+int main(int argc, const char* argv[])
+{
+    const int exit_code = run(argc, argv);
+    eventExit(exit_code);
+    return exit_code;
+}
@@ -0,0 +1,371 @@
+#include "serve.hpp"
+#include <iostream>
+
+#ifndef _WIN32
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef _WIN32
+
+bool serve(const Store& store, const fs::path& archive_dir, const ServeOptions& options, bool use_ansi)
+{
+    (void)store;
+    (void)archive_dir;
+    (void)options;
+    (void)use_ansi;
+
+    std::cerr << "lct serve isn't supported on Windows" << std::endl;
+    return false;
+}
+
+#else
+
+static const std::size_t max_header_size = 8 * 1024;
+static const int io_timeout_seconds = 30;
+
+static std::mutex log_mutex;
+
+struct Request {
+    std::string method;
+    std::string target;
+    std::string range;
+};
+
+struct Range {
+    off_t start;
+    off_t length;
+};
+
+static bool sendAll(int fd, const char* data, std::size_t size)
+{
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+// Zero-copy where the kernel supports it, a plain read/send loop elsewhere
+static bool sendFile(int out, int in, off_t offset, off_t length)
+{
+#ifdef __linux__
+    while (length > 0) {
+        ssize_t sent = sendfile(out, in, &offset, static_cast<std::size_t>(length));
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        length -= sent;
+    }
+    return true;
+#else
+    std::vector<char> buffer(64 * 1024);
+    if (lseek(in, offset, SEEK_SET) < 0) return false;
+
+    while (length > 0) {
+        const std::size_t want = static_cast<std::size_t>(std::min<off_t>(length, static_cast<off_t>(buffer.size())));
+        ssize_t count = read(in, buffer.data(), want);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        if (!sendAll(out, buffer.data(), static_cast<std::size_t>(count))) return false;
+        length -= count;
+    }
+    return true;
+#endif
+}
+
+static bool readRequest(int fd, Request& request)
+{
+    std::string data;
+    char buffer[1024];
+
+    while (data.find("\r\n\r\n") == std::string::npos) {
+        if (data.size() > max_header_size) return false;
+
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        data.append(buffer, static_cast<std::size_t>(count));
+    }
+
+    std::size_t line_end = data.find("\r\n");
+    const std::string line = data.substr(0, line_end);
+    std::size_t first = line.find(' ');
+    std::size_t second = line.find(' ', first + 1);
+    if (first == std::string::npos || second == std::string::npos) return false;
+
+    request.method = line.substr(0, first);
+    request.target = line.substr(first + 1, second - first - 1);
+
+    std::size_t pos = line_end + 2;
+    while (pos < data.size()) {
+        std::size_t end = data.find("\r\n", pos);
+        if (end == std::string::npos || end == pos) break;
+        const std::string header = data.substr(pos, end - pos);
+        pos = end + 2;
+
+        std::size_t colon = header.find(':');
+        if (colon == std::string::npos) continue;
+
+        std::string name = header.substr(0, colon);
+        for (char& c : name) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (name != "range") continue;
+
+        std::size_t value = header.find_first_not_of(' ', colon + 1);
+        if (value != std::string::npos) request.range = header.substr(value);
+    }
+
+    return true;
+}
+
+// Only a single "bytes=" range is honored, anything else gets the whole file
+static int parseRange(const std::string& header, off_t size, Range& range)
+{
+    range.start = 0;
+    range.length = size;
+    if (header.rfind("bytes=", 0) != 0 || header.find(',') != std::string::npos) return 200;
+
+    const std::string spec = header.substr(6);
+    std::size_t dash = spec.find('-');
+    if (dash == std::string::npos) return 200;
+
+    const std::string first = spec.substr(0, dash);
+    const std::string last = spec.substr(dash + 1);
+    if (first.empty() && last.empty()) return 200;
+
+    char* end;
+    if (first.empty()) {
+        // Suffix range, the last N bytes
+        long long suffix = std::strtoll(last.c_str(), &end, 10);
+        if (*end != '\0' || suffix <= 0) return 416;
+        if (suffix > size) suffix = size;
+        range.start = size - suffix;
+        range.length = suffix;
+        return size == 0 ? 416 : 206;
+    }
+
+    long long start = std::strtoll(first.c_str(), &end, 10);
+    if (*end != '\0' || start < 0 || start >= size) return 416;
+
+    long long stop = size - 1;
+    if (!last.empty()) {
+        stop = std::strtoll(last.c_str(), &end, 10);
+        if (*end != '\0' || stop < start) return 416;
+        if (stop >= size) stop = size - 1;
+    }
+
+    range.start = start;
+    range.length = stop - start + 1;
+    return 206;
+}
+
+static bool safeSegment(const std::string& segment)
+{
+    return !segment.empty() && segment != "." && segment != ".." && segment.find('\\') == std::string::npos;
+}
+
+static std::vector<std::string> splitPath(const std::string& path)
+{
+    std::vector<std::string> segments;
+    std::size_t pos = 1;
+    while (pos <= path.size()) {
+        std::size_t slash = path.find('/', pos);
+        if (slash == std::string::npos) slash = path.size();
+        segments.push_back(path.substr(pos, slash - pos));
+        pos = slash + 1;
+    }
+    return segments;
+}
+
+// Maps a request target to a file, empty if there is none to serve
+static fs::path resolve(const Store& store, const fs::path& archive_dir, const std::string& target)
+{
+    std::string path = target.substr(0, target.find('?'));
+    if (path.empty() || path[0] != '/' || path.find('%') != std::string::npos) return fs::path();
+
+    const std::vector<std::string> segments = splitPath(path);
+    for (const std::string& segment : segments) {
+        if (!safeSegment(segment)) return fs::path();
+    }
+
+    if (segments.size() == 2 && segments[0] == "archives") {
+        return archive_dir / segments[1];
+    }
+
+    if (segments.size() >= 5 && segments[0] == "store") {
+        if (segments[1] != hostPlatform() || isHostOnly(segments[2])) return fs::path();
+
+        fs::path file = store.Find(segments[2], segments[3]);
+        if (file.empty()) return fs::path();
+
+        for (std::size_t i = 4; i < segments.size(); i++) file /= segments[i];
+        return file;
+    }
+
+    return fs::path();
+}
+
+static void respond(int fd, int status, const char* reason, const std::string& headers)
+{
+    const std::string response = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n" + headers +
+                                 "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    sendAll(fd, response.data(), response.size());
+}
+
+static void logRequest(const Request& request, int status, off_t bytes)
+{
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cout << request.method << " " << request.target << " " << status << " " << bytes << std::endl;
+}
+
+static void handleConnection(int fd, const Store& store, const fs::path& archive_dir)
+{
+    struct timeval timeout;
+    timeout.tv_sec = io_timeout_seconds;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    Request request;
+    if (!readRequest(fd, request)) {
+        respond(fd, 400, "Bad Request", "");
+        return;
+    }
+
+    const bool head = request.method == "HEAD";
+    if (!head && request.method != "GET") {
+        respond(fd, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n");
+        logRequest(request, 405, 0);
+        return;
+    }
+
+    const fs::path file = resolve(store, archive_dir, request.target);
+    int in = file.empty() ? -1 : open(file.c_str(), O_RDONLY);
+
+    struct stat st;
+    if (in >= 0 && (fstat(in, &st) != 0 || !S_ISREG(st.st_mode))) {
+        close(in);
+        in = -1;
+    }
+    if (in < 0) {
+        respond(fd, 404, "Not Found", "");
+        logRequest(request, 404, 0);
+        return;
+    }
+
+    Range range;
+    const int status = request.range.empty() ? 200 : parseRange(request.range, st.st_size, range);
+    if (status == 200) {
+        range.start = 0;
+        range.length = st.st_size;
+    }
+
+    if (status == 416) {
+        respond(fd, 416, "Range Not Satisfiable", "Content-Range: bytes */" + std::to_string(st.st_size) + "\r\n");
+        logRequest(request, 416, 0);
+        close(in);
+        return;
+    }
+
+    std::string headers = "HTTP/1.1 " + std::to_string(status) + (status == 206 ? " Partial Content" : " OK") + "\r\n";
+    headers += "Content-Type: application/octet-stream\r\n";
+    headers += "Accept-Ranges: bytes\r\n";
+    headers += "Content-Length: " + std::to_string(range.length) + "\r\n";
+    if (status == 206) {
+        headers += "Content-Range: bytes " + std::to_string(range.start) + "-" + std::to_string(range.start + range.length - 1) +
+                   "/" + std::to_string(st.st_size) + "\r\n";
+    }
+    headers += "Connection: close\r\n\r\n";
+
+    bool sent = sendAll(fd, headers.data(), headers.size());
+    if (sent && !head) sent = sendFile(fd, in, range.start, range.length);
+    close(in);
+
+    logRequest(request, status, sent && !head ? range.length : 0);
+}
+
+bool serve(const Store& store, const fs::path& archive_dir, const ServeOptions& options, bool use_ansi)
+{
+    // Peers hanging up mid-transfer must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0) {
+        std::cerr << "Couldn't create socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.bind.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Invalid bind address: " << options.bind << std::endl;
+        close(server);
+        return false;
+    }
+
+    if (bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server, 128) != 0) {
+        std::cerr << "Couldn't listen on " << options.bind << ":" << options.port << ": " << std::strerror(errno) << std::endl;
+        close(server);
+        return false;
+    }
+
+    std::cout << "=> Serving ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << "http://" << options.bind << ":" << options.port;
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << " (" << hostPlatform() << ", up to " << options.max_connections << " connections)" << std::endl;
+
+    std::atomic<unsigned int> active(0);
+
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) continue;
+            std::cerr << "Couldn't accept connection: " << std::strerror(errno) << std::endl;
+            close(server);
+            return false;
+        }
+
+        if (active.load() >= options.max_connections) {
+            respond(client, 503, "Service Unavailable", "Retry-After: 1\r\n");
+            close(client);
+            continue;
+        }
+
+        active++;
+        std::thread([client, &store, &archive_dir, &active]() {
+            handleConnection(client, store, archive_dir);
+            close(client);
+            active--;
+        }).detach();
+    }
+}
+
+#endif
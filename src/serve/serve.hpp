@@ -0,0 +1,18 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include "../store/store.hpp"
+
+// Serves the archive cache and the store of this machine to other lct instances
+// (their 'peers' setting) over plain HTTP/1.1, GET and HEAD with single Range:
+//   /archives/<archive>
+//   /store/<platform>/<version>/<tool>/<file>   (including '.entry')
+struct ServeOptions {
+    std::string bind = "0.0.0.0";
+    unsigned short port = 7878;
+    unsigned int max_connections = 64;
+};
+
+// Runs until the process is terminated, returns false if the socket couldn't be set up
+bool serve(const Store& store, const std::filesystem::path& archive_dir, const ServeOptions& options, bool use_ansi);
@@ -28,3 +28,45 @@ CommandResult tar_gz(const char* path, const char* out)
 #endif
     return shell3Bases(base1, base2, base3, path, out);
 }
+
+CommandResult tar_gz_excluding(const char* path, const char* out, const char* const* excludes, size_t exclude_count)
+{
+    if (exclude_count == 0) return tar_gz(path, out);
+
+#ifdef _WIN32
+    const char* base1 = "tar -xzf '";
+    const char* base2 = "' -C '";
+    const char* base3 = "'";
+    const char* exclude1 = " --exclude '";
+    const char* exclude2 = "'";
+#else
+    const char* base1 = "tar -xzf \"";
+    const char* base2 = "\" -C \"";
+    const char* base3 = "\"";
+    const char* exclude1 = " --exclude \"";
+    const char* exclude2 = "\"";
+#endif
+
+    size_t length = strlen(base1) + strlen(path) + strlen(base2) + strlen(out) + strlen(base3) + 1;
+    for (size_t i = 0; i < exclude_count; i++) {
+        length += strlen(exclude1) + strlen(excludes[i]) + strlen(exclude2);
+    }
+
+    char* cmd = (char*)malloc(length);
+    if (!cmd) return invalidCommandResult;
+
+    strcpy(cmd, base1);
+    strcat(cmd, path);
+    strcat(cmd, base2);
+    strcat(cmd, out);
+    strcat(cmd, base3);
+    for (size_t i = 0; i < exclude_count; i++) {
+        strcat(cmd, exclude1);
+        strcat(cmd, excludes[i]);
+        strcat(cmd, exclude2);
+    }
+
+    CommandResult res = invokeShellCall(cmd);
+    free(cmd);
+    return res;
+}
@@ -4,3 +4,6 @@
 
 CommandResult unzip(const char* path, const char* out);
 CommandResult tar_gz(const char* path, const char* out);
+
+// Skips members matching any of the patterns, e.g. "*/tools/lbf"
+CommandResult tar_gz_excluding(const char* path, const char* out, const char* const* excludes, size_t exclude_count);
@@ -0,0 +1,671 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "batch.h"
+#include "copy.h"
+#include "remove.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && __has_include(<linux/version.h>)
+#include <linux/version.h>
+// IORING_OP_UNLINKAT is the newest operation used, it came with 5.11
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+#define LCT_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+// A batch runs once it holds this many operations or bytes
+#define BATCH_OPERATIONS 256
+#define BATCH_BYTES (16u * 1024u * 1024u)
+
+typedef struct FileOperation {
+    char* path;
+    unsigned char* data; // NULL for an unlink
+    size_t size;
+    unsigned int mode;
+    int directory;
+    int fd;
+    int failed;
+} FileOperation;
+
+struct FileBatch {
+    FileOperation operations[BATCH_OPERATIONS];
+    size_t count;
+    size_t bytes;
+    size_t failed;
+};
+
+static FileBackend requested = FILE_BACKEND_SYNC;
+
+#ifdef LCT_HAVE_IO_URING
+typedef struct Ring {
+    int fd;
+    unsigned int entries;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+} Ring;
+
+static Ring ring;
+static int ring_state = 0; // 0 not tried yet, 1 ready, -1 unavailable
+
+// Result of an operation that hasn't completed
+#define PENDING INT_MIN
+
+static int ringSupports(const struct io_uring_probe* probe, unsigned int op)
+{
+    return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+static int setupRing(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // Seccomp filters of containers often refuse it, that is what the fallback is for
+    const int fd = (int)syscall(__NR_io_uring_setup, BATCH_OPERATIONS, &params);
+    if (fd < 0) return -1;
+
+    const size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, probe_size);
+    int supported = probe && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    ringSupports(probe, IORING_OP_OPENAT) && ringSupports(probe, IORING_OP_WRITE) &&
+                    ringSupports(probe, IORING_OP_CLOSE) && ringSupports(probe, IORING_OP_UNLINKAT);
+    free(probe);
+    if (!supported || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(fd);
+        return -1;
+    }
+
+    // With IORING_FEAT_SINGLE_MMAP both rings live in one mapping
+    size_t ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    const size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > ring_size) ring_size = cq_size;
+
+    unsigned char* rings = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    void* sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        munmap(rings, ring_size);
+        close(fd);
+        return -1;
+    }
+
+    // Creates and unlinks in one directory serialize on its lock, more workers only contend for it
+    unsigned int workers[2] = { 2, 2 };
+    syscall(__NR_io_uring_register, fd, IORING_REGISTER_IOWQ_MAX_WORKERS, workers, 2);
+
+    ring.fd = fd;
+    ring.entries = params.sq_entries;
+    ring.sq_head = (unsigned int*)(rings + params.sq_off.head);
+    ring.sq_tail = (unsigned int*)(rings + params.sq_off.tail);
+    ring.sq_mask = (unsigned int*)(rings + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned int*)(rings + params.sq_off.array);
+    ring.sqes = sqes;
+    ring.cq_head = (unsigned int*)(rings + params.cq_off.head);
+    ring.cq_tail = (unsigned int*)(rings + params.cq_off.tail);
+    ring.cq_mask = (unsigned int*)(rings + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+    return 0;
+}
+
+static int ringReady(void)
+{
+    if (ring_state == 0) ring_state = setupRing() == 0 ? 1 : -1;
+    return ring_state == 1;
+}
+
+static struct io_uring_sqe* nextSqe(unsigned int* tail)
+{
+    const unsigned int index = *tail & *ring.sq_mask;
+    struct io_uring_sqe* sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    (*tail)++;
+    return sqe;
+}
+
+// Submits what was prepared up to 'tail' and waits for all of it, the result of
+// each operation goes to results[user_data]
+static void submitAndWait(unsigned int tail, unsigned int count, int* results)
+{
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned int done = 0;
+    unsigned int to_submit = count;
+    while (done < count) {
+        const int entered = (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, count - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (entered < 0 && errno != EINTR) {
+            // What is left in the ring can't be trusted anymore, later batches go without it
+            ring_state = -1;
+            break;
+        }
+        if (entered > 0) to_submit -= (unsigned int)entered < to_submit ? (unsigned int)entered : to_submit;
+
+        unsigned int head = *ring.cq_head;
+        const unsigned int cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++) {
+            const struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            results[cqe->user_data] = cqe->res;
+            done++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Whatever never completed counts as failed
+    if (done < count) {
+        for (unsigned int i = 0; i < count; i++) {
+            if (results[i] == PENDING) results[i] = -EIO;
+        }
+    }
+}
+
+static void writeRest(FileOperation* op, size_t written)
+{
+    while (written < op->size) {
+        const ssize_t n = pwrite(op->fd, op->data + written, op->size - written, (off_t)written);
+        if (n <= 0) {
+            op->failed = 1;
+            return;
+        }
+        written += (size_t)n;
+    }
+}
+
+// Finishes the opened files without the ring, once it broke down mid-batch
+static void finishWithoutRing(FileBatch* batch, int write)
+{
+    for (size_t i = 0; i < batch->count; i++) {
+        FileOperation* op = &batch->operations[i];
+        if (op->fd < 0) continue;
+        if (write) writeRest(op, 0);
+        if (close(op->fd) != 0) op->failed = 1;
+    }
+}
+
+static void flushRing(FileBatch* batch)
+{
+    int results[BATCH_OPERATIONS];
+    const unsigned int count = (unsigned int)batch->count;
+
+    // Opens and unlinks
+    unsigned int tail = *ring.sq_tail;
+    for (unsigned int i = 0; i < count; i++) {
+        FileOperation* op = &batch->operations[i];
+        struct io_uring_sqe* sqe = nextSqe(&tail);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)op->path;
+        sqe->user_data = i;
+        if (op->data) {
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW;
+            sqe->len = op->mode;
+        } else {
+            sqe->opcode = IORING_OP_UNLINKAT;
+            sqe->unlink_flags = op->directory ? AT_REMOVEDIR : 0;
+        }
+        results[i] = PENDING;
+    }
+    submitAndWait(tail, count, results);
+
+    unsigned int writes = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        FileOperation* op = &batch->operations[i];
+        op->fd = -1;
+        if (results[i] < 0) op->failed = 1;
+        else if (op->data) op->fd = results[i];
+        if (op->fd >= 0 && op->size > 0) writes++;
+    }
+    if (ring_state != 1) {
+        finishWithoutRing(batch, 1);
+        return;
+    }
+
+    // Writes of everything that opened
+    if (writes > 0) {
+        tail = *ring.sq_tail;
+        for (unsigned int i = 0; i < count; i++) {
+            FileOperation* op = &batch->operations[i];
+            results[i] = 0;
+            if (op->fd < 0 || op->size == 0) continue;
+
+            struct io_uring_sqe* sqe = nextSqe(&tail);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = op->fd;
+            sqe->addr = (unsigned long)op->data;
+            sqe->len = (unsigned int)op->size;
+            sqe->off = 0;
+            sqe->user_data = i;
+            results[i] = PENDING;
+        }
+        submitAndWait(tail, writes, results);
+
+        for (unsigned int i = 0; i < count; i++) {
+            FileOperation* op = &batch->operations[i];
+            if (op->fd < 0 || op->size == 0) continue;
+            if (results[i] < 0) {
+                op->failed = 1;
+                continue;
+            }
+
+            // A short write is finished here, regular files rarely have them
+            writeRest(op, (size_t)results[i]);
+        }
+    }
+    if (ring_state != 1) {
+        finishWithoutRing(batch, 0);
+        return;
+    }
+
+    // Closes
+    unsigned int closes = 0;
+    tail = *ring.sq_tail;
+    for (unsigned int i = 0; i < count; i++) {
+        FileOperation* op = &batch->operations[i];
+        results[i] = 0;
+        if (op->fd < 0) continue;
+
+        struct io_uring_sqe* sqe = nextSqe(&tail);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = op->fd;
+        sqe->user_data = i;
+        results[i] = PENDING;
+        closes++;
+    }
+    if (closes > 0) submitAndWait(tail, closes, results);
+    for (unsigned int i = 0; i < count; i++) {
+        if (batch->operations[i].fd >= 0 && results[i] < 0) batch->operations[i].failed = 1;
+    }
+}
+#endif
+
+int configureFileBackend(FileBackend backend)
+{
+    requested = backend;
+#ifdef LCT_HAVE_IO_URING
+    if (backend == FILE_BACKEND_IO_URING && !ringReady()) return -1;
+#else
+    if (backend == FILE_BACKEND_IO_URING) return -1;
+#endif
+    return 0;
+}
+
+static int usesRing(void)
+{
+#ifdef LCT_HAVE_IO_URING
+    return requested == FILE_BACKEND_IO_URING && ringReady();
+#else
+    return 0;
+#endif
+}
+
+const char* fileBackendName(void)
+{
+    return usesRing() ? "io_uring" : "sync";
+}
+
+static void flushSync(FileBatch* batch)
+{
+    for (size_t i = 0; i < batch->count; i++) {
+        FileOperation* op = &batch->operations[i];
+        if (!op->data) {
+#ifdef _WIN32
+            op->failed = (op->directory ? _rmdir(op->path) : remove(op->path)) != 0;
+#else
+            op->failed = (op->directory ? rmdir(op->path) : unlink(op->path)) != 0;
+#endif
+            continue;
+        }
+
+#ifdef _WIN32
+        FILE* file = fopen(op->path, "wb");
+        op->failed = !file || fwrite(op->data, 1, op->size, file) != op->size;
+        if (file && fclose(file) != 0) op->failed = 1;
+#else
+        const int fd = open(op->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, op->mode);
+        if (fd < 0) {
+            op->failed = 1;
+            continue;
+        }
+        size_t written = 0;
+        while (written < op->size) {
+            const ssize_t n = write(fd, op->data + written, op->size - written);
+            if (n <= 0) {
+                op->failed = 1;
+                break;
+            }
+            written += (size_t)n;
+        }
+        if (close(fd) != 0) op->failed = 1;
+#endif
+    }
+}
+
+FileBatch* openFileBatch(void)
+{
+    return calloc(1, sizeof(FileBatch));
+}
+
+static int queue(FileBatch* batch, const char* path, const void* data, size_t size, unsigned int mode, int directory)
+{
+    if (batch->count == BATCH_OPERATIONS || (data && batch->bytes + size > BATCH_BYTES)) flushFileBatch(batch);
+
+    FileOperation* op = &batch->operations[batch->count];
+    memset(op, 0, sizeof(*op));
+    op->path = strdup(path);
+    if (!op->path) return -1;
+
+    if (data) {
+        // Always allocated so an empty file still counts as a write
+        op->data = malloc(size > 0 ? size : 1);
+        if (!op->data) {
+            free(op->path);
+            return -1;
+        }
+        if (size > 0) memcpy(op->data, data, size);
+    }
+    op->size = size;
+    op->mode = mode;
+    op->directory = directory;
+
+    batch->count++;
+    batch->bytes += size;
+    return 0;
+}
+
+int batchWrite(FileBatch* batch, const char* path, const void* data, size_t size, unsigned int mode)
+{
+    return queue(batch, path, data ? data : "", size, mode, 0);
+}
+
+int batchUnlink(FileBatch* batch, const char* path, int directory)
+{
+    return queue(batch, path, NULL, 0, 0, directory);
+}
+
+size_t flushFileBatch(FileBatch* batch)
+{
+    if (batch->count == 0) return 0;
+
+#ifdef LCT_HAVE_IO_URING
+    if (usesRing()) flushRing(batch);
+    else flushSync(batch);
+#else
+    flushSync(batch);
+#endif
+
+    size_t failed = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        if (batch->operations[i].failed) failed++;
+        free(batch->operations[i].path);
+        free(batch->operations[i].data);
+    }
+    batch->count = 0;
+    batch->bytes = 0;
+    batch->failed += failed;
+    return failed;
+}
+
+size_t closeFileBatch(FileBatch* batch)
+{
+    flushFileBatch(batch);
+    const size_t failed = batch->failed;
+    free(batch);
+    return failed;
+}
+
+#ifndef _WIN32
+typedef struct Directory {
+    char* path;
+    size_t depth;
+} Directory;
+
+typedef struct DirectoryList {
+    Directory* items;
+    size_t count;
+    size_t capacity;
+} DirectoryList;
+
+static int pushDirectory(DirectoryList* list, const char* path, size_t depth)
+{
+    if (list->count == list->capacity) {
+        const size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        Directory* items = realloc(list->items, capacity * sizeof(Directory));
+        if (!items) return -1;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count].path = strdup(path);
+    if (!list->items[list->count].path) return -1;
+    list->items[list->count].depth = depth;
+    list->count++;
+    return 0;
+}
+
+static char* joinPath(const char* dir, const char* name)
+{
+    const size_t dir_length = strlen(dir);
+    char* path = malloc(dir_length + strlen(name) + 2);
+    if (!path) return NULL;
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '/';
+    strcpy(path + dir_length + 1, name);
+    return path;
+}
+
+static int isDirectory(const char* path, const struct dirent* entry)
+{
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (entry->d_type != DT_UNKNOWN) return entry->d_type == DT_DIR;
+#else
+    (void)entry;
+#endif
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Queues the removal of every file below 'path' and lists the directories
+static int queueRemovals(FileBatch* batch, const char* path, size_t depth, DirectoryList* directories)
+{
+    DIR* dir = opendir(path);
+    if (!dir) return -1;
+
+    int result = pushDirectory(directories, path, depth);
+    struct dirent* entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        char* child = joinPath(path, entry->d_name);
+        if (!child) result = -1;
+        else if (isDirectory(child, entry)) result = queueRemovals(batch, child, depth + 1, directories);
+        else result = batchUnlink(batch, child, 0);
+        free(child);
+    }
+    closedir(dir);
+    return result;
+}
+
+static int byDepthDescending(const void* a, const void* b)
+{
+    const size_t depth_a = ((const Directory*)a)->depth;
+    const size_t depth_b = ((const Directory*)b)->depth;
+    return depth_a < depth_b ? 1 : depth_a > depth_b ? -1 : 0;
+}
+
+int removeTree(const char* path)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0) return errno == ENOENT ? 0 : -1;
+    if (!S_ISDIR(st.st_mode)) return unlink(path) == 0 ? 0 : -1;
+
+    FileBatch* batch = openFileBatch();
+    if (!batch) return -1;
+
+    DirectoryList directories = {NULL, 0, 0};
+    int result = queueRemovals(batch, path, 0, &directories);
+    flushFileBatch(batch);
+
+    // A directory only goes once everything deeper is gone
+    qsort(directories.items, directories.count, sizeof(Directory), byDepthDescending);
+    for (size_t i = 0; i < directories.count; i++) {
+        if (i > 0 && directories.items[i].depth != directories.items[i - 1].depth) flushFileBatch(batch);
+        if (batchUnlink(batch, directories.items[i].path, 1) != 0) result = -1;
+    }
+
+    if (closeFileBatch(batch) > 0) result = -1;
+    for (size_t i = 0; i < directories.count; i++) free(directories.items[i].path);
+    free(directories.items);
+    return result;
+}
+
+// Files this large are streamed on their own instead of being held in a batch
+#define STREAMED_SIZE (4u * 1024u * 1024u)
+
+static int streamFile(int src_fd, const char* dst, unsigned int mode)
+{
+    const int dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (dst_fd < 0) return -1;
+
+    char buffer[64 * 1024];
+    int result = 0;
+    for (;;) {
+        const ssize_t n = read(src_fd, buffer, sizeof(buffer));
+        if (n == 0) break;
+        if (n < 0 || write(dst_fd, buffer, (size_t)n) != n) {
+            result = -1;
+            break;
+        }
+    }
+    if (close(dst_fd) != 0) result = -1;
+    return result;
+}
+
+static int copyFile(FileBatch* batch, const char* src, const char* dst)
+{
+    const int fd = open(src, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    const unsigned int mode = (unsigned int)(st.st_mode & 07777);
+    const size_t size = (size_t)st.st_size;
+    if (size >= STREAMED_SIZE) {
+        const int result = streamFile(fd, dst, mode);
+        close(fd);
+        return result;
+    }
+
+    unsigned char* data = malloc(size > 0 ? size : 1);
+    size_t done = 0;
+    while (data && done < size) {
+        const ssize_t n = read(fd, data + done, size - done);
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    close(fd);
+
+    const int result = data && done == size ? batchWrite(batch, dst, data, size, mode) : -1;
+    free(data);
+    return result;
+}
+
+static int copyEntries(FileBatch* batch, const char* src, const char* dst)
+{
+    struct stat st;
+    if (stat(src, &st) != 0) return -1;
+    // Kept writable by its owner so the files can go in
+    if (mkdir(dst, (st.st_mode & 07777) | 0700) != 0 && errno != EEXIST) return -1;
+
+    DIR* dir = opendir(src);
+    if (!dir) return -1;
+
+    int result = 0;
+    struct dirent* entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        char* from = joinPath(src, entry->d_name);
+        char* to = joinPath(dst, entry->d_name);
+        if (!from || !to) result = -1;
+        else {
+            struct stat entry_st;
+            if (lstat(from, &entry_st) != 0) result = -1;
+            else if (S_ISDIR(entry_st.st_mode)) result = copyEntries(batch, from, to);
+            else if (S_ISLNK(entry_st.st_mode)) {
+                char target[4096];
+                const ssize_t length = readlink(from, target, sizeof(target) - 1);
+                if (length < 0) result = -1;
+                else {
+                    target[length] = '\0';
+                    unlink(to);
+                    if (symlink(target, to) != 0) result = -1;
+                }
+            } else if (S_ISREG(entry_st.st_mode)) {
+                result = copyFile(batch, from, to);
+            }
+        }
+        free(from);
+        free(to);
+    }
+    closedir(dir);
+    return result;
+}
+
+int copyTree(const char* src, const char* dst)
+{
+    FileBatch* batch = openFileBatch();
+    if (!batch) return -1;
+
+    int result = copyEntries(batch, src, dst);
+    if (closeFileBatch(batch) > 0) result = -1;
+    return result;
+}
+#else
+int removeTree(const char* path)
+{
+    CommandResult result = sh_remove(path);
+    free(result.stdout_str);
+    free(result.stderr_str);
+    return result.exit_code == 0 ? 0 : -1;
+}
+
+int copyTree(const char* src, const char* dst)
+{
+    CommandResult result = copy(src, dst);
+    free(result.stdout_str);
+    free(result.stderr_str);
+    return result.exit_code == 0 ? 0 : -1;
+}
+#endif
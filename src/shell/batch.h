@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+// How batched file operations reach the kernel. io_uring submits a whole batch
+// with one system call per step (open, write, close) instead of one per file,
+// whether that is faster depends on the host, see 'lct bench files'.
+typedef enum FileBackend {
+    FILE_BACKEND_SYNC,
+    FILE_BACKEND_IO_URING // falls back to sync where the kernel lacks one of the operations
+} FileBackend;
+
+// Returns 0 on success, -1 if io_uring was asked for and isn't available
+int configureFileBackend(FileBackend backend);
+
+// "io_uring" or "sync", whichever the next batch is going to use
+const char* fileBackendName(void);
+
+// Operations queued in a batch run in no particular order when it is flushed,
+// so a file's directory has to exist before and a directory has to be empty
+// before the batch that removes it. A batch flushes itself when it gets large.
+// Batches share one ring and must only be used from one thread.
+typedef struct FileBatch FileBatch;
+
+FileBatch* openFileBatch(void);
+
+// Queues creating 'path' with a copy of 'size' bytes of 'data', a symlink at 'path' fails it
+int batchWrite(FileBatch* batch, const char* path, const void* data, size_t size, unsigned int mode);
+
+// Queues removing the file (or empty directory if 'directory' is set) 'path'
+int batchUnlink(FileBatch* batch, const char* path, int directory);
+
+// Runs everything that's queued, returns how many operations failed
+size_t flushFileBatch(FileBatch* batch);
+
+// Flushes and frees the batch, returns how many operations failed in total
+size_t closeFileBatch(FileBatch* batch);
+
+// Like 'rm -rf' and 'cp -R <src>/. <dst>', returns 0 on success and -1 if anything failed
+int removeTree(const char* path);
+int copyTree(const char* src, const char* dst);
@@ -1,4 +1,5 @@
 #include "copy.h"
+#include "batch.h"
 #include "mkdir.h"
 #include "shell_.h"
 
@@ -9,10 +10,9 @@ CommandResult copy(const char* path, const char* dest)
     const char* base1 = "Copy-Item -Recurse -Force '";
     const char* base2 = "\\*' '";
     const char* base3 = "'";
+    return shell3Bases(base1, base2, base3, path, dest);
 #else
-    const char* base1 = "cp -R -- \"";
-    const char* base2 = "/.\" \"";
-    const char* base3 = "\"";
+    CommandResult result = { copyTree(path, dest) == 0 ? 0 : 1, NULL, NULL };
+    return result;
 #endif
-    return shell3Bases(base1, base2, base3, path, dest);
 }
@@ -1,17 +1,41 @@
 #include "curl.h"
 
 #include "shell_.h"
+#include <stdio.h>
 
-CommandResult curl(const char* url, const char* destination)
+CommandResult curlProbe(const char* const* urls, size_t count, unsigned int timeout)
 {
 #ifdef _WIN32
-    const char* base1 = "Invoke-WebRequest -Uri '";
-    const char* base2 = "' -OutFile '";
-    const char* base3 = "' -UseBasicParsing";
+    (void)urls;
+    (void)count;
+    (void)timeout;
+    return invalidCommandResult;
 #else
-    const char* base1 = "curl -L -f \"";
-    const char* base2 = "\" -o \"";
-    const char* base3 = "\"";
+    char base[192];
+    snprintf(base, sizeof(base), "curl -s -I --parallel --parallel-immediate --max-time %u -w \"%%{url_effective} %%{http_code} %%{time_starttransfer}\\n\"", timeout);
+
+    size_t length = strlen(base) + 1;
+    for (size_t i = 0; i < count; i++) length += strlen(urls[i]) + 20;
+
+    char* cmd = (char*)malloc(length);
+    if (!cmd) return invalidCommandResult;
+
+    char* pos = cmd;
+    memcpy(pos, base, strlen(base));
+    pos += strlen(base);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t url_length = strlen(urls[i]);
+        memcpy(pos, " -o /dev/null \"", 15);
+        pos += 15;
+        memcpy(pos, urls[i], url_length);
+        pos += url_length;
+        *pos++ = '"';
+    }
+    *pos = '\0';
+
+    CommandResult res = invokeShellCall(cmd);
+    free(cmd);
+    return res;
 #endif
-    return shell3Bases(base1, base2, base3, url, destination);
 }
@@ -2,4 +2,5 @@
 
 #include "shell_.h"
 
-CommandResult curl(const char* url, const char* destination);
+// Sends HEAD requests to all urls at once, stdout gets "<url> <status> <seconds>" per answer
+CommandResult curlProbe(const char* const* urls, size_t count, unsigned int timeout);
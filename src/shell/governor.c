@@ -0,0 +1,274 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "governor.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#endif
+
+static ProcessLimits limits;
+static ProcessTotals totals;
+
+#ifdef __linux__
+static cpu_set_t cpu_set;
+static int cpu_set_used = 0;
+
+// Parses "0-3,6" into 'set'
+static int parseCpus(const char* list, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    const char* pos = list;
+    while (*pos) {
+        char* end;
+        unsigned long first = strtoul(pos, &end, 10);
+        if (end == pos) return -1;
+        unsigned long last = first;
+        if (*end == '-') {
+            pos = end + 1;
+            last = strtoul(pos, &end, 10);
+            if (end == pos || last < first) return -1;
+        }
+        if (last >= CPU_SETSIZE) return -1;
+        for (unsigned long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, set);
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        pos = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+#endif
+
+int configureProcesses(const ProcessLimits* new_limits)
+{
+    limits = *new_limits;
+#ifdef __linux__
+    cpu_set_used = 0;
+    if (limits.cpus[0] != '\0') {
+        if (parseCpus(limits.cpus, &cpu_set) != 0) return -1;
+        cpu_set_used = 1;
+    }
+#endif
+    return 0;
+}
+
+const ProcessLimits* processLimits(void)
+{
+    return &limits;
+}
+
+const ProcessTotals* processTotals(void)
+{
+    return &totals;
+}
+
+unsigned int processCpuCount(void)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    if (cpu_set_used) return (unsigned int)CPU_COUNT(&cpu_set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) return (unsigned int)CPU_COUNT(&set);
+#endif
+#ifndef _WIN32
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online > 0) return (unsigned int)online;
+#endif
+    return 1;
+}
+
+unsigned int processJobs(void)
+{
+    if (limits.jobs > 0) return limits.jobs;
+    if (limits.cpus[0] != '\0') return processCpuCount();
+    return 0;
+}
+
+#ifndef _WIN32
+static void limitResource(int resource, unsigned long long bytes)
+{
+    if (bytes == 0) return;
+
+    struct rlimit limit;
+    if (getrlimit(resource, &limit) != 0) return;
+    // A hard limit can only be lowered
+    if (limit.rlim_max != RLIM_INFINITY && (rlim_t)bytes > limit.rlim_max) bytes = (unsigned long long)limit.rlim_max;
+    limit.rlim_cur = (rlim_t)bytes;
+    limit.rlim_max = (rlim_t)bytes;
+    setrlimit(resource, &limit);
+}
+#endif
+
+void applyProcessLimits(void)
+{
+#ifndef _WIN32
+    // Its own process group so it can be stopped and continued as a whole
+    if (limits.max_load > 0.0) setpgid(0, 0);
+
+    if (limits.nice != 0) {
+        errno = 0;
+        int current = getpriority(PRIO_PROCESS, 0);
+        if (errno == 0) setpriority(PRIO_PROCESS, 0, current + limits.nice);
+    }
+
+    limitResource(RLIMIT_DATA, limits.memory);
+    limitResource(RLIMIT_AS, limits.address_space);
+#endif
+
+#ifdef __linux__
+    if (limits.io_class > 0) {
+        // IOPRIO_WHO_PROCESS, the class lives above the 13 bits of the level
+        const int ioprio = (limits.io_class << 13) | (limits.io_class == 3 ? 0 : limits.io_level);
+        syscall(SYS_ioprio_set, 1, 0, ioprio);
+    }
+
+    if (cpu_set_used) sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+#endif
+}
+
+#ifndef _WIN32
+// Below this fraction of the threshold a stopped group is continued again
+static const double resume_fraction = 0.9;
+
+// Read by forwardSignal(), so it has to be a type written in one go
+static volatile sig_atomic_t governed = 0;
+static int stopped = 0;
+static struct timespec stopped_at;
+
+static struct sigaction previous_int;
+static struct sigaction previous_term;
+static struct sigaction previous_hup;
+
+// Ctrl-C only reaches the foreground group, which the governed one isn't part of
+static void forwardSignal(int sig)
+{
+    const pid_t group = (pid_t)governed;
+    if (group > 0) {
+        kill(-group, SIGCONT);
+        kill(-group, sig);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static double elapsed(const struct timespec* since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) + (double)(now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static void startGoverning(pid_t pid)
+{
+    // Whichever of parent and child gets to run first sets the group
+    setpgid(pid, pid);
+    governed = (sig_atomic_t)pid;
+    stopped = 0;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = forwardSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &previous_int);
+    sigaction(SIGTERM, &action, &previous_term);
+    sigaction(SIGHUP, &action, &previous_hup);
+}
+
+// A process stopped while it waits on a vfork() child sits in uninterruptible
+// sleep, which the load average counts. Left in, those would keep the load above
+// the threshold for as long as the group is stopped.
+static unsigned int blockedInGroup(pid_t group)
+{
+    unsigned int blocked = 0;
+#ifdef __linux__
+    DIR* proc = opendir("/proc");
+    if (!proc) return 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(proc)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+
+        char path[300];
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        FILE* file = fopen(path, "r");
+        if (!file) continue;
+
+        char stat[512];
+        const size_t length = fread(stat, 1, sizeof(stat) - 1, file);
+        fclose(file);
+        stat[length] = '\0';
+
+        // "<pid> (<comm>) <state> <ppid> <pgrp> ...", comm may contain anything
+        const char* fields = strrchr(stat, ')');
+        char state;
+        int ppid, pgrp;
+        if (fields && sscanf(fields + 1, " %c %d %d", &state, &ppid, &pgrp) == 3 && pgrp == group && state == 'D') blocked++;
+    }
+    closedir(proc);
+#else
+    (void)group;
+#endif
+    return blocked;
+}
+
+int governedSelect(pid_t pid, int nfds, fd_set* readfds)
+{
+    if (limits.max_load <= 0.0) return select(nfds, readfds, NULL, NULL, NULL);
+
+    if (governed != pid) startGoverning(pid);
+
+    double load;
+    if (getloadavg(&load, 1) == 1) {
+        if (stopped) load -= blockedInGroup(pid);
+        if (!stopped && load > limits.max_load) {
+            if (kill(-pid, SIGSTOP) == 0) {
+                stopped = 1;
+                totals.pauses++;
+                clock_gettime(CLOCK_MONOTONIC, &stopped_at);
+            }
+        } else if (stopped && load < limits.max_load * resume_fraction) {
+            kill(-pid, SIGCONT);
+            stopped = 0;
+            totals.throttled += elapsed(&stopped_at);
+        }
+    }
+
+    struct timeval timeout = {1, 0};
+    int ready = select(nfds, readfds, NULL, NULL, &timeout);
+    if (ready < 0 && errno == EINTR) {
+        FD_ZERO(readfds);
+        return 0;
+    }
+    return ready;
+}
+
+void releaseProcess(pid_t pid)
+{
+    if (governed != pid) return;
+
+    if (stopped) {
+        kill(-pid, SIGCONT);
+        stopped = 0;
+        totals.throttled += elapsed(&stopped_at);
+    }
+
+    sigaction(SIGINT, &previous_int, NULL);
+    sigaction(SIGTERM, &previous_term, NULL);
+    sigaction(SIGHUP, &previous_hup, NULL);
+    governed = 0;
+}
+#endif
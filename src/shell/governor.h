@@ -0,0 +1,48 @@
+#pragma once
+
+// Limits the builds started through invokeGovernedCall() are put under, so a
+// build on a busy host doesn't compete with what the host is there for. Each
+// one is applied in the child before exec and inherited by everything it starts.
+typedef struct ProcessLimits {
+    int nice;                        // added to the niceness, 0 leaves it
+    int io_class;                    // 0 leaves it, 1 realtime, 2 best-effort, 3 idle (Linux only)
+    int io_level;                    // 0 (highest) to 7 within realtime and best-effort
+    char cpus[256];                  // CPU list like "0-3,6" (Linux only), empty for all
+    unsigned long long memory;       // bytes of heap and private mappings (RLIMIT_DATA), 0 for unlimited
+    unsigned long long address_space; // bytes of virtual memory (RLIMIT_AS), 0 for unlimited
+    double max_load;                 // the children are stopped while the 1-minute load average is above, 0 for never
+    unsigned int jobs;               // parallel jobs of make and CMake, 0 for one per CPU when 'cpus' is set and the build's own choice otherwise
+} ProcessLimits;
+
+typedef struct ProcessTotals {
+    double throttled; // seconds children spent stopped for the load average
+    unsigned int pauses;
+} ProcessTotals;
+
+// Returns 0 on success, -1 if the CPU list can't be parsed
+int configureProcesses(const ProcessLimits* limits);
+const ProcessLimits* processLimits(void);
+const ProcessTotals* processTotals(void);
+
+// How many CPUs the children may run on
+unsigned int processCpuCount(void);
+
+// How many parallel jobs a build may run, 0 if it's up to the build. Only
+// builds driven by make or CMake read it, LCT's ci.ci compiles one file at a
+// time and has no option for it, 'cpus' is what confines that one.
+unsigned int processJobs(void);
+
+// Called in the child between fork and exec
+void applyProcessLimits(void);
+
+// Waits for one of 'readfds' of 'pid' to become readable, at most about a second
+// when yielding to the load average. Stops or continues the process group of
+// 'pid' as the load average requires. Returns what select() returned.
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/select.h>
+int governedSelect(pid_t pid, int nfds, fd_set* readfds);
+
+// Ends the yielding for 'pid', it is continued if it was stopped
+void releaseProcess(pid_t pid);
+#endif
@@ -1,4 +1,5 @@
 #include "remove.h"
+#include "batch.h"
 #include "shell_.h"
 
 CommandResult sh_remove(const char* path)
@@ -6,9 +7,10 @@ CommandResult sh_remove(const char* path)
 #ifdef _WIN32
     const char* base1 = "Remove-Item -Recurse -Force '";
     const char* base2 = "'";
+    return shell2Bases(base1, base2, path);
 #else
-    const char* base1 = "rm -rf -- \"";
-    const char* base2 = "\"";
+    // In-process, so a tree of thousands of files is unlinked in batches
+    CommandResult result = { removeTree(path) == 0 ? 0 : 1, NULL, NULL };
+    return result;
 #endif
-    return shell2Bases(base1, base2, path);
 }
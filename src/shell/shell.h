@@ -11,6 +11,8 @@ extern "C" {
 #include "opendir.h"
 #include "copy.h"
 #include "remove.h"
+#include "governor.h"
+#include "batch.h"
 
 #ifdef __cplusplus
 }
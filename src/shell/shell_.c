@@ -1,4 +1,5 @@
 #include "shell_.h"
+#include "governor.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -15,9 +16,36 @@ const CommandResult invalidCommandResult = {
     NULL
 };
 
-CommandResult invokeSystemCall(const char* cmd)
+static OutputHandler output_handler = NULL;
+static void* output_data = NULL;
+
+void setOutputHandler(OutputHandler handler, void* data)
+{
+    output_handler = handler;
+    output_data = data;
+}
+
+// Hands the complete lines of 'buffer' after '*line_start' to the output
+// handler, and the unterminated rest too once the stream is 'done'
+static void emitLines(int stream, const char* buffer, size_t length, size_t* line_start, int done)
+{
+    if (!output_handler) return;
+
+    for (size_t i = *line_start; i < length; i++) {
+        if (buffer[i] != '\n') continue;
+        output_handler(stream, buffer + *line_start, i - *line_start, output_data);
+        *line_start = i + 1;
+    }
+    if (done && *line_start < length) {
+        output_handler(stream, buffer + *line_start, length - *line_start, output_data);
+        *line_start = length;
+    }
+}
+
+static CommandResult invokeCall(const char* cmd, int governed)
 {
 #ifdef _WIN32
+    (void)governed;
     CommandResult result = {0, NULL, NULL};
     HANDLE outRead, outWrite, errRead, errWrite;
     SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
@@ -79,6 +107,7 @@ CommandResult invokeSystemCall(const char* cmd)
     }
 
     char buf[512];
+    size_t stdoutLine = 0, stderrLine = 0;
     DWORD n;
     BOOL running = TRUE;
 
@@ -96,6 +125,7 @@ CommandResult invokeSystemCall(const char* cmd)
                 }
                 memcpy(result.stdout_str + stdoutLen, buf, n);
                 stdoutLen += n;
+                emitLines(1, result.stdout_str, stdoutLen, &stdoutLine, 0);
             }
         }
 
@@ -110,6 +140,7 @@ CommandResult invokeSystemCall(const char* cmd)
                 }
                 memcpy(result.stderr_str + stderrLen, buf, n);
                 stderrLen += n;
+                emitLines(2, result.stderr_str, stderrLen, &stderrLine, 0);
             }
         }
 
@@ -117,6 +148,8 @@ CommandResult invokeSystemCall(const char* cmd)
         if (state == WAIT_TIMEOUT) running = TRUE;
     }
 
+    emitLines(1, result.stdout_str, stdoutLen, &stdoutLine, 1);
+    emitLines(2, result.stderr_str, stderrLen, &stderrLine, 1);
     result.stdout_str[stdoutLen] = '\0';
     result.stderr_str[stderrLen] = '\0';
 
@@ -149,6 +182,7 @@ CommandResult invokeSystemCall(const char* cmd)
         dup2(errPipe[1], STDERR_FILENO);
         close(outPipe[0]); close(outPipe[1]);
         close(errPipe[0]); close(errPipe[1]);
+        if (governed) applyProcessLimits();
         execl("/bin/sh", "sh", "-c", cmd, NULL);
         _exit(127);
     } else {
@@ -170,6 +204,7 @@ CommandResult invokeSystemCall(const char* cmd)
         }
 
         char buf[512];
+        size_t stdoutLine = 0, stderrLine = 0;
         int out_done = 0, err_done = 0;
 
         int flags_out = fcntl(outPipe[0], F_GETFL, 0);
@@ -184,7 +219,8 @@ CommandResult invokeSystemCall(const char* cmd)
             if (!err_done) FD_SET(errPipe[0], &readfds);
 
             int maxfd = (outPipe[0] > errPipe[0] ? outPipe[0] : errPipe[0]) + 1;
-            if (select(maxfd, &readfds, NULL, NULL, NULL) < 0) break;
+            const int ready = governed ? governedSelect(pid, maxfd, &readfds) : select(maxfd, &readfds, NULL, NULL, NULL);
+            if (ready < 0) break;
 
             // STDOUT
             if (FD_ISSET(outPipe[0], &readfds)) {
@@ -196,6 +232,7 @@ CommandResult invokeSystemCall(const char* cmd)
                     }
                     memcpy(result.stdout_str + stdoutLen, buf, n);
                     stdoutLen += n;
+                    emitLines(1, result.stdout_str, stdoutLen, &stdoutLine, 0);
                 } else {
                     out_done = 1;
                 }
@@ -211,15 +248,20 @@ CommandResult invokeSystemCall(const char* cmd)
                     }
                     memcpy(result.stderr_str + stderrLen, buf, n);
                     stderrLen += n;
+                    emitLines(2, result.stderr_str, stderrLen, &stderrLine, 0);
                 } else {
                     err_done = 1;
                 }
             }
         }
 
+        emitLines(1, result.stdout_str, stdoutLen, &stdoutLine, 1);
+        emitLines(2, result.stderr_str, stderrLen, &stderrLine, 1);
         result.stdout_str[stdoutLen] = '\0';
         result.stderr_str[stderrLen] = '\0';
 
+        if (governed) releaseProcess(pid);
+
         int status;
         waitpid(pid, &status, 0);
         if (WIFEXITED(status)) result.exit_code = WEXITSTATUS(status);
@@ -233,6 +275,16 @@ CommandResult invokeSystemCall(const char* cmd)
 #endif
 }
 
+CommandResult invokeSystemCall(const char* cmd)
+{
+    return invokeCall(cmd, 0);
+}
+
+CommandResult invokeGovernedCall(const char* cmd)
+{
+    return invokeCall(cmd, 1);
+}
+
 #ifdef _WIN32
 CommandResult invokeShellCall(const char* cmd)
 {
@@ -11,8 +11,18 @@ typedef struct CommandResult {
 
 extern const CommandResult invalidCommandResult;
 
+// Called with each line (without its newline) a command writes while it runs,
+// 'stream' is 1 for stdout and 2 for stderr. The result still has all of it.
+typedef void (*OutputHandler)(int stream, const char* line, size_t length, void* data);
+
+// Applies to the calls that follow, NULL for none
+void setOutputHandler(OutputHandler handler, void* data);
+
 CommandResult invokeSystemCall(const char* cmd);
 
+// Like invokeSystemCall() with the child put under the ProcessLimits, see governor.h
+CommandResult invokeGovernedCall(const char* cmd);
+
 #ifdef _WIN32
 CommandResult invokeShellCall(const char* cmd);
 #else
@@ -0,0 +1,266 @@
+#include "shim.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#include <direct.h>
+#include <io.h>
+#define getcwd _getcwd
+#define access _access
+#define X_OK 0
+#define EXE_SUFFIX ".exe"
+#else
+#include <unistd.h>
+#include <limits.h>
+#define EXE_SUFFIX ""
+#if defined(__APPLE__) || defined(__MACH__)
+#include <mach-o/dyld.h>
+#endif
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+namespace fs = std::filesystem;
+
+static std::string trim(const char* str)
+{
+    while (std::isspace(static_cast<unsigned char>(*str))) str++;
+    std::size_t len = std::strlen(str);
+    while (len > 0 && std::isspace(static_cast<unsigned char>(str[len - 1]))) len--;
+    return std::string(str, len);
+}
+
+// A .lct-version either holds one version for every tool or "tool=version" lines
+static bool readVersionFile(const char* path, const std::string& tool, std::string& version)
+{
+    FILE* file = std::fopen(path, "r");
+    if (!file) return false;
+
+    std::string all_tools;
+    char line[256];
+    while (std::fgets(line, sizeof(line), file)) {
+        std::string entry = trim(line);
+        if (entry.empty() || entry[0] == '#') continue;
+
+        std::size_t equals = entry.find('=');
+        if (equals == std::string::npos) {
+            all_tools = entry;
+        } else if (trim(entry.substr(0, equals).c_str()) == tool) {
+            version = trim(entry.c_str() + equals + 1);
+            std::fclose(file);
+            return true;
+        }
+    }
+
+    std::fclose(file);
+    version = all_tools;
+    return !version.empty();
+}
+
+static std::string resolveVersion(const std::string& tool)
+{
+    std::string env_name = "LCT_";
+    for (char c : tool) env_name += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    env_name += "_VERSION";
+
+    const char* env = std::getenv(env_name.c_str());
+    if (env && *env) return env;
+    env = std::getenv("LCT_VERSION");
+    if (env && *env) return env;
+
+    char dir[PATH_MAX];
+    if (!getcwd(dir, sizeof(dir))) return "";
+
+    std::string current = dir;
+    std::string version;
+    while (true) {
+        std::string candidate = current;
+        if (candidate.back() != '/' && candidate.back() != '\\') candidate += '/';
+        candidate += ".lct-version";
+
+        if (readVersionFile(candidate.c_str(), tool, version)) return version;
+
+        std::size_t slash = current.find_last_of("/\\");
+        if (slash == std::string::npos) break;
+
+        // Stop after the root ("/" or "C:\\")
+        if (slash == 0 || (slash == 2 && current[1] == ':')) {
+            if (current.size() == slash + 1) break;
+            current.resize(slash + 1);
+        } else {
+            current.resize(slash);
+        }
+    }
+
+    return "";
+}
+
+// Versions come from the environment and files in any parent directory and
+// end up in a path, so they may only name a directory of the store
+static bool validVersion(const std::string& version)
+{
+    if (version.empty() || version[0] == '.' || version.find("..") != std::string::npos) return false;
+    for (char c : version) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-' && c != '_' && c != '+') return false;
+    }
+    return true;
+}
+
+bool runShim(const fs::path& main_dir, int argc, const char* argv[], int& exit_code)
+{
+    const char* name = argv[0];
+    for (const char* c = argv[0]; *c; c++) {
+        if (*c == '/' || *c == '\\') name = c + 1;
+    }
+
+    std::string tool = name;
+    if (tool.size() > 4 && tool.compare(tool.size() - 4, 4, ".exe") == 0) tool.resize(tool.size() - 4);
+    if (tool.rfind("lct", 0) == 0) return false;
+
+    const std::string cache = (main_dir / "shims" / (tool + ".shim")).string();
+    FILE* file = std::fopen(cache.c_str(), "r");
+    if (!file) return false;
+
+    std::string target;
+    std::vector<std::string> roots;
+    std::vector<std::string> profiled; // "<version>+<profile>" of the installed versions built with a profile
+    char line[PATH_MAX + 16];
+    while (std::fgets(line, sizeof(line), file)) {
+        std::string entry = trim(line);
+        if (entry.rfind("default=", 0) == 0) target = entry.substr(8);
+        else if (entry.rfind("root=", 0) == 0) roots.push_back(entry.substr(5));
+        else if (entry.rfind("profile=", 0) == 0) profiled.push_back(entry.substr(8));
+    }
+    std::fclose(file);
+
+    const std::string version = resolveVersion(tool);
+    if (!version.empty() && !validVersion(version)) {
+        std::fprintf(stderr, "lct: '%s' isn't a valid version of %s\n", version.c_str(), tool.c_str());
+        exit_code = 127;
+        return true;
+    }
+    if (!version.empty()) {
+        // A pinned version runs with the profile it was installed with, a
+        // version that isn't installed runs its release build
+        std::vector<std::string> store_versions;
+        for (const std::string& store_version : profiled) {
+            if (store_version.rfind(version + "+", 0) == 0) store_versions.push_back(store_version);
+        }
+        store_versions.push_back(version);
+
+        target.clear();
+        for (const std::string& store_version : store_versions) {
+            for (const std::string& root : roots) {
+                std::string candidate = root + "/" + store_version + "/" + tool + "/bin/" + tool + EXE_SUFFIX;
+                if (access(candidate.c_str(), X_OK) == 0) {
+                    target = candidate;
+                    break;
+                }
+            }
+            if (!target.empty()) break;
+        }
+
+        if (target.empty()) {
+            std::fprintf(stderr, "lct: %s %s isn't in the store. Run 'lct install %s@%s'.\n", tool.c_str(), version.c_str(), tool.c_str(), version.c_str());
+            exit_code = 127;
+            return true;
+        }
+    }
+
+    if (target.empty()) {
+        std::fprintf(stderr, "lct: no version of %s is installed\n", tool.c_str());
+        exit_code = 127;
+        return true;
+    }
+
+    std::vector<const char*> args(argv, argv + argc);
+    args.push_back(nullptr);
+    args[0] = target.c_str();
+
+#ifdef _WIN32
+    intptr_t rc = _spawnv(_P_WAIT, target.c_str(), args.data());
+    exit_code = rc < 0 ? 127 : static_cast<int>(rc);
+#else
+    execv(target.c_str(), const_cast<char* const*>(args.data()));
+    std::perror(target.c_str());
+    exit_code = 127;
+#endif
+    return true;
+}
+
+static fs::path selfExecutable()
+{
+#ifdef _WIN32
+    char buf[MAX_PATH];
+    DWORD len = GetModuleFileNameA(NULL, buf, sizeof(buf));
+    if (len == 0 || len == sizeof(buf)) return fs::path();
+    return fs::path(std::string(buf, len));
+#elif defined(__APPLE__) || defined(__MACH__)
+    char buf[PATH_MAX];
+    uint32_t size = sizeof(buf);
+    if (_NSGetExecutablePath(buf, &size) != 0) return fs::path();
+    return fs::canonical(buf);
+#else
+    char buf[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (len <= 0) return fs::path();
+    return fs::path(std::string(buf, static_cast<std::size_t>(len)));
+#endif
+}
+
+void writeShims(const fs::path& shim_dir, const fs::path& bin_dir, const Store& store, const State& state)
+{
+    const fs::path self = selfExecutable();
+    if (self.empty()) throw std::runtime_error("Couldn't locate the lct executable for shims");
+
+    std::error_code ec;
+    fs::create_directories(shim_dir, ec);
+    fs::create_directories(bin_dir, ec);
+
+    // Refreshed every time so shims always match the running lct
+    const fs::path shim = shim_dir / ("lct-shim" EXE_SUFFIX);
+    const fs::path shim_tmp = shim_dir / ("lct-shim.tmp" EXE_SUFFIX);
+    fs::copy_file(self, shim_tmp, fs::copy_options::overwrite_existing, ec);
+    if (!ec) fs::rename(shim_tmp, shim, ec);
+    if (ec) throw std::runtime_error("Couldn't copy " + self.string() + " to " + shim.string() + ": " + ec.message());
+
+    for (fs::directory_iterator it(shim_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".shim") continue;
+        if (!state.IsInstalled(it->path().stem().string())) fs::remove(it->path(), ec);
+    }
+
+    for (const auto& [tool, tool_state] : state.installed_tools) {
+        const fs::path entry = store.Find(storeVersion(tool_state.active, state.GetProfile(tool, tool_state.active)), tool);
+        if (entry.empty()) continue;
+
+        FILE* file = std::fopen((shim_dir / (tool + ".shim")).string().c_str(), "w");
+        if (!file) throw std::runtime_error("Couldn't write shim cache for " + tool);
+        std::fprintf(file, "default=%s\n", fs::absolute(entry / "bin" / (tool + EXE_SUFFIX)).string().c_str());
+        for (const fs::path& root : store.roots) {
+            std::fprintf(file, "root=%s\n", fs::absolute(root).string().c_str());
+        }
+        for (const auto& [version, profile] : tool_state.profiles) {
+            std::fprintf(file, "profile=%s\n", storeVersion(version, profile).c_str());
+        }
+        std::fclose(file);
+
+        const fs::path executable = bin_dir / (tool + EXE_SUFFIX);
+        fs::remove(executable, ec);
+        fs::create_hard_link(shim, executable, ec);
+        if (ec) {
+            ec.clear();
+            fs::copy_file(shim, executable, fs::copy_options::overwrite_existing, ec);
+        }
+        if (ec) throw std::runtime_error("Couldn't install shim " + executable.string() + ": " + ec.message());
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <filesystem>
+#include "../store/store.hpp"
+#include "../data/state.hpp"
+
+// With 'shims' enabled, the tools in current/bin are hardlinks to a copy of lct.
+// Started under a tool's name it picks the version from LCT_<TOOL>_VERSION,
+// LCT_VERSION or the nearest .lct-version file and execs that build from the
+// store, built with the profile that version was installed with, or the release
+// build if it isn't installed. Everything else it needs is cached in
+// shims/<tool>.shim, so running a tool never loads the config or the state.
+
+// Returns false if argv[0] isn't a shim, otherwise exit_code is set
+bool runShim(const std::filesystem::path& main_dir, int argc, const char* argv[], int& exit_code);
+
+void writeShims(const std::filesystem::path& shim_dir, const std::filesystem::path& bin_dir, const Store& store, const State& state);
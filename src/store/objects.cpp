@@ -0,0 +1,111 @@
+#include "objects.hpp"
+#include "../hash/sha256.h"
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+std::string hashFile(const fs::path& path)
+{
+    char hex[SHA256_HEX_SIZE];
+    if (sha256File(path.string().c_str(), hex) != 0) return "";
+    return hex;
+}
+
+fs::path objectPath(const fs::path& root, const std::string& hash, bool executable)
+{
+    return root / "objects" / hash.substr(0, 2) / (hash.substr(2) + (executable ? "x" : ""));
+}
+
+fs::path addObject(const fs::path& root, const fs::path& src, const std::string& hash)
+{
+    const bool executable = (fs::status(src).permissions() & fs::perms::owner_exec) != fs::perms::none;
+    const fs::path object = objectPath(root, hash, executable);
+
+    std::error_code ec;
+    if (fs::exists(object, ec)) return object;
+
+    const fs::path tmp = object.parent_path() / (".tmp-" + std::to_string(getpid()) + "-" + object.filename().string());
+
+    fs::create_directories(object.parent_path(), ec);
+    if (!ec) fs::copy_file(src, tmp, fs::copy_options::overwrite_existing, ec);
+    if (!ec) fs::permissions(tmp, fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write, fs::perm_options::remove, ec);
+    if (!ec) fs::rename(tmp, object, ec);
+
+    if (ec) {
+        fs::remove(tmp, ec);
+        if (fs::exists(object, ec)) return object;
+        throw std::runtime_error("Couldn't add " + src.string() + " to " + (root / "objects").string());
+    }
+
+    return object;
+}
+
+static bool reflink(const fs::path& src, const fs::path& dst)
+{
+#if defined(__linux__) && defined(FICLONE)
+    int in = open(src.c_str(), O_RDONLY);
+    if (in < 0) return false;
+
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 07777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    int rc = ioctl(out, FICLONE, in);
+    close(in);
+    close(out);
+
+    if (rc != 0) {
+        unlink(dst.c_str());
+        return false;
+    }
+    return true;
+#else
+    (void)src;
+    (void)dst;
+    return false;
+#endif
+}
+
+LinkMethod materialize(const fs::path& object, const fs::path& dst, bool allow_symlink)
+{
+    std::error_code ec;
+
+    fs::create_hard_link(object, dst, ec);
+    if (!ec) return LinkMethod::Hardlink;
+
+    if (reflink(object, dst)) return LinkMethod::Reflink;
+
+    if (allow_symlink) {
+        ec.clear();
+        fs::create_symlink(fs::absolute(object), dst, ec);
+        if (!ec) return LinkMethod::Symlink;
+    }
+
+    ec.clear();
+    fs::copy_file(object, dst, fs::copy_options::overwrite_existing, ec);
+    if (!ec) return LinkMethod::Copy;
+
+    throw std::runtime_error("Couldn't materialize " + dst.string() + " from " + object.string() + ": " + ec.message());
+}
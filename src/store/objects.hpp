@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// Content-addressed files shared by every entry of a store root. Objects live in
+// <root>/objects/<first two hex digits>/<remaining SHA-256 digits>, with an 'x'
+// suffix for executables since hardlinks share their mode.
+
+enum class LinkMethod {
+    Hardlink,
+    Reflink,
+    Symlink,
+    Copy
+};
+
+std::string hashFile(const std::filesystem::path& path);
+
+std::filesystem::path objectPath(const std::filesystem::path& root, const std::string& hash, bool executable);
+std::filesystem::path addObject(const std::filesystem::path& root, const std::filesystem::path& src, const std::string& hash);
+
+// Tries hardlink, reflink, symlink (if allowed) and copy in that order
+LinkMethod materialize(const std::filesystem::path& object, const std::filesystem::path& dst, bool allow_symlink);
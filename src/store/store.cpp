@@ -0,0 +1,405 @@
+#include "store.hpp"
+#include "objects.hpp"
+#include "../download/transfer.hpp"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+bool readEntry(const fs::path& entry, std::vector<StoreFile>& files)
+{
+    files.clear();
+
+    std::ifstream ifs(entry / ".entry");
+    if (!ifs.is_open()) return false;
+
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.rfind("file=", 0) == 0) {
+            std::size_t hash_comma = line.rfind(',');
+            if (hash_comma == std::string::npos || hash_comma < 5) return false;
+            std::size_t size_comma = line.rfind(',', hash_comma - 1);
+            if (size_comma == std::string::npos || size_comma < 5) return false;
+
+            StoreFile file;
+            file.path = line.substr(5, size_comma - 5);
+            file.size = std::strtoull(line.c_str() + size_comma + 1, nullptr, 10);
+            file.hash = line.substr(hash_comma + 1);
+            files.push_back(file);
+        }
+    }
+
+    return !files.empty();
+}
+
+// The first file is the executable and has to exist, the others are optional
+static std::vector<std::string> toolFiles(const std::string& tool)
+{
+    return {
+#ifdef _WIN32
+        "bin/" + tool + ".exe",
+#else
+        "bin/" + tool,
+#endif
+        "THIRD_PARTY_LICENSES/" + tool + ".txt",
+        "LICENSE"
+    };
+}
+
+std::string storeVersion(const std::string& version, const std::string& profile)
+{
+    if (profile.empty()) return version;
+    return version + "+" + profile;
+}
+
+bool isHostOnly(const std::string& store_version)
+{
+    static const std::string native = "+native";
+    return store_version.size() > native.size() && store_version.compare(store_version.size() - native.size(), native.size(), native) == 0;
+}
+
+const char* hostPlatform()
+{
+#if defined(_WIN32)
+#define PLATFORM_OS "windows"
+#elif defined(__APPLE__)
+#define PLATFORM_OS "macos"
+#else
+#define PLATFORM_OS "linux"
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PLATFORM_ARCH "x86_64"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PLATFORM_ARCH "arm64"
+#elif defined(__i386__) || defined(_M_IX86)
+#define PLATFORM_ARCH "x86"
+#else
+#define PLATFORM_ARCH "unknown"
+#endif
+
+    return PLATFORM_OS "-" PLATFORM_ARCH;
+}
+
+fs::path Store::Find(const std::string& version, const std::string& tool) const
+{
+    std::vector<StoreFile> files;
+
+    for (const fs::path& root : roots) {
+        const fs::path entry = root / version / tool;
+        if (!readEntry(entry, files)) continue;
+
+        bool complete = true;
+        for (const StoreFile& file : files) {
+            std::error_code ec;
+            std::uintmax_t size = fs::file_size(entry / file.path, ec);
+            if (ec || size != file.size) {
+                complete = false;
+                break;
+            }
+        }
+
+        if (complete) return entry;
+    }
+
+    return fs::path();
+}
+
+const char* const activation_tmp_prefix = ".lct-tmp-";
+
+fs::path Store::Publish(const fs::path& dist_dir, const std::string& version, const std::string& tool) const
+{
+    const std::vector<std::string> files = toolFiles(tool);
+    if (!fs::exists(dist_dir / files[0])) {
+        throw std::runtime_error("Build of " + version + " didn't produce " + files[0]);
+    }
+
+    std::string last_error = "no store configured";
+
+    for (const fs::path& root : roots) {
+        const fs::path final_dir = root / version / tool;
+        const fs::path tmp_dir = root / ".tmp" / (version + "-" + tool + "-" + std::to_string(getpid()));
+
+        std::error_code ec;
+        fs::remove_all(tmp_dir, ec);
+        fs::create_directories(tmp_dir, ec);
+        if (ec) {
+            last_error = root.string() + ": " + ec.message();
+            continue;
+        }
+
+        std::ofstream entry(tmp_dir / ".entry", std::ios::trunc);
+        try {
+            for (const std::string& file : files) {
+                const fs::path src = dist_dir / file;
+                const fs::path dst = tmp_dir / file;
+                if (!fs::exists(src)) continue;
+
+                const std::string hash = hashFile(src);
+                if (hash.empty()) throw std::runtime_error("couldn't hash " + src.string());
+
+                const fs::path object = addObject(root, src, hash);
+                fs::create_directories(dst.parent_path());
+                materialize(object, dst, false);
+
+                entry << "file=" << file << "," << fs::file_size(object) << "," << hash << "\n";
+            }
+        } catch (const std::exception& e) {
+            last_error = root.string() + ": " + e.what();
+            entry.close();
+            fs::remove_all(tmp_dir, ec);
+            continue;
+        }
+        entry.close();
+
+        if (!entry) {
+            last_error = root.string() + ": couldn't write entry";
+            fs::remove_all(tmp_dir, ec);
+            continue;
+        }
+
+        fs::create_directories(final_dir.parent_path(), ec);
+        if (!ec && fs::exists(final_dir) && !Has(version, tool)) fs::remove_all(final_dir, ec);
+        if (!ec) fs::rename(tmp_dir, final_dir, ec);
+
+        if (ec) {
+            // Another process may have published the same build in the meantime
+            fs::remove_all(tmp_dir, ec);
+            fs::path existing = Find(version, tool);
+            if (!existing.empty()) return existing;
+
+            last_error = root.string() + ": couldn't publish " + final_dir.string();
+            continue;
+        }
+
+        return final_dir;
+    }
+
+    throw std::runtime_error("Couldn't store build of " + tool + " " + version + " (" + last_error + ")");
+}
+
+fs::path Store::Fetch(const std::string& version, const std::string& tool) const
+{
+    if (peers.empty() || roots.empty() || isHostOnly(version)) return fs::path();
+
+    const std::vector<std::string> allowed = toolFiles(tool);
+    const fs::path tmp_dir = roots.back() / ".tmp" / ("peer-" + version + "-" + tool + "-" + std::to_string(getpid()));
+
+    for (const std::string& peer : peers) {
+        std::string base = peer;
+        while (!base.empty() && base.back() == '/') base.pop_back();
+        base += "/store/" + std::string(hostPlatform()) + "/" + version + "/" + tool + "/";
+
+        std::error_code ec;
+        fs::remove_all(tmp_dir, ec);
+        fs::create_directories(tmp_dir, ec);
+        if (ec) return fs::path();
+
+        std::vector<StoreFile> files;
+        if (!downloadFile(base + ".entry", tmp_dir / ".entry").ok || !readEntry(tmp_dir, files)) continue;
+        fs::remove(tmp_dir / ".entry", ec);
+
+        // The entry comes from another machine, so it may only name the files of the tool
+        bool complete = true;
+        for (const StoreFile& file : files) {
+            if (std::find(allowed.begin(), allowed.end(), file.path) == allowed.end()) {
+                complete = false;
+                break;
+            }
+
+            const fs::path dst = tmp_dir / file.path;
+            fs::create_directories(dst.parent_path(), ec);
+
+            if (downloadFile(base + file.path, dst).hash != file.hash) {
+                complete = false;
+                break;
+            }
+
+            if (file.path == allowed.front()) {
+                fs::permissions(dst, fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec, fs::perm_options::add, ec);
+            }
+        }
+        if (!complete) continue;
+
+        try {
+            const fs::path entry = Publish(tmp_dir, version, tool);
+            fs::remove_all(tmp_dir, ec);
+            return entry;
+        } catch (const std::runtime_error&) {
+            continue;
+        }
+    }
+
+    std::error_code ec;
+    fs::remove_all(tmp_dir, ec);
+    return fs::path();
+}
+
+// The file is put next to its destination first and renamed over it, an
+// interrupted activation leaves either version behind but never half a file
+static void activateFile(const fs::path& src, const fs::path& dst)
+{
+    const fs::path tmp = dst.parent_path() / (activation_tmp_prefix + dst.filename().string() + "-" + std::to_string(getpid()));
+
+    std::error_code ec;
+    fs::create_directories(dst.parent_path(), ec);
+    fs::remove(tmp, ec);
+
+    materialize(src, tmp, true);
+
+    fs::rename(tmp, dst, ec);
+    if (ec) {
+        // Windows doesn't replace every kind of file in a rename
+        fs::remove(dst, ec);
+        fs::rename(tmp, dst, ec);
+    }
+    if (ec) {
+        fs::remove(tmp, ec);
+        throw std::runtime_error("Couldn't activate " + dst.string() + ": " + ec.message());
+    }
+
+    // Renaming a hardlink over another one of the same object leaves both
+    fs::remove(tmp, ec);
+}
+
+Activation Store::Activate(const fs::path& entry, const fs::path& dest_dir, const std::function<bool(const StoreFile&)>& unchanged) const
+{
+    Activation activation;
+    if (!readEntry(entry, activation.files)) {
+        throw std::runtime_error("Store entry " + entry.string() + " is incomplete");
+    }
+
+    for (const StoreFile& file : activation.files) {
+        const fs::path src = fs::absolute(entry / file.path);
+        const fs::path dst = dest_dir / file.path;
+
+        // Already a hardlink of the same object
+        std::error_code ec;
+        if (fs::equivalent(src, dst, ec) || unchanged(file)) continue;
+
+        activateFile(src, dst);
+        activation.replaced++;
+        activation.written += file.size;
+    }
+
+    return activation;
+}
+
+bool Store::Restore(const fs::path& entry, const StoreFile& file, const fs::path& dest_dir) const
+{
+    // The entry's file is a hardlink of the object, so a file modified in
+    // current/ may have taken both with it. Another root may still have it.
+    std::error_code ec;
+    const fs::file_status status = fs::status(entry / file.path, ec);
+    const bool executable = !ec && (status.permissions() & fs::perms::owner_exec) != fs::perms::none;
+
+    std::vector<fs::path> candidates = {entry / file.path};
+    for (const fs::path& root : roots) {
+        candidates.push_back(objectPath(root, file.hash, executable));
+        candidates.push_back(objectPath(root, file.hash, !executable));
+    }
+
+    for (const fs::path& candidate : candidates) {
+        if (hashFile(candidate) != file.hash) continue;
+        activateFile(fs::absolute(candidate), dest_dir / file.path);
+        return true;
+    }
+    return false;
+}
+
+std::vector<StoreEntry> Store::Entries(const fs::path& root) const
+{
+    std::vector<StoreEntry> entries;
+    std::error_code ec;
+
+    for (fs::directory_iterator version_it(root, ec), end; !ec && version_it != end; version_it.increment(ec)) {
+        const std::string name = version_it->path().filename().string();
+        if (name == "objects" || name == ".tmp") continue;
+
+        std::error_code tool_ec;
+        for (fs::directory_iterator tool_it(version_it->path(), tool_ec); !tool_ec && tool_it != end; tool_it.increment(tool_ec)) {
+            StoreEntry entry;
+            if (!readEntry(tool_it->path(), entry.files)) continue;
+
+            entry.version = name;
+            entry.tool = tool_it->path().filename().string();
+            entry.path = tool_it->path();
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    return entries;
+}
+
+bool Store::Verify(const fs::path& entry) const
+{
+    std::vector<StoreFile> files;
+    if (!readEntry(entry, files)) return false;
+
+    for (const StoreFile& file : files) {
+        if (hashFile(entry / file.path) != file.hash) return false;
+    }
+
+    return true;
+}
+
+void Store::Touch(const fs::path& entry) const
+{
+    // Shared entries may belong to someone else, the access time is a hint only
+    std::error_code ec;
+    fs::last_write_time(entry / ".entry", fs::file_time_type::clock::now(), ec);
+}
+
+StoreUsage Store::Usage(const fs::path& root) const
+{
+    StoreUsage usage;
+
+    for (const StoreEntry& entry : Entries(root)) {
+        usage.entries++;
+        for (const StoreFile& file : entry.files) {
+            usage.files++;
+            usage.logical += file.size;
+
+            // Entries that couldn't be hardlinked to their object are copies
+            std::error_code ec;
+            if (fs::hard_link_count(entry.path / file.path, ec) == 1) usage.physical += file.size;
+        }
+    }
+
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(root / "objects", ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        usage.objects++;
+        usage.physical += it->file_size(ec);
+    }
+
+    return usage;
+}
+
+StoreUsage installedUsage(const fs::path& install_dir)
+{
+    StoreUsage usage;
+    std::error_code ec;
+
+    for (fs::recursive_directory_iterator it(install_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+
+        const std::uintmax_t size = it->file_size(ec);
+        usage.files++;
+        usage.logical += size;
+
+        // Links into the store don't take up any space of their own
+        if (!it->is_symlink(ec) && it->hard_link_count(ec) == 1) usage.physical += size;
+    }
+
+    return usage;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <string>
+
+struct StoreUsage {
+    std::uintmax_t entries = 0;
+    std::uintmax_t files = 0;
+    std::uintmax_t objects = 0;
+    std::uintmax_t logical = 0;
+    std::uintmax_t physical = 0;
+};
+
+struct StoreFile {
+    std::string path;
+    std::uintmax_t size;
+    std::string hash;
+};
+
+struct Activation {
+    std::vector<StoreFile> files; // all of the entry's files, whether replaced or not
+    std::size_t replaced = 0;
+    std::uintmax_t written = 0;   // bytes of the replaced files
+};
+
+struct StoreEntry {
+    std::string version;
+    std::string tool;
+    std::filesystem::path path;
+    std::vector<StoreFile> files;
+};
+
+// Immutable per-version tool builds, shared by everyone pointing at the same root.
+// An entry lives in <root>/<version>/<tool>/ and mirrors the part of a build's
+// 'dist/' that belongs to the tool; '.entry' lists its files and is written last.
+// The files themselves are hardlinks into the content-addressed objects of the root.
+struct Store {
+    // Searched in order, new entries are published into the first writable root
+    std::vector<std::filesystem::path> roots;
+
+    // Base URLs of 'lct serve' instances that missing entries are fetched from
+    std::vector<std::string> peers;
+
+    std::filesystem::path Find(const std::string& version, const std::string& tool) const;
+    std::filesystem::path Publish(const std::filesystem::path& dist_dir, const std::string& version, const std::string& tool) const;
+    std::filesystem::path Fetch(const std::string& version, const std::string& tool) const;
+    // Puts the entry's files into 'dest_dir' except those 'unchanged' says are
+    // already there, so processes running them keep their pages cached
+    Activation Activate(const std::filesystem::path& entry, const std::filesystem::path& dest_dir, const std::function<bool(const StoreFile&)>& unchanged) const;
+    // Puts one file of 'entry' back into 'dest_dir' from a copy that still has
+    // its hash, false if the store has none left
+    bool Restore(const std::filesystem::path& entry, const StoreFile& file, const std::filesystem::path& dest_dir) const;
+    bool Verify(const std::filesystem::path& entry) const;
+    void Touch(const std::filesystem::path& entry) const;
+    std::vector<StoreEntry> Entries(const std::filesystem::path& root) const;
+    StoreUsage Usage(const std::filesystem::path& root) const;
+
+    inline bool Has(const std::string& version, const std::string& tool) const
+    {
+        return !Find(version, tool).empty();
+    }
+};
+
+// Files being activated are named "<prefix><name>-<pid>" until they are renamed into place
+extern const char* const activation_tmp_prefix;
+
+// Reads the file list of <entry>/.entry, false if it is missing or empty
+bool readEntry(const std::filesystem::path& entry, std::vector<StoreFile>& files);
+
+// Builds with a non-default profile (e.g. "native") are kept apart as "<version>+<profile>"
+std::string storeVersion(const std::string& version, const std::string& profile);
+
+// Native builds use instructions of the CPU they were built on, the same
+// platform doesn't mean they run. They never leave or enter through peers, serve or bundles.
+bool isHostOnly(const std::string& store_version);
+
+// "<os>-<arch>" of this build, entries are only shared between the same platform
+const char* hostPlatform();
+
+StoreUsage installedUsage(const std::filesystem::path& install_dir);
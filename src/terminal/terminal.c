@@ -18,12 +18,26 @@ int supportsANSI()
 
     return true;
 }
+
+int terminalWidth()
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) return 0;
+    return info.srWindow.Right - info.srWindow.Left + 1;
+}
 #else
 #include <unistd.h>
+#include <sys/ioctl.h>
 
 int supportsANSI()
 {
     return isatty(fileno(stdout));
 }
-#endif
 
+int terminalWidth()
+{
+    struct winsize size;
+    if (ioctl(fileno(stdout), TIOCGWINSZ, &size) != 0) return 0;
+    return size.ws_col;
+}
+#endif
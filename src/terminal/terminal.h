@@ -6,6 +6,9 @@ extern "C" {
 
 int supportsANSI();
 
+// Columns of the terminal stdout goes to, 0 if it isn't one or doesn't say
+int terminalWidth();
+
 #ifdef __cplusplus
 }
 #endif
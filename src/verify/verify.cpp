@@ -0,0 +1,209 @@
+#include "verify.hpp"
+#include "../store/objects.hpp"
+#include "../shell/shell.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+enum class Problem {
+    None,
+    Missing,
+    NotRegular,
+    Size,
+    Mode,
+    Mtime,
+    Hash
+};
+
+static const char* describe(Problem problem)
+{
+    switch (problem) {
+        case Problem::Missing:    return "is missing";
+        case Problem::NotRegular: return "isn't a regular file";
+        case Problem::Size:       return "changed its size";
+        case Problem::Mode:       return "changed its permissions";
+        case Problem::Mtime:      return "was modified";
+        case Problem::Hash:       return "doesn't match its hash";
+        default:                  return "is fine";
+    }
+}
+
+struct Check {
+    std::string tool;
+    InstalledFile file;
+    Problem problem = Problem::None;
+    bool done = false;
+    bool binary = false; // replaced by the shim when shims are on
+};
+
+static std::string binaryPath(const std::string& tool)
+{
+#ifdef _WIN32
+    return "bin/" + tool + ".exe";
+#else
+    return "bin/" + tool;
+#endif
+}
+
+// writeShims() links the shim over the binary the manifest lists, or copies it
+// where hardlinks aren't possible
+static bool isShim(const fs::path& path, const fs::path& shim)
+{
+    std::error_code ec;
+    if (fs::equivalent(path, shim, ec)) return true;
+
+    const std::uintmax_t size = fs::file_size(path, ec);
+    if (ec || size != fs::file_size(shim, ec) || ec) return false;
+    return hashFile(path) == hashFile(shim);
+}
+
+static Problem checkFile(const fs::path& path, const InstalledFile& file, bool full)
+{
+    std::error_code ec;
+    const fs::file_status status = fs::status(path, ec);
+    if (!fs::exists(status)) return Problem::Missing;
+    if (!fs::is_regular_file(status)) return Problem::NotRegular;
+    if (fs::file_size(path, ec) != file.size || ec) return Problem::Size;
+    if (static_cast<unsigned int>(status.permissions() & fs::perms::mask) != file.mode) return Problem::Mode;
+
+    if (full) return hashFile(path) == file.hash ? Problem::None : Problem::Hash;
+
+    // Manifests recorded without an mtime can only be checked by hashing
+    const fs::file_time_type mtime = fs::last_write_time(path, ec);
+    if (file.mtime != 0 && (ec || mtime.time_since_epoch().count() != file.mtime)) return Problem::Mtime;
+    return Problem::None;
+}
+
+bool matchesManifest(const fs::path& path, const InstalledFile& file)
+{
+    return file.mtime != 0 && checkFile(path, file, false) == Problem::None;
+}
+
+static double elapsed(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+VerifyResult verifyInstalled(const Store& store, const fs::path& dest_dir, const std::vector<std::string>& tools, State& state, const VerifyOptions& options, bool use_ansi)
+{
+    VerifyResult result;
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<Check> checks;
+    for (const std::string& tool : tools) {
+        for (const InstalledFile& file : state.GetFiles(tool)) checks.push_back({tool, file, Problem::None, false, file.path == binaryPath(tool)});
+    }
+
+    unsigned int jobs = options.jobs > 0 ? options.jobs : processCpuCount();
+    jobs = static_cast<unsigned int>(std::max<std::size_t>(1, std::min<std::size_t>(jobs, checks.size())));
+
+    std::cout << "==> Checking " << checks.size() << " files " << (options.full ? "by their hashes" : "by size, mode and mtime");
+    if (jobs > 1) std::cout << " with " << jobs << " threads";
+    std::cout << "..." << '\n';
+
+    // Each thread takes the next file until there are none or the time is up, a
+    // file that is being hashed when it passes is finished
+    std::atomic<std::size_t> next(0);
+    std::atomic<std::uintmax_t> hashed(0);
+    auto work = [&]() {
+        for (;;) {
+            if (options.deadline > 0.0 && elapsed(start) >= options.deadline) return;
+
+            const std::size_t i = next++;
+            if (i >= checks.size()) return;
+
+            Check& check = checks[i];
+            check.problem = checkFile(dest_dir / check.file.path, check.file, options.full);
+            if (check.problem != Problem::None && check.binary && !options.shim.empty() && isShim(dest_dir / check.file.path, options.shim)) {
+                check.problem = Problem::None;
+            }
+            check.done = true;
+            if (options.full && check.problem != Problem::Missing && check.problem != Problem::NotRegular) hashed += check.file.size;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < jobs; i++) threads.emplace_back(work);
+    work();
+    for (std::thread& thread : threads) thread.join();
+
+    result.hashed = hashed;
+
+    for (const Check& check : checks) {
+        if (!check.done) {
+            result.unchecked++;
+            continue;
+        }
+        result.checked++;
+        if (check.problem == Problem::None) continue;
+
+        result.bad++;
+        std::cout << "==> ";
+        if (use_ansi) std::cout << "\033[31m";
+        std::cout << check.file.path;
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " of " << check.tool << " " << describe(check.problem) << '\n';
+
+        if (!options.repair) continue;
+
+        // The shim goes back in place of a binary, as writeShims() would put it
+        std::error_code shim_ec;
+        if (check.binary && !options.shim.empty() && fs::exists(options.shim.parent_path() / (check.tool + ".shim"), shim_ec)) {
+            std::error_code ec;
+            const fs::path path = dest_dir / check.file.path;
+            fs::remove(path, ec);
+            fs::create_hard_link(options.shim, path, ec);
+            if (ec) {
+                ec.clear();
+                fs::copy_file(options.shim, path, fs::copy_options::overwrite_existing, ec);
+            }
+            if (ec) {
+                std::cout << "    couldn't link the shim again: " << ec.message() << '\n';
+                continue;
+            }
+
+            result.repaired++;
+            std::cout << "    linked the shim again" << '\n';
+            continue;
+        }
+
+        // Only the build the tool was activated from is trusted, nothing is downloaded
+        auto active = state.GetVersion(check.tool);
+        const fs::path entry = active.has_value() ? store.Find(storeVersion(active->get(), state.GetProfile(check.tool)), check.tool) : fs::path();
+
+        bool restored = false;
+        if (!entry.empty()) {
+            try {
+                restored = store.Restore(entry, {check.file.path, check.file.size, check.file.hash}, dest_dir);
+            } catch (const std::runtime_error& e) {
+                std::cerr << e.what() << '\n';
+            }
+        }
+
+        if (!restored) {
+            std::cout << "    the store has no intact copy left, reinstall " << check.tool << " to repair it" << '\n';
+            continue;
+        }
+
+        // A hardlink shares its mode with the object, so a chmod in current/ changed both
+        std::error_code ec;
+        const fs::path path = dest_dir / check.file.path;
+        if (static_cast<unsigned int>(fs::status(path, ec).permissions() & fs::perms::mask) != check.file.mode) {
+            fs::permissions(path, static_cast<fs::perms>(check.file.mode), ec);
+        }
+
+        const fs::file_time_type mtime = fs::last_write_time(path, ec);
+        state.SetMtime(check.file.path, check.file.hash, ec ? 0 : mtime.time_since_epoch().count());
+
+        result.repaired++;
+        std::cout << "    restored from the store" << '\n';
+    }
+
+    result.seconds = elapsed(start);
+    return result;
+}
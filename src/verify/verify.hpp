@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "../store/store.hpp"
+#include "../data/state.hpp"
+
+struct VerifyOptions {
+    bool full = false;     // hash every file instead of comparing size, mode and mtime
+    bool repair = false;   // put bad files back from the local store
+    unsigned int jobs = 0; // files checked at once, 0 for one per CPU
+    double deadline = 0.0; // seconds after which no more files are started, 0 for none
+    std::filesystem::path shim; // shims/lct-shim if shims are on, a tool's binary may be a link of it then
+};
+
+struct VerifyResult {
+    std::size_t checked = 0;
+    std::size_t bad = 0;
+    std::size_t repaired = 0;
+    std::size_t unchecked = 0; // left when the deadline passed
+    std::uintmax_t hashed = 0; // bytes
+    double seconds = 0.0;
+};
+
+// Checks the files 'tools' installed into 'dest_dir' against their manifests in
+// 'state' and prints each one that is missing or differs. Only the manifests of
+// the active versions are read, so the time it takes doesn't grow with the
+// versions kept in the store. Repaired files get their new mtime recorded in 'state'.
+VerifyResult verifyInstalled(const Store& store, const std::filesystem::path& dest_dir, const std::vector<std::string>& tools, State& state, const VerifyOptions& options, bool use_ansi);
+
+// True if 'path' still has the size, mode and mtime 'file' was recorded with,
+// false if no mtime was recorded. Doesn't read the file.
+bool matchesManifest(const std::filesystem::path& path, const InstalledFile& file);
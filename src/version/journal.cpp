@@ -0,0 +1,116 @@
+#include "journal.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static const char* const phase_names[] = { "downloaded", "extracted", "built", "staged" };
+
+const char* phaseName(BuildPhase phase)
+{
+    return phase_names[static_cast<int>(phase)];
+}
+
+bool Journal::Load(const fs::path& dir)
+{
+    std::ifstream ifs(dir / ".journal");
+    if (!ifs.is_open()) return false;
+
+    workspace = dir;
+    version.clear();
+    tools.clear();
+    source.clear();
+
+    bool any_phase = false;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.rfind("version=", 0) == 0) version = line.substr(8);
+        else if (line.rfind("tool=", 0) == 0) tools.push_back(line.substr(5));
+        else if (line.rfind("source=", 0) == 0) source = line.substr(7);
+        else if (line.rfind("phase=", 0) == 0) {
+            for (int i = 0; i < 4; i++) {
+                if (line.compare(6, std::string::npos, phase_names[i]) != 0) continue;
+                phase = static_cast<BuildPhase>(i);
+                any_phase = true;
+            }
+        }
+    }
+
+    return any_phase && !version.empty() && !tools.empty();
+}
+
+bool Journal::Save() const
+{
+    const fs::path path = workspace / ".journal";
+    const fs::path tmp = workspace / (".journal.tmp-" + std::to_string(getpid()));
+
+    FILE* file = std::fopen(tmp.string().c_str(), "w");
+    if (!file) return false;
+
+    std::string text = "version=" + version + "\n";
+    for (const std::string& tool : tools) text += "tool=" + tool + "\n";
+    if (!source.empty()) text += "source=" + source + "\n";
+    text += std::string("phase=") + phaseName(phase) + "\n";
+
+    bool ok = std::fwrite(text.data(), 1, text.size(), file) == text.size() && std::fflush(file) == 0;
+#ifndef _WIN32
+    // The phase has to survive a reboot before the work after it may depend on it
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = std::fclose(file) == 0 && ok;
+
+    std::error_code ec;
+    if (ok) fs::rename(tmp, path, ec);
+    if (!ok || ec) {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+void Journal::Record(BuildPhase new_phase)
+{
+    phase = new_phase;
+    // A journal that can't be written only costs the resume
+    Save();
+}
+
+bool Journal::Covers(const std::vector<std::string>& needed) const
+{
+    for (const std::string& tool : needed) {
+        if (std::find(tools.begin(), tools.end(), tool) == tools.end()) return false;
+    }
+    return true;
+}
+
+bool processGone(long pid)
+{
+#ifndef _WIN32
+    return pid > 0 && kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH;
+#else
+    (void)pid;
+    return false;
+#endif
+}
+
+long namePid(const std::string& name)
+{
+    const std::size_t dash = name.rfind('-');
+    if (dash == std::string::npos) return 0;
+
+    char* end;
+    const long pid = std::strtol(name.c_str() + dash + 1, &end, 10);
+    if (*end != '\0' || end == name.c_str() + dash + 1 || pid <= 0) return 0;
+    return pid;
+}
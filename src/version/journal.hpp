@@ -0,0 +1,42 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Phases of a build in the order they complete
+enum class BuildPhase {
+    Downloaded, // the archive is cached and matched its SHA-256 (or git fetched the tag)
+    Extracted,  // the sources are in the workspace
+    Built,      // dist/ holds every tool
+    Staged      // every tool is published into the store
+};
+
+const char* phaseName(BuildPhase phase);
+
+// What a build got done so far, kept in its workspace as '.journal'. A build
+// that was interrupted (Ctrl-C, OOM kill, reboot of a disk workspace) leaves
+// both behind, the next build of the same version picks them up after the
+// last phase that was recorded.
+struct Journal {
+    std::filesystem::path workspace;
+    std::string version; // the store version
+    std::vector<std::string> tools;
+    std::string source;  // the source tree, relative to the workspace
+    BuildPhase phase = BuildPhase::Downloaded;
+
+    bool Load(const std::filesystem::path& workspace);
+
+    // Replaces the journal in one rename and flushes it to disk
+    bool Save() const;
+    void Record(BuildPhase phase);
+
+    // True if it was built for every one of 'tools'
+    bool Covers(const std::vector<std::string>& tools) const;
+};
+
+// True if no process with 'pid' exists anymore
+bool processGone(long pid);
+
+// The pid at the end of a "<name>-<pid>" style file name, 0 if there is none
+long namePid(const std::string& name);
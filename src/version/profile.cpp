@@ -0,0 +1,221 @@
+#include "profile.hpp"
+#include "../shell/shell.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const char* const profiles[] = { "native", "lto", "pgo" };
+
+static const char* const compilers[] = { "cc", "c++", "gcc", "g++", "clang", "clang++" };
+
+// What each tool is trained on, run in the workload directory with the
+// instrumented binaries first on PATH. LCT doesn't document the command lines
+// of its tools, so these are guesses: a run that fails makes the pgo build
+// fail rather than quietly being a release build.
+struct Workload {
+    const char* tool;
+    const char* command;
+};
+
+static const Workload workloads[] = {
+    {"lasmp", "lasmp train.asm -o train.pre.asm"},
+    {"lasm",  "lasm train.asm -o train.o"},
+    {"lnk",   "lnk train.o -o train.out"},
+    {"lbf",   "lbf train.bf"},
+    {"lbt",   "lbt --help"},
+    {"lfs",   "lfs --help"},
+    {"ljoke", "ljoke"},
+    {"lhoho", "lhoho"}
+};
+
+static std::string quote(const std::string& str)
+{
+    std::string quoted = "'";
+    for (char c : str) {
+        if (c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+}
+
+bool isProfile(const std::string& name)
+{
+    for (const char* profile : profiles) {
+        if (name == profile) return true;
+    }
+    return false;
+}
+
+void splitStoreVersion(const std::string& store_version, std::string& version, std::string& profile)
+{
+    std::size_t plus = store_version.rfind('+');
+    if (plus == std::string::npos || !isProfile(store_version.substr(plus + 1))) {
+        version = store_version;
+        profile.clear();
+        return;
+    }
+
+    version = store_version.substr(0, plus);
+    profile = store_version.substr(plus + 1);
+}
+
+static fs::path findCompiler(const std::string& name, const fs::path& skip)
+{
+    const char* path = std::getenv("PATH");
+    if (!path) return fs::path();
+
+    std::istringstream dirs(path);
+    std::string dir;
+    std::error_code ec;
+    while (std::getline(dirs, dir, ':')) {
+        if (dir.empty() || fs::equivalent(dir, skip, ec)) continue;
+
+        const fs::path candidate = fs::path(dir) / name;
+        if (fs::is_regular_file(candidate, ec)) return candidate;
+    }
+    return fs::path();
+}
+
+static std::string profileFlags(const std::string& compiler, const std::string& profile, ProfileStage stage, const fs::path& profile_dir)
+{
+#ifdef __APPLE__
+    const bool clang = true;
+    (void)compiler;
+#else
+    const bool clang = compiler.find("clang") != std::string::npos;
+#endif
+
+    if (profile == "native") {
+#if defined(__aarch64__)
+        return "-mcpu=native";
+#else
+        return "-march=native";
+#endif
+    }
+
+    if (profile == "lto") return clang ? "-flto=thin" : "-flto=auto";
+
+    if (profile == "pgo") {
+        if (stage == ProfileStage::Generate) return "-fprofile-generate=" + quote(profile_dir.string());
+
+        if (!clang) return "-fprofile-use=" + quote(profile_dir.string()) + " -fprofile-correction -Wno-missing-profile";
+
+        // Without merged profile data the final build is a plain release build
+        std::error_code ec;
+        const fs::path data = profile_dir / "lct.profdata";
+        if (!fs::exists(data, ec)) return "";
+        return "-fprofile-use=" + quote(data.string()) + " -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date";
+    }
+
+    return "";
+}
+
+bool writeCompilerWrappers(const fs::path& dir, const std::string& profile, ProfileStage stage, const fs::path& profile_dir)
+{
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    fs::create_directories(dir, ec);
+    if (ec) return false;
+
+    bool any = false;
+    for (const char* name : compilers) {
+        const fs::path real = findCompiler(name, dir);
+        if (real.empty()) continue;
+
+        const fs::path wrapper = dir / name;
+        {
+            std::ofstream ofs(wrapper, std::ios::trunc);
+            if (!ofs.is_open()) return false;
+            ofs << "#!/bin/sh\n";
+            ofs << "exec " << quote(real.string()) << " \"$@\" " << profileFlags(name, profile, stage, profile_dir) << "\n";
+            if (!ofs) return false;
+        }
+
+        fs::permissions(wrapper, fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec |
+                        fs::perms::others_read | fs::perms::others_exec, ec);
+        if (ec) return false;
+        any = true;
+    }
+
+    return any;
+}
+
+static void writeWorkloadFiles(const fs::path& dir)
+{
+    // Enough distinct labels and instructions to exercise symbol lookup and encoding
+    std::ofstream asm_file(dir / "train.asm", std::ios::trunc);
+    asm_file << "section .text\nglobal _start\n_start:\n";
+    for (int i = 0; i < 2000; i++) {
+        asm_file << "loop_" << i << ":\n";
+        asm_file << "    mov rax, " << i << "\n";
+        asm_file << "    add rax, rbx\n";
+        asm_file << "    cmp rax, " << (i * 7) << "\n";
+        asm_file << "    jne loop_" << (i / 2) << "\n";
+    }
+    asm_file << "    mov rax, 60\n    xor rdi, rdi\n    syscall\n";
+    asm_file << "section .data\n";
+    for (int i = 0; i < 200; i++) {
+        asm_file << "message_" << i << ": db \"training data " << i << "\", 10\n";
+    }
+
+    // Nested countdown loops that always terminate, then print a cell
+    std::ofstream bf_file(dir / "train.bf", std::ios::trunc);
+    for (int i = 0; i < 50; i++) {
+        bf_file << "++++++++[>++++++++[>++++++++[>+>+<<-]<-]<-]>>>.<<<\n";
+    }
+}
+
+std::vector<std::string> trainProfile(const std::vector<std::string>& tools, const fs::path& bin_dir, const fs::path& workload_dir)
+{
+    std::error_code ec;
+    fs::create_directories(workload_dir, ec);
+    if (ec) return tools;
+
+    writeWorkloadFiles(workload_dir);
+
+    std::vector<std::string> failed;
+    for (const std::string& tool : tools) {
+        const Workload* workload = nullptr;
+        for (const Workload& known : workloads) {
+            if (tool == known.tool) workload = &known;
+        }
+        if (!workload) {
+            failed.push_back(tool);
+            continue;
+        }
+
+        const std::string cmd = "cd " + quote(workload_dir.string()) + " && PATH=" + quote(bin_dir.string()) + ":\"$PATH\" " +
+                                workload->command + " >/dev/null 2>&1";
+        CommandResult res = invokeGovernedCall(cmd.c_str());
+        std::free(res.stdout_str);
+        std::free(res.stderr_str);
+        if (res.exit_code != 0) failed.push_back(tool);
+    }
+
+    return failed;
+}
+
+bool finishProfile(const fs::path& profile_dir)
+{
+#ifdef __APPLE__
+    const std::string profdata = "xcrun llvm-profdata";
+#else
+    const std::string profdata = "llvm-profdata";
+#endif
+
+    // gcc reads its .gcda files directly
+    std::error_code ec;
+    bool raw = false;
+    for (const fs::directory_entry& entry : fs::directory_iterator(profile_dir, ec)) {
+        raw = raw || entry.path().extension() == ".profraw";
+    }
+    if (!raw) return true;
+
+    const std::string cmd = profdata + " merge -o " + quote((profile_dir / "lct.profdata").string()) + " " + quote(profile_dir.string());
+    CommandResult res = invokeSystemCall(cmd.c_str());
+    std::free(res.stdout_str);
+    std::free(res.stderr_str);
+    return res.exit_code == 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Build profiles change how LCT compiles the tools without LCT's build scripts
+// knowing about them: compiler wrappers put in front of PATH append the flags.
+//   native  tuned for this CPU (-march=native)
+//   lto     link-time optimization
+//   pgo     built twice, the second time with profiles from a training run
+// The default release build is the empty profile.
+bool isProfile(const std::string& name);
+
+// Splits a store version ("<version>+<profile>") back into its parts
+void splitStoreVersion(const std::string& store_version, std::string& version, std::string& profile);
+
+enum class ProfileStage {
+    Build,    // the only build of native and lto, the final one of pgo
+    Generate  // the instrumented pgo build that is trained
+};
+
+// Writes wrappers for every compiler found on PATH into 'dir', pgo profiles
+// are written to and read from 'profile_dir'
+bool writeCompilerWrappers(const std::filesystem::path& dir, const std::string& profile, ProfileStage stage, const std::filesystem::path& profile_dir);
+
+// Runs the bundled workload of every tool with the instrumented binaries in
+// 'bin_dir', returns the tools whose run failed or that have no workload
+std::vector<std::string> trainProfile(const std::vector<std::string>& tools, const std::filesystem::path& bin_dir, const std::filesystem::path& workload_dir);
+
+// Turns what the training run wrote into something -fprofile-use reads (clang only)
+bool finishProfile(const std::filesystem::path& profile_dir);
@@ -1,20 +1,88 @@
 #include "version.hpp"
 
+#include <algorithm>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <cstdlib>
+#include <fstream>
+#include <chrono>
 #include "../shell/shell.h"
 #include "../download/source.h"
+#include "../download/decode.h"
+#include "../format/format.hpp"
+#include "profile.hpp"
+#include "workspace.hpp"
+#include "journal.hpp"
+#include "../verify/verify.hpp"
+#include "../events/events.hpp"
 #include <iostream>
 
 namespace fs = std::filesystem;
 
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static const char* const activation_record_prefix = ".activating-";
+
 #define PATH_MAKE_STRING(name) \
     const std::string& name##_string = name.string()
 
+// Where the sources of each tool live in the archive of a version, relative to
+// its top-level folder. Directories of tools that aren't being built are left
+// out when unpacking, everything else (ci/, shared code, licenses) is kept.
+typedef std::unordered_map<std::string, std::vector<std::string>> SourceLayout;
+
+static const SourceLayout layout_v0_1_0_alpha_6 = {
+    {"lhoho", {"tools/lhoho"}},
+    {"ljoke", {"tools/ljoke"}},
+    {"lbf",   {"tools/lbf"}},
+    {"lfs",   {"tools/lfs"}},
+    {"lbt",   {"tools/lbt"}},
+    {"lnk",   {"tools/lnk"}},
+    {"lasm",  {"tools/lasm", "tools/lasmp"}},
+    {"lasmp", {"tools/lasmp"}}
+};
+
+static const std::unordered_map<std::string, const SourceLayout*> source_layouts = {
+    {"v0.1.0-alpha.6",   &layout_v0_1_0_alpha_6},
+    {"v0.1.0-alpha.6.2", &layout_v0_1_0_alpha_6}
+};
+
+// Directories none of 'tools' need, empty for versions without a layout
+static std::vector<std::string> unneededSources(const char* version_str, const std::vector<std::string>& tools)
+{
+    auto layout = source_layouts.find(version_str);
+    if (layout == source_layouts.end()) return {};
+
+    std::unordered_set<std::string> needed;
+    for (const std::string& tool : tools) {
+        auto dirs = layout->second->find(tool);
+        // A tool the layout doesn't know about could need anything
+        if (dirs == layout->second->end()) return {};
+        needed.insert(dirs->second.begin(), dirs->second.end());
+    }
+
+    std::unordered_set<std::string> excluded;
+    for (const auto& [tool, dirs] : *layout->second) {
+        for (const std::string& dir : dirs) {
+            if (needed.find(dir) == needed.end()) excluded.insert(dir);
+        }
+    }
+    std::vector<std::string> dirs(excluded.begin(), excluded.end());
+    std::sort(dirs.begin(), dirs.end());
+    return dirs;
+}
+
 struct buildData {
     std::vector<std::string> tools;
     const char* version;
+    fs::path wrapper_dir; // compiler wrappers of the build profile, empty for none
 };
 
 CommandResult buildToolchain(void* vdata)
@@ -27,19 +95,28 @@ CommandResult buildToolchain(void* vdata)
     const char* cmd_base = "python3 -m ci.ci --no-test -v ";
 #endif
 
-    std::string cmd = cmd_base;
+    std::string cmd;
+    if (!data->wrapper_dir.empty()) cmd += "PATH=\"" + data->wrapper_dir.string() + ":$PATH\" ";
+#ifndef _WIN32
+    // Make and CMake honor these, so does every build they drive. ci.ci itself
+    // compiles one file after another and ignores them, see processJobs().
+    const unsigned int jobs = processJobs();
+    if (jobs > 0) cmd += "MAKEFLAGS=-j" + std::to_string(jobs) + " CMAKE_BUILD_PARALLEL_LEVEL=" + std::to_string(jobs) + " ";
+#endif
+    cmd += cmd_base;
     cmd += '\"';
     cmd += data->version;
     cmd += '\"';
     for (std::string& tool : data->tools) cmd += " " + tool;
 
-    return invokeSystemCall(cmd.c_str());
+    return invokeGovernedCall(cmd.c_str());
 }
 
-void install_version(const char* version_str, const fs::path& source_dir, const fs::path& dest_dir, const std::vector<std::string>& tools, bool use_ansi)
+// Downloads the archive and unpacks it into a new workspace, returns the source tree
+static fs::path unpack_version(const char* version_str, Sources& sources, const std::vector<std::string>& unneeded, Workspace& workspace, Journal& journal, bool use_ansi)
 {
+    const fs::path& source_dir = sources.archive_dir;
     PATH_MAKE_STRING(source_dir);
-    PATH_MAKE_STRING(dest_dir);
 
     sh_mkdir(source_dir_string.c_str());
 
@@ -47,76 +124,488 @@ void install_version(const char* version_str, const fs::path& source_dir, const
     if (use_ansi) std::cout << "\033[36m";
     std::cout << version_str;
     if (use_ansi) std::cout << "\033[0m";
-    std::cout << "..." << std::endl;
-    char* archive = downloadSource(version_str, source_dir_string.c_str());
-    if (!archive) {
+    std::cout << "..." << '\n';
+    const fs::path archive = sources.Download(version_str, use_ansi);
+    if (archive.empty()) {
         throw std::runtime_error(std::string("Couldn't download source of ") + version_str);
     }
+    PATH_MAKE_STRING(archive);
+
+    // Only gzip says, xz and zstd archives are assumed to compress like they did
+    // before and zips about 1:3
+    std::error_code size_ec;
+    const std::uintmax_t archive_size = fs::file_size(archive, size_ec);
+    const int codec = codecOfFile(archive_string.c_str());
+    std::uintmax_t unpacked = codec == CODEC_GZIP ? gzipUncompressedSize(archive) : 0;
+    if (unpacked == 0 && !size_ec) {
+        if (codec >= 0) unpacked = static_cast<std::uintmax_t>(static_cast<double>(archive_size) / sources.Stats(static_cast<ArchiveCodec>(codec)).ratio);
+        else unpacked = archive_size * 3;
+    }
+    workspace.Create(sources.build_root, source_dir, journal.version, unpacked, use_ansi);
+    journal.workspace = workspace.path;
+    journal.Record(BuildPhase::Downloaded);
+    const std::string workspace_string = workspace.path.string();
+
+    std::vector<std::string> excludes;
+    for (const std::string& dir : unneeded) excludes.push_back("*/" + dir);
+    std::vector<const char*> exclude_ptrs;
+    for (const std::string& exclude : excludes) exclude_ptrs.push_back(exclude.c_str());
 
     std::cout << "==> Unarchiving source of ";
     if (use_ansi) std::cout << "\033[36m";
     std::cout << version_str;
     if (use_ansi) std::cout << "\033[0m";
-    std::cout << "..." << std::endl;
-    char* unarchived = unpackSource(archive, source_dir_string.c_str(), version_str);
-    if (!unarchived) {
-        sh_remove(archive);
-        std::free(archive);
-        throw std::runtime_error(std::string("Couldn't unarchive source of ") + version_str);
+#ifndef _WIN32
+    if (!excludes.empty()) std::cout << " (skipping " << excludes.size() << " unneeded directories)";
+#endif
+    std::cout << "..." << '\n';
+    const auto unpack_start = std::chrono::steady_clock::now();
+    unsigned long long unpacked_bytes = 0;
+    char* unarchived;
+    {
+        EventPhase phase("unpack", archive.filename().string());
+        unarchived = unpackSource(archive_string.c_str(), workspace_string.c_str(), version_str, exclude_ptrs.data(), exclude_ptrs.size(), &unpacked_bytes);
+        if (!unarchived) {
+            sh_remove(archive_string.c_str());
+            throw std::runtime_error(std::string("Couldn't unarchive source of ") + version_str);
+        }
     }
 
-    const fs::path full_source = source_dir / unarchived;
-    PATH_MAKE_STRING(full_source);
+    if (unpacked_bytes > 0) {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - unpack_start).count();
+        std::cout << "==> Unpacked ";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << formatBytes(unpacked_bytes);
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " from " << archive.filename().string() << " in " << formatDuration(seconds) << " (" << formatRate(unpacked_bytes, seconds) << ")" << '\n';
+        if (codec >= 0 && !size_ec) sources.Record(static_cast<ArchiveCodec>(codec), archive_size, unpacked_bytes, seconds);
+    }
 
-    std::free(archive);
+    const fs::path full_source = workspace.path / unarchived;
     std::free(unarchived);
+    return full_source;
+}
+
+// Checks the version out of the git mirror into a new workspace, empty if git failed
+static fs::path checkout_version(const char* version_str, Sources& sources, const std::vector<std::string>& unneeded, Workspace& workspace, Journal& journal, bool use_ansi)
+{
+    std::cout << "==> Checking out source of ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << version_str;
+    if (use_ansi) std::cout << "\033[0m";
+    if (!unneeded.empty()) std::cout << " (skipping " << unneeded.size() << " unneeded directories)";
+    std::cout << "..." << '\n';
+
+    EventPhase phase("checkout", version_str);
+    if (!sources.git.Fetch(version_str, use_ansi)) {
+        phase.Fail();
+        return fs::path();
+    }
+
+    workspace.Create(sources.build_root, sources.archive_dir, journal.version, sources.git.TreeSize(version_str), use_ansi);
+    journal.workspace = workspace.path;
+    journal.Record(BuildPhase::Downloaded);
+
+    const fs::path full_source = workspace.path / "source";
+    if (!sources.git.Checkout(version_str, unneeded, full_source)) {
+        phase.Fail();
+        workspace.Remove();
+        return fs::path();
+    }
+    return full_source;
+}
+
+static void printStep(const char* step, const std::string& version, bool use_ansi)
+{
+    std::cout << "==> " << step << " ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << version;
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << "..." << '\n';
+}
+
+static void forwardOutput(int stream, const char* line, size_t length, void* data)
+{
+    (void)data;
+    eventOutput(stream, line, length);
+}
+
+// 'store_version' only names the build in events
+static void run_build(const fs::path& full_source, buildData& build_data, const std::string& store_version, bool use_ansi)
+{
+    const ProcessTotals before = *processTotals();
+
+    const std::string full_source_string = full_source.string();
+    CommandResult res;
+    {
+        EventPhase phase("build", store_version);
+        if (eventsEnabled()) setOutputHandler(forwardOutput, nullptr);
+        res = openDir(full_source_string.c_str(), buildToolchain, reinterpret_cast<void*>(&build_data));
+        setOutputHandler(nullptr, nullptr);
+        if (res.exit_code != 0) phase.Fail();
+    }
+
+    const ProcessTotals* after = processTotals();
+    if (after->pauses > before.pauses) {
+        std::cout << "==> Paused for ";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << formatDuration(after->throttled - before.throttled);
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " while the load average was above " << processLimits()->max_load << '\n';
+    }
+    if (res.exit_code != 0) {
+        throw std::runtime_error(std::string("Failed to build ") + build_data.version + ":\nSTDERR: " + res.stderr_str + "\nSTDOUT: " + res.stdout_str);
+    }
+}
 
+// Builds the unpacked sources with the compilers of 'profile', twice for pgo
+static void build_source(const fs::path& full_source, const Workspace& workspace, const std::vector<std::string>& tools,
+                         const std::string& version, const std::string& profile, bool use_ansi)
+{
     buildData build_data;
     build_data.tools = tools;
-    build_data.version = version_str;
+    build_data.version = version.c_str();
+
+    const fs::path profile_dir = workspace.path / "profile";
+    if (!profile.empty()) {
+        build_data.wrapper_dir = profile_dir / "bin";
+        if (!writeCompilerWrappers(build_data.wrapper_dir, profile, profile == "pgo" ? ProfileStage::Generate : ProfileStage::Build, profile_dir / "data")) {
+            throw std::runtime_error("Couldn't set up the compilers for the " + profile + " profile");
+        }
+    }
+
+    if (profile == "pgo") {
+        // The final build has to happen at the same path for gcc to find its profiles
+        const fs::path pristine = workspace.path / "pristine";
+        if (copyTree(full_source.string().c_str(), pristine.string().c_str()) != 0) {
+            throw std::runtime_error("Couldn't copy the source of " + version + " for the pgo build");
+        }
+
+        printStep("Building instrumented source of", version, use_ansi);
+        run_build(full_source, build_data, version, use_ansi);
+
+        printStep("Training on the bundled workload of", version, use_ansi);
+        std::vector<std::string> untrained;
+        {
+            EventPhase phase("train", version);
+            untrained = trainProfile(tools, full_source / "dist" / "bin", profile_dir / "workload");
+            if (!untrained.empty()) phase.Fail();
+        }
+
+        // Without profile data the result would be a release build labelled pgo
+        if (!untrained.empty()) {
+            std::string names;
+            for (const std::string& tool : untrained) names += (names.empty() ? "" : ", ") + tool;
+            throw std::runtime_error("Training the pgo build of " + version + " failed for " + names + ", install it with another profile");
+        }
+        if (!finishProfile(profile_dir / "data")) {
+            throw std::runtime_error("Couldn't merge the training profiles of " + version + ", is llvm-profdata installed?");
+        }
+
+        removeTree(full_source.string().c_str());
+        std::error_code ec;
+        fs::rename(pristine, full_source, ec);
+        if (ec || !writeCompilerWrappers(build_data.wrapper_dir, profile, ProfileStage::Build, profile_dir / "data")) {
+            throw std::runtime_error("Couldn't set up the optimized pgo build of " + version);
+        }
+    }
+
+    printStep("Building source of", storeVersion(version, profile), use_ansi);
+    run_build(full_source, build_data, storeVersion(version, profile), use_ansi);
+}
+
+// 'store_version' carries the build profile, see storeVersion()
+static void build_version(const char* store_version_str, const Store& store, Sources& sources, const std::vector<std::string>& tools, bool use_ansi)
+{
+    std::string version, profile;
+    splitStoreVersion(store_version_str, version, profile);
+    const char* version_str = version.c_str();
+
+#ifdef _WIN32
+    if (!profile.empty()) throw std::runtime_error("Build profiles aren't supported on Windows");
+#endif
+
+    const std::vector<std::string> unneeded = unneededSources(version_str, tools);
 
-    std::cout << "==> Building source of ";
+    // Everything below happens inside the workspace, which goes away on return or throw
+    Workspace workspace;
+    Journal journal;
+    journal.version = store_version_str;
+    journal.tools = tools;
+
+    fs::path full_source;
+    if (workspace.Resume(sources.build_root, sources.archive_dir, store_version_str, tools, journal)) {
+        full_source = workspace.path / journal.source;
+        std::cout << "==> Resuming the interrupted build of ";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << store_version_str;
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " (already " << phaseName(journal.phase) << ")" << '\n';
+    }
+
+    if (full_source.empty()) {
+        if (sources.git.Enabled()) {
+            if (!GitSource::Available()) {
+                printWarning("git isn't available, downloading the archive instead", use_ansi);
+            } else {
+                full_source = checkout_version(version_str, sources, unneeded, workspace, journal, use_ansi);
+                if (full_source.empty()) printWarning(std::string("Couldn't check out ") + version_str + " with git, downloading the archive instead", use_ansi);
+            }
+        }
+        if (full_source.empty()) full_source = unpack_version(version_str, sources, unneeded, workspace, journal, use_ansi);
+
+        // gcc finds the pgo profiles by the path of the build, a half done one can't continue at another
+        journal.source = full_source.lexically_relative(workspace.path).generic_string();
+        if (profile != "pgo") journal.Record(BuildPhase::Extracted);
+    }
+
+    if (journal.phase < BuildPhase::Built) {
+        build_source(full_source, workspace, tools, version, profile, use_ansi);
+        journal.Record(BuildPhase::Built);
+    }
+
+    printStep("Storing 'dist/' of", store_version_str, use_ansi);
+    {
+        EventPhase phase("store", store_version_str);
+        for (const std::string& tool : tools) {
+            store.Publish(full_source / "dist", store_version_str, tool);
+        }
+    }
+    journal.Record(BuildPhase::Staged);
+}
+
+void prepare_version(const char* version_str, const Store& store, Sources& sources, const std::vector<std::string>& tools, bool use_ansi)
+{
+    std::vector<std::string> missing;
+    for (const std::string& tool : tools) {
+        if (store.Has(version_str, tool)) continue;
+
+        if (!store.peers.empty()) {
+            std::cout << "==> Fetching " << tool << " ";
+            if (use_ansi) std::cout << "\033[36m";
+            std::cout << version_str;
+            if (use_ansi) std::cout << "\033[0m";
+            std::cout << " from peers..." << '\n';
+            EventPhase phase("fetch", tool + "@" + version_str);
+            if (!store.Fetch(version_str, tool).empty()) continue;
+            phase.Fail();
+        }
+
+        missing.push_back(tool);
+    }
+
+    if (!missing.empty()) {
+        build_version(version_str, store, sources, missing, use_ansi);
+    }
+}
+
+void install_version(const char* version_str, const Store& store, Sources& sources, const fs::path& dest_dir, const std::vector<std::string>& tools, State& state, bool use_ansi)
+{
+    prepare_version(version_str, store, sources, tools, use_ansi);
+    activate_version(version_str, store, dest_dir, tools, state, use_ansi);
+}
+
+void activate_version(const char* version_str, const Store& store, const fs::path& dest_dir, const std::vector<std::string>& tools, State& state, bool use_ansi)
+{
+    std::cout << "==> Linking ";
     if (use_ansi) std::cout << "\033[36m";
     std::cout << version_str;
     if (use_ansi) std::cout << "\033[0m";
-    std::cout << "..." << std::endl;
-    CommandResult res = openDir(full_source_string.c_str(), buildToolchain, reinterpret_cast<void*>(&build_data));
-    if (res.exit_code != 0) {
-        sh_remove(full_source_string.c_str());
-        throw std::runtime_error(std::string("Failed to build ") + version_str + ":\nSTDERR: " + res.stderr_str + "\nSTDOUT: " + res.stdout_str);
+    std::cout << " from store..." << '\n';
+    EventPhase phase("link", version_str);
+
+    std::vector<fs::path> entries;
+    for (const std::string& tool : tools) {
+        const fs::path entry = store.Find(version_str, tool);
+        if (entry.empty()) {
+            throw std::runtime_error("Couldn't find " + tool + " " + version_str + " in store");
+        }
+        entries.push_back(entry);
     }
 
-    const fs::path full_dist = full_source / "dist";
-    PATH_MAKE_STRING(full_dist);
+    // Lists the tools whose files are being swapped until all of them are, see clean_interrupted()
+    const fs::path record = dest_dir / (activation_record_prefix + std::to_string(getpid()));
+    std::error_code ec;
+    fs::create_directories(dest_dir, ec);
+    {
+        std::ofstream ofs(record, std::ios::trunc);
+        for (const std::string& tool : tools) ofs << tool << "\n";
+    }
+
+    // A file some tool's manifest lists with the new file's hash and that wasn't
+    // touched since stays, running processes keep their mappings and pages
+    auto unchanged = [&](const StoreFile& file) {
+        for (const auto& [tool, tool_state] : state.installed_tools) {
+            for (const InstalledFile& installed : tool_state.files) {
+                if (installed.path == file.path && installed.hash == file.hash) return matchesManifest(dest_dir / file.path, installed);
+            }
+        }
+        return false;
+    };
+
+    std::size_t files = 0;
+    std::size_t replaced = 0;
+    std::uintmax_t written = 0;
+    for (std::size_t i = 0; i < tools.size(); i++) {
+        const Activation activation = store.Activate(entries[i], dest_dir, unchanged);
+        store.Touch(entries[i]);
+        files += activation.files.size();
+        replaced += activation.replaced;
+        written += activation.written;
+
+        std::vector<InstalledFile> installed;
+        for (const StoreFile& file : activation.files) {
+            const fs::perms perms = fs::status(dest_dir / file.path, ec).permissions();
+            const std::int64_t mtime = fs::last_write_time(dest_dir / file.path, ec).time_since_epoch().count();
+            installed.push_back({file.path, file.size, static_cast<unsigned int>(perms & fs::perms::mask), file.hash, ec ? 0 : mtime});
+
+            // A shared file was just replaced under the other tools that list it
+            state.SetMtime(file.path, file.hash, installed.back().mtime);
+        }
+
+        // Files of the version that was active before and that this one doesn't have
+        for (const InstalledFile& old_file : state.GetFiles(tools[i])) {
+            const bool kept = std::any_of(installed.begin(), installed.end(), [&](const InstalledFile& file) { return file.path == old_file.path; });
+            if (!kept && !state.IsShared(old_file.path, tools[i])) fs::remove(dest_dir / old_file.path, ec);
+        }
+
+        state.SetFiles(tools[i], installed);
+    }
 
-    std::cout << "==> Copying 'dist/' of ";
+    fs::remove(record, ec);
+
+    std::cout << "==> Linked " << replaced;
+    if (replaced < files) std::cout << " of " << files;
+    std::cout << " files (";
     if (use_ansi) std::cout << "\033[36m";
-    std::cout << version_str;
+    std::cout << formatBytes(written);
     if (use_ansi) std::cout << "\033[0m";
-    std::cout << "..." << std::endl;
-    res = copy(full_dist_string.c_str(), dest_dir_string.c_str());
-    if (res.exit_code != 0) {
-        sh_remove(full_source_string.c_str());
-        throw std::runtime_error(std::string("Couldn't copy \"dist\" of ") + version_str + ":\nSTDERR: " + res.stderr_str + "\nSTDOUT: " + res.stdout_str);
+    std::cout << ")";
+    if (replaced < files) std::cout << ", " << files - replaced << " were unchanged";
+    std::cout << '\n';
+}
+
+// Removes the files in 'dir' (not below) that start with 'prefix' and belong to a process that died
+static std::size_t removeDead(const fs::path& dir, const std::string& prefix, bool directories)
+{
+    std::size_t removed = 0;
+    std::error_code ec;
+    for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind(prefix, 0) != 0 || !processGone(namePid(name))) continue;
+
+        std::error_code remove_ec;
+        if (directories) fs::remove_all(entry.path(), remove_ec);
+        else if (!entry.is_directory(remove_ec)) fs::remove(entry.path(), remove_ec);
+        if (!remove_ec) removed++;
+    }
+    return removed;
+}
+
+// What is older than this in the .tmp of a shared store is left over, gc uses the same age
+static const std::chrono::hours shared_tmp_age(1);
+
+// Processes of other users and containers publish into a shared store, a pid
+// that is gone here may still run in another pid namespace
+static void removeStale(const fs::path& dir)
+{
+    const fs::file_time_type now = fs::file_time_type::clock::now();
+    std::error_code ec;
+    for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec)) {
+        std::error_code entry_ec;
+        const fs::file_time_type modified = fs::last_write_time(entry.path(), entry_ec);
+        if (entry_ec || now - modified < shared_tmp_age) continue;
+        fs::remove_all(entry.path(), entry_ec);
+    }
+}
+
+std::vector<std::string> clean_interrupted(const Store& store, const Sources& sources, const fs::path& dest_dir)
+{
+    // Downloads stream into "<archive>.part-<pid>"
+    std::error_code ec;
+    for (const fs::directory_entry& entry : fs::directory_iterator(sources.archive_dir, ec)) {
+        const std::string name = entry.path().filename().string();
+        const std::size_t part = name.rfind(".part-");
+        if (part != std::string::npos && processGone(namePid(name.substr(part)))) fs::remove(entry.path(), ec);
+    }
+
+    // Entries are published through "<root>/.tmp/<version>-<tool>-<pid>", only
+    // the pids in the per-user store are known to be of this host
+    for (const fs::path& root : store.roots) {
+        if (root == store.roots.back()) removeDead(root / ".tmp", "", true);
+        else removeStale(root / ".tmp");
     }
 
-    sh_remove(full_source_string.c_str());
+    sweepWorkspaces(sources.build_root, sources.archive_dir);
+
+    // Activation puts files next to where they go before renaming them into place
+    std::vector<fs::path> dirs = {dest_dir};
+    for (fs::recursive_directory_iterator it(dest_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_directory(ec)) dirs.push_back(it->path());
+    }
+    for (const fs::path& dir : dirs) removeDead(dir, activation_tmp_prefix, false);
+
+    std::vector<std::string> interrupted;
+    for (const fs::directory_entry& entry : fs::directory_iterator(dest_dir, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind(activation_record_prefix, 0) != 0 || !processGone(namePid(name))) continue;
+
+        std::ifstream ifs(entry.path());
+        std::string tool;
+        while (std::getline(ifs, tool)) {
+            if (!tool.empty() && std::find(interrupted.begin(), interrupted.end(), tool) == interrupted.end()) interrupted.push_back(tool);
+        }
+        ifs.close();
+
+        std::error_code remove_ec;
+        fs::remove(entry.path(), remove_ec);
+    }
+    return interrupted;
 }
 
-void uninstall_version(const fs::path& dest_dir, const std::vector<std::string>& tools)
+void verify_version(const char* version_str, const Store& store, const std::vector<std::string>& tools, bool use_ansi)
+{
+    std::cout << "==> Verifying ";
+    if (use_ansi) std::cout << "\033[36m";
+    std::cout << version_str;
+    if (use_ansi) std::cout << "\033[0m";
+    std::cout << "..." << '\n';
+    EventPhase phase("verify", version_str);
+    for (const std::string& tool : tools) {
+        const fs::path entry = store.Find(version_str, tool);
+        if (entry.empty() || !store.Verify(entry)) {
+            throw std::runtime_error("Build of " + tool + " " + version_str + " in store is corrupted");
+        }
+    }
+}
+
+void uninstall_version(const fs::path& dest_dir, const std::vector<std::string>& tools, State& state)
 {
     const fs::path bin_dir = dest_dir / "bin";
     const fs::path tpl_dir = dest_dir / "THIRD_PARTY_LICENSES";
 
     for (const std::string& tool : tools) {
+        const std::vector<InstalledFile> files = state.GetFiles(tool);
+
+        // Installed by an lct that didn't keep a manifest yet, these are the files it put there
+        if (files.empty()) {
 #ifdef _WIN32
-        const fs::path executable = bin_dir / (tool + ".exe");
+            const fs::path executable = bin_dir / (tool + ".exe");
 #else
-        const fs::path executable = bin_dir / tool;
+            const fs::path executable = bin_dir / tool;
 #endif
-        const fs::path tpl = tpl_dir / (tool + ".txt");
+            const fs::path tpl = tpl_dir / (tool + ".txt");
+
+            sh_remove(executable.string().c_str());
+            if (fs::exists(tpl)) sh_remove(tpl.string().c_str());
+            continue;
+        }
 
-        sh_remove(executable.string().c_str());
-        if (fs::exists(tpl)) sh_remove(tpl.string().c_str());
+        for (const InstalledFile& file : files) {
+            if (state.IsShared(file.path, tool)) continue;
+            std::error_code ec;
+            fs::remove(dest_dir / file.path, ec);
+        }
+        if (state.IsInstalled(tool)) state.SetFiles(tool, {});
     }
 }
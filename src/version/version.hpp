@@ -2,6 +2,20 @@
 
 #include <filesystem>
 #include <vector>
+#include "../store/store.hpp"
+#include "../download/mirrors.hpp"
+#include "../data/state.hpp"
 
-void install_version(const char* version_str, const std::filesystem::path& source_dir, const std::filesystem::path& dest_dir, const std::vector<std::string>& tools, bool use_ansi);
-void uninstall_version(const std::filesystem::path& dest_dir, const std::vector<std::string>& tools);
+// Makes sure the store holds a build of every tool, downloading and building once if not
+void prepare_version(const char* version_str, const Store& store, Sources& sources, const std::vector<std::string>& tools, bool use_ansi);
+void install_version(const char* version_str, const Store& store, Sources& sources, const std::filesystem::path& dest_dir, const std::vector<std::string>& tools, State& state, bool use_ansi);
+
+// Links the tools into 'dest_dir' and records what they installed in 'state', see InstalledFile
+void activate_version(const char* version_str, const Store& store, const std::filesystem::path& dest_dir, const std::vector<std::string>& tools, State& state, bool use_ansi);
+// Removes what runs that died left behind: partial downloads and store entries,
+// workspaces that can't be resumed and half activated files. Returns the tools
+// whose activation was interrupted, their files in 'dest_dir' may be a mix of two versions.
+std::vector<std::string> clean_interrupted(const Store& store, const Sources& sources, const std::filesystem::path& dest_dir);
+void verify_version(const char* version_str, const Store& store, const std::vector<std::string>& tools, bool use_ansi);
+// Removes exactly what the tools' manifests in 'state' list, except files another tool installed too
+void uninstall_version(const std::filesystem::path& dest_dir, const std::vector<std::string>& tools, State& state);
@@ -0,0 +1,279 @@
+#include "workspace.hpp"
+#include "../format/format.hpp"
+#include "../shell/shell.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Sources, objects and dist/ all live in the workspace at the same time
+static const std::uintmax_t build_space_factor = 3;
+
+// Memory left for everything else when building on a tmpfs
+static const std::uintmax_t memory_reserve = 512ull * 1024 * 1024;
+
+static const char* const workspace_prefix = "lct-build-";
+
+// Bytes of memory that can still be used without swapping, 0 if unknown
+static std::uintmax_t availableMemory()
+{
+#ifdef __linux__
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    std::uintmax_t kib;
+    std::string unit;
+    while (meminfo >> key >> kib >> unit) {
+        if (key == "MemAvailable:") return kib * 1024;
+    }
+#endif
+    return 0;
+}
+
+static std::uintmax_t availableSpace(const fs::path& path)
+{
+    std::error_code ec;
+    const fs::space_info space = fs::space(path, ec);
+    return ec ? 0 : space.available;
+}
+
+static bool writableDirectory(const fs::path& path)
+{
+    std::error_code ec;
+    if (path.empty() || !fs::is_directory(path, ec)) return false;
+#ifndef _WIN32
+    return access(path.c_str(), W_OK | X_OK) == 0;
+#else
+    return true;
+#endif
+}
+
+// A directory of this user that isn't a symlink, anything else in a shared
+// root may have been put there by someone else
+static bool ownDirectory(const fs::path& path, bool only_owner)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid()) return false;
+    return !only_owner || (st.st_mode & 077) == 0;
+#else
+    std::error_code ec;
+    return fs::is_directory(fs::symlink_status(path, ec));
+#endif
+}
+
+// Everyone can write to /dev/shm, so the workspaces of a user live in
+// "<root>/lct-<uid>" that only they can use. Empty if it doesn't exist or
+// isn't theirs alone.
+static fs::path privateRoot(const fs::path& root, bool create)
+{
+#ifndef _WIN32
+    const fs::path dir = root / ("lct-" + std::to_string(getuid()));
+    if (create && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) return fs::path();
+    return ownDirectory(dir, true) ? dir : fs::path();
+#else
+    (void)create;
+    return root;
+#endif
+}
+
+// Interrupted builds are only resumed this long, a workspace in memory holds on to it until then
+static const auto resume_window = std::chrono::hours(24);
+
+static bool resumable(const fs::path& workspace, Journal& journal)
+{
+    if (!journal.Load(workspace) || journal.phase < BuildPhase::Extracted) return false;
+
+    std::error_code ec;
+    const auto written = fs::last_write_time(workspace / ".journal", ec);
+    return !ec && fs::file_time_type::clock::now() - written < resume_window;
+}
+
+// Workspaces are named "lct-build-<version>-<pid>" in a private root, the ones of processes that
+// died are removed unless their journal lets a later build resume them
+static void removeAbandoned(const fs::path& root)
+{
+    std::error_code ec;
+    for (const fs::directory_entry& entry : fs::directory_iterator(root, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind(workspace_prefix, 0) != 0 || !processGone(namePid(name)) || !ownDirectory(entry.path(), false)) continue;
+
+        Journal journal;
+        if (!resumable(entry.path(), journal)) removeTree(entry.path().string().c_str());
+    }
+}
+
+static std::vector<fs::path> memoryCandidates()
+{
+    std::vector<fs::path> candidates;
+    if (const char* runtime = std::getenv("XDG_RUNTIME_DIR")) candidates.push_back(runtime);
+#ifdef __linux__
+    candidates.push_back("/dev/shm");
+#endif
+    return candidates;
+}
+
+static fs::path memoryRoot(std::uintmax_t required)
+{
+    const std::uintmax_t memory = availableMemory();
+    if (memory < required + memory_reserve) return fs::path();
+
+    for (const fs::path& candidate : memoryCandidates()) {
+        if (!writableDirectory(candidate) || availableSpace(candidate) < required) continue;
+        // Someone else holding the name of the private root only costs the speed of memory
+        if (!privateRoot(candidate, true).empty()) return candidate;
+    }
+    return fs::path();
+}
+
+// Every root 'build_root' may have put a workspace in
+static std::vector<fs::path> buildRoots(const std::string& build_root, const fs::path& disk_root)
+{
+    if (build_root == "disk") return {disk_root};
+    if (!build_root.empty() && build_root != "auto") return {build_root};
+
+    std::vector<fs::path> roots = memoryCandidates();
+    roots.push_back(disk_root);
+    return roots;
+}
+
+void sweepWorkspaces(const std::string& build_root, const fs::path& disk_root)
+{
+    for (const fs::path& root : buildRoots(build_root, disk_root)) {
+        const fs::path private_root = privateRoot(root, false);
+        if (!private_root.empty()) removeAbandoned(private_root);
+    }
+}
+
+Workspace::~Workspace()
+{
+    Remove();
+}
+
+void Workspace::Create(const std::string& build_root, const fs::path& disk_root, const std::string& version, std::uintmax_t needed, bool use_ansi)
+{
+    Remove();
+
+    const std::uintmax_t required = needed * build_space_factor;
+
+    fs::path root;
+    in_memory = false;
+    if (build_root.empty() || build_root == "auto") {
+        root = memoryRoot(required);
+        in_memory = !root.empty();
+        if (!in_memory) {
+            root = disk_root;
+            if (needed > 0) std::cout << "==> Building on disk, no tmpfs of this user has room for the " << formatBytes(required) << " a build in memory needs" << '\n';
+        }
+    } else if (build_root == "disk") {
+        root = disk_root;
+    } else {
+        root = build_root;
+    }
+
+    std::error_code ec;
+    fs::create_directories(root, ec);
+    if (!writableDirectory(root)) throw std::runtime_error("Build root " + root.string() + " isn't a writable directory");
+
+    const std::uintmax_t space = availableSpace(root);
+    if (needed > 0 && space < required) {
+        throw std::runtime_error("Not enough space to build " + version + " in " + root.string() + ": needs " +
+                                 formatBytes(required) + ", " + formatBytes(space) + " available");
+    }
+
+    const fs::path private_root = privateRoot(root, true);
+    if (private_root.empty()) throw std::runtime_error("Couldn't create a build directory in " + root.string() + " that only this user can use");
+    removeAbandoned(private_root);
+
+    path = private_root / (workspace_prefix + version + "-" + std::to_string(getpid()));
+    removeTree(path.string().c_str());
+    fs::create_directories(path, ec);
+    if (ec) throw std::runtime_error("Couldn't create " + path.string() + ": " + ec.message());
+
+    if (in_memory) {
+        std::cout << "==> Building in memory at ";
+        if (use_ansi) std::cout << "\033[36m";
+        std::cout << root.string();
+        if (use_ansi) std::cout << "\033[0m";
+        std::cout << " (" << formatBytes(space) << " free)" << '\n';
+    }
+}
+
+bool Workspace::Resume(const std::string& build_root, const fs::path& disk_root, const std::string& version,
+                       const std::vector<std::string>& tools, Journal& journal)
+{
+    Remove();
+
+    const std::string prefix = workspace_prefix + version + "-";
+    for (const fs::path& root : buildRoots(build_root, disk_root)) {
+        const fs::path private_root = privateRoot(root, false);
+        if (private_root.empty()) continue;
+
+        std::error_code ec;
+        for (const fs::directory_entry& entry : fs::directory_iterator(private_root, ec)) {
+            const std::string name = entry.path().filename().string();
+            if (name.rfind(prefix, 0) != 0 || !processGone(namePid(name.substr(prefix.size() - 1))) || !ownDirectory(entry.path(), false)) continue;
+
+            Journal found;
+            if (!resumable(entry.path(), found) || found.version != version || !found.Covers(tools)) continue;
+
+            // The rename is what claims it, another lct resuming the same build loses
+            const fs::path claimed = private_root / (prefix + std::to_string(getpid()));
+            std::error_code claim_ec;
+            fs::rename(entry.path(), claimed, claim_ec);
+            if (claim_ec) continue;
+
+            path = claimed;
+            in_memory = root != disk_root;
+            journal = found;
+            journal.workspace = claimed;
+            journal.Save();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Workspace::Remove()
+{
+    if (path.empty()) return;
+
+    // A source tree has thousands of files, see removeTree()
+    removeTree(path.string().c_str());
+    path.clear();
+}
+
+std::uintmax_t gzipUncompressedSize(const fs::path& archive)
+{
+    std::ifstream ifs(archive, std::ios::binary);
+    if (!ifs.is_open()) return 0;
+
+    unsigned char magic[2];
+    if (!ifs.read(reinterpret_cast<char*>(magic), 2) || magic[0] != 0x1f || magic[1] != 0x8b) return 0;
+
+    // ISIZE, the size modulo 2^32 of the last member, little endian
+    unsigned char trailer[4];
+    ifs.seekg(-4, std::ios::end);
+    if (!ifs.read(reinterpret_cast<char*>(trailer), 4)) return 0;
+
+    const std::uintmax_t isize = static_cast<std::uintmax_t>(trailer[0]) | (static_cast<std::uintmax_t>(trailer[1]) << 8) |
+                                 (static_cast<std::uintmax_t>(trailer[2]) << 16) | (static_cast<std::uintmax_t>(trailer[3]) << 24);
+
+    // Past 4 GiB it wrapped around, source archives don't compress better than 1:10
+    std::error_code ec;
+    const std::uintmax_t compressed = fs::file_size(archive, ec);
+    if (!ec && isize < compressed) return compressed * 10;
+    return isize;
+}
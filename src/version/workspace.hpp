@@ -0,0 +1,39 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "journal.hpp"
+
+// The directory a source tree is unpacked and built in, deleted with
+// everything in it when the build is done or failed. One left behind by a
+// process that died is kept for Resume() if its journal allows.
+//
+// 'build_root' is a directory, "disk" for 'disk_root' or "auto": a tmpfs
+// ($XDG_RUNTIME_DIR, /dev/shm) when it and the available memory can hold the
+// build, 'disk_root' otherwise. 'needed' is the size of the unpacked sources.
+// Workspaces go into "<root>/lct-<uid>", a directory only the user can access.
+struct Workspace {
+    std::filesystem::path path;
+    bool in_memory = false;
+
+    Workspace() = default;
+    Workspace(const Workspace&) = delete;
+    Workspace& operator=(const Workspace&) = delete;
+    ~Workspace();
+
+    void Create(const std::string& build_root, const std::filesystem::path& disk_root, const std::string& version, std::uintmax_t needed, bool use_ansi);
+
+    // Takes over the workspace of an interrupted build of 'version' for 'tools'
+    // that got its sources extracted, false if there is none
+    bool Resume(const std::string& build_root, const std::filesystem::path& disk_root, const std::string& version,
+                const std::vector<std::string>& tools, Journal& journal);
+    void Remove();
+};
+
+// Removes the workspaces of processes that died, except the ones a build can still resume
+void sweepWorkspaces(const std::string& build_root, const std::filesystem::path& disk_root);
+
+// Uncompressed size from the gzip trailer, 0 if it isn't a gzip file
+std::uintmax_t gzipUncompressedSize(const std::filesystem::path& archive);
@@ -0,0 +1,309 @@
+"""Runs dist/bin/lct against generated source archives, -c removes what the runs left behind"""
+
+from pathlib import Path
+import hashlib
+import http.client
+import io
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tarfile
+import time
+import unittest
+
+root = Path(__file__).resolve().parent.parent
+output = root / "tests" / "output"
+lct = root / "dist" / "bin" / "lct"
+
+version = "v0.1.0-alpha.6"
+top = "LCT-0.1.0-alpha.6"
+
+# Builds an empty lbf into dist/ like the real ci.ci would
+ci_script = b"""import sys
+from pathlib import Path
+args = [a for a in sys.argv[1:] if not a.startswith("-")]
+b = Path("dist/bin"); b.mkdir(parents=True, exist_ok=True)
+for t in args[1:]:
+    (b / t).write_text("#!/bin/sh\\n")
+    (b / t).chmod(0o755)
+"""
+
+# Serves <url basename> out of the archives directory, like a mirror would
+fake_curl = """#!/bin/sh
+url=""
+while [ $# -gt 0 ]; do case "$1" in -o|-D|--connect-timeout|--speed-time|--speed-limit) shift 2;; -*) shift;; *) url="$1"; shift;; esac; done
+f="{archives}/$(basename "$url")"
+[ -f "$f" ] || exit 22
+cat "$f"
+"""
+
+class Member:
+    def __init__(self, name: str, data: bytes = b"", link: str = "", kind: bytes = tarfile.REGTYPE):
+        self.name = name
+        self.data = data
+        self.link = link
+        self.kind = kind
+
+def symlink(name: str, target: str) -> Member:
+    return Member(name, link=target, kind=tarfile.SYMTYPE)
+
+def hardlink(name: str, target: str) -> Member:
+    return Member(name, link=target, kind=tarfile.LNKTYPE)
+
+# A test directory with a fake curl serving the archives in 'archives', and lct
+# running with 'home' as its HOME
+class Fixture(unittest.TestCase):
+    def setUp(self):
+        self.dir = output / self.id().rsplit(".", 1)[-1]
+        shutil.rmtree(self.dir, ignore_errors=True)
+        (self.dir / "bin").mkdir(parents=True)
+        (self.dir / "archives").mkdir()
+        (self.dir / "home").mkdir()
+        self.outside = self.dir / "outside"
+        self.outside.mkdir()
+
+        curl = self.dir / "bin" / "curl"
+        curl.write_text(fake_curl.format(archives=self.dir / "archives"))
+        curl.chmod(0o755)
+
+    def write_archive(self, members: list, name: str = version, prefix: str = top):
+        with tarfile.open(self.dir / "archives" / f"{name}.tar.gz", "w:gz", format=tarfile.GNU_FORMAT) as tar:
+            for member in [Member(f"{prefix}/ci/__init__.py"), Member(f"{prefix}/ci/ci.py", ci_script)] + members:
+                info = tarfile.TarInfo(member.name)
+                info.type = member.kind
+                info.linkname = member.link
+                info.size = len(member.data)
+                info.mode = 0o644
+                tar.addfile(info, io.BytesIO(member.data) if member.kind == tarfile.REGTYPE else None)
+
+    def config(self, text: str, home: str = "home"):
+        (self.dir / home / ".lct").mkdir(parents=True, exist_ok=True)
+        (self.dir / home / ".lct" / "lct.config").write_text(text)
+
+    def lct(self, *args: str, home: str = "home", path: str = "", env: dict = {}) -> subprocess.CompletedProcess:
+        full_env = {"PATH": path or f"{self.dir / 'bin'}:/usr/bin:/bin", "HOME": str(self.dir / home), **env}
+        return subprocess.run([str(lct), *args], env=full_env, cwd=self.dir, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+
+class Untar(Fixture):
+    def install(self, members: list) -> int:
+        self.write_archive(members)
+        return self.lct("install", f"lbf@{version}").returncode
+
+    def test_symlinks_inside(self):
+        self.assertEqual(self.install([
+            Member(f"{top}/tools/lbf/main.c", b"int main() {}\n"),
+            symlink(f"{top}/tools/main.c", "lbf/main.c"),
+            symlink(f"{top}/tools/lbf/ci", "../../ci"),
+            hardlink(f"{top}/tools/lbf/copy.c", f"{top}/tools/lbf/main.c")
+        ]), 0)
+
+    def test_absolute_symlink(self):
+        self.assertNotEqual(self.install([
+            symlink(f"{top}/evil", str(self.outside)),
+            Member(f"{top}/evil/pwned", b"pwned\n")
+        ]), 0)
+        self.assertFalse((self.outside / "pwned").exists())
+
+    def test_relative_symlink_out(self):
+        self.assertNotEqual(self.install([symlink(f"{top}/evil", "../../../../outside")]), 0)
+
+    def test_symlink_through_symlink(self):
+        # Every link stays inside by its names, but "up" goes up one level more
+        self.assertNotEqual(self.install([
+            symlink(f"{top}/a/up", ".."),
+            symlink(f"{top}/a/evil", "up/../.."),
+        ]), 0)
+
+    def test_hardlink_through_symlink(self):
+        self.assertNotEqual(self.install([
+            symlink(f"{top}/evil", str(self.outside)),
+            hardlink(f"{top}/evil/pwned", f"{top}/ci/ci.py")
+        ]), 0)
+        self.assertFalse((self.outside / "pwned").exists())
+
+class Bundle(unittest.TestCase):
+    def setUp(self):
+        self.dir = output / self.id().rsplit(".", 1)[-1]
+        shutil.rmtree(self.dir, ignore_errors=True)
+        (self.dir / "home").mkdir(parents=True)
+        self.outside = self.dir / "outside"
+        self.outside.mkdir()
+
+    # Writes the files uncompressed, in the layout of src/bundle/bundle.hpp
+    def import_bundle(self, files: dict) -> int:
+        data = b"LCTBNDL1"
+        index = "bundle=1\nplatform=linux-x86_64\n"
+        for name, content in files.items():
+            index += f"file={name},{len(data)},{len(content)},{len(content)},{hashlib.sha256(content).hexdigest()},-\n"
+            data += content
+        bundle = self.dir / "test.lctb"
+        bundle.write_bytes(data + index.encode() + struct.pack("<QQ", len(data), len(index)) + b"LCTBNDL1")
+
+        env = {"PATH": "/usr/bin:/bin", "HOME": str(self.dir / "home")}
+        return subprocess.run([str(lct), "bundle", "import", str(bundle)], env=env, cwd=self.dir, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode
+
+    def test_valid_names(self):
+        self.assertEqual(self.import_bundle({f"archives/{version}.tar.gz": b"archive"}), 0)
+
+    def test_dot_dot_name(self):
+        self.assertNotEqual(self.import_bundle({
+            f"store/{version}/lbf/bin/lbf": b"lbf",
+            f"store/{version}/lbf/../../../../../../../outside/pwned": b"pwned\n"
+        }), 0)
+        self.assertFalse((self.outside / "pwned").exists())
+
+    def test_absolute_name(self):
+        self.assertNotEqual(self.import_bundle({f"store/{version}/lbf/{self.outside}/pwned": b"pwned\n"}), 0)
+        self.assertNotEqual(self.import_bundle({"/archives/pwned": b"pwned\n"}), 0)
+
+# Another lct instance on localhost, for the tests of 'lct serve' and its peers
+class Serve(Fixture):
+    def setUp(self):
+        super().setUp()
+        with socket.socket() as probe:
+            probe.bind(("127.0.0.1", 0))
+            self.port = probe.getsockname()[1]
+
+        self.config("serve_bind=127.0.0.1\n")
+        archive_dir = self.dir / "home" / ".lct" / "archives"
+        archive_dir.mkdir()
+        self.data = bytes(range(100))
+        (archive_dir / "data.bin").write_bytes(self.data)
+        (self.dir / "home" / ".lct" / "secret").write_text("secret\n")
+
+        self.server = subprocess.Popen([str(lct), "serve", f"--port={self.port}"], env={"PATH": "/usr/bin:/bin", "HOME": str(self.dir / "home")},
+                                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        for _ in range(100):
+            try:
+                socket.create_connection(("127.0.0.1", self.port), timeout=1).close()
+                break
+            except OSError:
+                time.sleep(0.05)
+
+    def tearDown(self):
+        self.server.terminate()
+        self.server.wait()
+
+    def get(self, target: str, headers: dict = {}) -> http.client.HTTPResponse:
+        connection = http.client.HTTPConnection("127.0.0.1", self.port, timeout=10)
+        connection.request("GET", target, headers=headers)
+        response = connection.getresponse()
+        response.body = response.read()
+        connection.close()
+        return response
+
+    def test_whole_file(self):
+        response = self.get("/archives/data.bin")
+        self.assertEqual(response.status, 200)
+        self.assertEqual(response.body, self.data)
+
+    def test_range(self):
+        response = self.get("/archives/data.bin", {"Range": "bytes=10-19"})
+        self.assertEqual(response.status, 206)
+        self.assertEqual(response.body, self.data[10:20])
+        self.assertEqual(response.getheader("Content-Range"), "bytes 10-19/100")
+
+    def test_suffix_range(self):
+        response = self.get("/archives/data.bin", {"Range": "bytes=-10"})
+        self.assertEqual(response.status, 206)
+        self.assertEqual(response.body, self.data[90:])
+        self.assertEqual(response.getheader("Content-Range"), "bytes 90-99/100")
+
+    def test_open_range(self):
+        response = self.get("/archives/data.bin", {"Range": "bytes=95-"})
+        self.assertEqual(response.status, 206)
+        self.assertEqual(response.body, self.data[95:])
+
+    def test_unsatisfiable_range(self):
+        response = self.get("/archives/data.bin", {"Range": "bytes=100-"})
+        self.assertEqual(response.status, 416)
+        self.assertEqual(response.getheader("Content-Range"), "bytes */100")
+        self.assertEqual(self.get("/archives/data.bin", {"Range": "bytes=-0"}).status, 416)
+
+    def test_dot_dot(self):
+        self.assertEqual(self.get("/archives/../secret").status, 404)
+        self.assertEqual(self.get("/store/../secret").status, 404)
+
+    def test_percent(self):
+        self.assertEqual(self.get("/archives/%2e%2e/secret").status, 404)
+        self.assertEqual(self.get("/archives/data%2ebin").status, 404)
+
+    def test_peer_fetch(self):
+        self.write_archive([Member(f"{top}/tools/lbf/main.c", b"int main() {}\n")])
+        self.assertEqual(self.lct("install", f"lbf@{version}").returncode, 0)
+
+        # Nothing to build from, so the entry can only come from the peer
+        self.config(f"peers=http://127.0.0.1:{self.port}\nmirrors=http://127.0.0.1:1\n", home="peer")
+        self.assertEqual(self.lct("install", f"lbf@{version}", home="peer", path="/usr/bin:/bin").returncode, 0)
+        self.assertTrue((self.dir / "peer" / ".lct" / "current" / "bin" / "lbf").is_file())
+
+class Commands(Fixture):
+    def setUp(self):
+        super().setUp()
+        self.write_archive([Member(f"{top}/tools/lbf/main.c", b"int main() {}\n")])
+
+    def test_gc(self):
+        # Earlier generations would keep the uninstalled version
+        self.config("keep_generations=0\n")
+        store = self.dir / "home" / ".lct" / "store"
+        self.assertEqual(self.lct("install", f"lbf@{version}").returncode, 0)
+        self.assertEqual(self.lct("gc").returncode, 0)
+        self.assertTrue((store / version / "lbf").is_dir())
+
+        self.assertEqual(self.lct("uninstall", "lbf").returncode, 0)
+        self.assertEqual(self.lct("gc").returncode, 0)
+        self.assertFalse((store / version / "lbf").exists())
+
+    def test_shim(self):
+        self.config("shims=true\n")
+        self.assertEqual(self.lct("install", f"lbf@{version}").returncode, 0)
+
+        shim = str(self.dir / "home" / ".lct" / "current" / "bin" / "lbf")
+        run = lambda pinned: subprocess.run([shim], env={"PATH": "/usr/bin:/bin", "HOME": str(self.dir / "home"), "LCT_VERSION": pinned},
+                                            cwd=self.dir, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode
+        self.assertEqual(run(""), 0)
+        self.assertEqual(run(version), 0)
+        self.assertEqual(run("../../../outside"), 127)
+        self.assertEqual(run("v0.1.0-alpha.6.2"), 127)
+
+    def test_apply_order(self):
+        # A dependency listed at another version wins over the implicit one, whatever the order
+        plans = []
+        for manifest in ([f"lasm@{version}", "lasmp@v0.1.0-alpha.6.2"], ["lasmp@v0.1.0-alpha.6.2", f"lasm@{version}"]):
+            (self.dir / "lct.manifest").write_text("\n".join(manifest) + "\n")
+            result = self.lct("apply", str(self.dir / "lct.manifest"), "--dry-run")
+            self.assertEqual(result.returncode, 0)
+            plans.append(sorted(line.strip() for line in result.stdout.splitlines() if line.strip().startswith(("+", "*"))))
+        self.assertEqual(plans[0], plans[1])
+        self.assertIn("* lasmp@v0.1.0-alpha.6.2 (active)", plans[0])
+
+    def test_verify(self):
+        self.assertEqual(self.lct("install", f"lbf@{version}").returncode, 0)
+        self.assertEqual(self.lct("verify").returncode, 0)
+
+        binary = self.dir / "home" / ".lct" / "current" / "bin" / "lbf"
+        binary.unlink()
+        binary.write_text("#!/bin/sh\necho tampered\n")
+        self.assertNotEqual(self.lct("verify").returncode, 0)
+        self.assertEqual(self.lct("verify", "--repair").returncode, 0)
+        self.assertEqual(self.lct("verify").returncode, 0)
+
+    def test_verify_shims(self):
+        self.config("shims=true\n")
+        self.assertEqual(self.lct("install", f"lbf@{version}").returncode, 0)
+        self.assertEqual(self.lct("verify").returncode, 0)
+
+if __name__ == "__main__":
+    if "-c" in sys.argv[1:]:
+        shutil.rmtree(output, ignore_errors=True)
+        sys.exit(0)
+
+    if sys.platform == "win32":
+        print("Skipping the tests, Windows sources come as zips")
+        sys.exit(0)
+
+    result = unittest.main(exit=False).result
+    sys.exit(0 if result.wasSuccessful() else 1)